@@ -11,48 +11,368 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace MMIntern {
 class MemoryClass;
 class HttpClient;
+class ThreadPool;
+class MemoryStatsTable;
+struct ResponseHeaders;
 }
+class MeteomaticsMappedTimeSeries;
+class MeteomaticsReduction;
+
+// results are [row][column], the value type is double unless single precision is requested
+template<class T>
+using BasicMatrix = std::vector<std::vector<T>>;
+typedef BasicMatrix<double> Matrix;
+typedef BasicMatrix<float> FloatMatrix;
+
+
+//
+// Token bucket limiting requests/s and bytes/s, shared by all clients using the same account.
+//   Interactive requests are always served before waiting backfill requests.
+//
+class MeteomaticsRateLimiter
+{
+public:
+    enum Priority
+    {
+        Interactive = 0,
+        Backfill = 1
+    };
+    
+    // a rate <= 0 disables the respective limit, burstSeconds is the bucket size in seconds of rate
+    MeteomaticsRateLimiter(const double requestsPerSecond, const double bytesPerSecond, const double burstSeconds=1.0);
+    
+    // blocks until the request may be sent, returns false if the deadline passed before
+    bool acquire(const Priority priority, const std::chrono::steady_clock::time_point& deadline=std::chrono::steady_clock::time_point::max());
+    bool tryAcquire(const Priority priority, double& waitSeconds);  // non-blocking, otherwise returns the time to wait
+    void consumeBytes(const std::size_t bytes);         // debits received bytes, the byte bucket may go into debt
+    void holdFor(const double seconds);                 // e.g. due to a Retry-After header, holds back all lanes
+    void pauseFor(const double seconds);                // holdFor and wait until the pause is over
+    
+    std::size_t numWaiting(const Priority priority) const;
+    
+private:
+    typedef std::chrono::steady_clock Clock;
+    
+    void refill(const Clock::time_point now);
+    bool take(const Priority priority, double& waitSeconds);
+    
+    const double requestRate;
+    const double byteRate;
+    const double requestCapacity;
+    const double byteCapacity;
+    
+    double requestTokens;
+    double byteTokens;
+    Clock::time_point lastRefill;
+    Clock::time_point pausedUntil;
+    std::size_t waiting[2];
+    
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+};
+
+
+//
+// Cancels requests in flight. Copies refer to the same flag, a default constructed token is never cancelled.
+//
+class MeteomaticsCancellationToken
+{
+public:
+    MeteomaticsCancellationToken();
+    static MeteomaticsCancellationToken create();
+    
+    void cancel() const;
+    bool isCancelled() const;
+    bool canBeCancelled() const;
+    
+private:
+    std::shared_ptr<std::atomic<bool>> flag;
+};
+
+
+//
+// Per-call deadline and cancellation. Once expired, the transfer is aborted and decoding stops.
+//
+struct MeteomaticsRequestControl
+{
+    MeteomaticsRequestControl();
+    MeteomaticsRequestControl(const std::chrono::steady_clock::time_point& deadline, const MeteomaticsCancellationToken& cancellation=MeteomaticsCancellationToken());
+    MeteomaticsRequestControl(const MeteomaticsCancellationToken& cancellation);
+    
+    static MeteomaticsRequestControl withTimeout(const std::chrono::milliseconds& timeout, const MeteomaticsCancellationToken& cancellation=MeteomaticsCancellationToken());
+    
+    bool hasDeadline() const;
+    bool expired() const;
+    long remainingMilliseconds() const;         // LONG_MAX without deadline
+    std::string reason() const;                 // message for an expired request
+    
+    std::chrono::steady_clock::time_point deadline;
+    MeteomaticsCancellationToken cancellation;
+};
+
+
+//
+// Archive of raw responses (query path, http code, headers, body) for offline benchmarks and regression tests.
+//   While recording, every response received by the clients using the archive is appended to the file.
+//   While replaying, responses are served from the file without any network: repeated queries get their
+//   recordings in order, then the last one again. Queries not in the archive fail with code 404, as does
+//   a recorded 304 requested without If-None-Match or If-Modified-Since (a server wouldn't have sent it).
+//
+class MeteomaticsTransportArchive
+{
+public:
+    MeteomaticsTransportArchive();
+    ~MeteomaticsTransportArchive();
+    
+    bool record(const std::string& path, std::string& msg, const bool append=true);
+    bool replay(const std::string& path, std::string& msg, const bool mapped=true);  // mapped or read into memory
+    void close();
+    
+    bool isRecording() const;
+    bool isReplaying() const;
+    std::vector<std::string> queries() const;   // recorded query paths, sorted
+    std::size_t numRecords() const;
+    std::size_t numReplayed() const;
+    std::size_t numMissing() const;
+    std::vector<std::string> requestHeaders(const std::string& query, const std::size_t n) const;   // sent with the n-th replay of query
+    
+    // used by the http client, headers are "name: value" lines
+    void add(const std::string& query, const int httpCode, const std::string& headers, const char* body, const std::size_t size);
+    bool find(const std::string& query, const std::vector<std::string>& requestHeaders, int& httpCode, std::string& headers, const char*& body, std::size_t& size);
+    
+private:
+    struct Record
+    {
+        int httpCode;
+        std::string headers;
+        std::size_t offset;                     // of the body
+        std::size_t size;
+    };
+    
+    std::FILE* out;
+    std::vector<char> buffer;
+    void* mapping;
+    const char* data;
+    std::size_t dataBytes;
+    bool replaying;
+    std::map<std::string, std::vector<Record>> records;
+    std::map<std::string, std::size_t> cursors;
+    std::map<std::string, std::vector<std::vector<std::string>>> requests;
+    std::size_t recorded;
+    std::size_t replayed;
+    std::size_t missing;
+    mutable std::mutex mutex;
+    
+    static const uint32_t recordMagic = 0x51524D4D;   // "MMRQ"
+};
+
+
+//
+// Timeline of the request lifecycle as Chrome trace events, to be loaded into chrome://tracing or ui.perfetto.dev.
+//   Clients using the tracer emit a span per phase (query build, queue wait, dns, connect, tls, server wait,
+//   transfer, decode, reverse, result assembly) on the thread that ran it. Shared by any number of clients.
+//
+class MeteomaticsTracer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    
+    MeteomaticsTracer(const std::size_t maxEvents=1000000);    // further spans are dropped
+    
+    void addSpan(const char* name, const char* category, const Clock::time_point& start, const Clock::time_point& end, const std::string& detail=std::string());
+    
+    std::string toJson() const;                 // {"traceEvents": [...]}, times in microseconds since construction
+    bool write(const std::string& path, std::string& msg) const;
+    void clear();
+    
+    std::size_t numEvents() const;
+    std::size_t numDropped() const;
+    
+private:
+    struct Event
+    {
+        const char* name;                       // string literals
+        const char* category;
+        std::size_t thread;
+        long long start;                        // microseconds since epoch
+        long long duration;
+        std::string detail;
+    };
+    
+    const std::size_t maxEvents;
+    const Clock::time_point epoch;
+    std::vector<Event> events;
+    std::vector<std::thread::id> threads;       // index + 1 is the tid in the trace
+    std::size_t dropped;
+    mutable std::mutex mutex;
+};
+
+
+//
+// Heap allocations of requests. Only counted if the application defines METEOMATICS_COUNT_ALLOCATIONS
+// before including the client, which replaces the global operator new/delete.
+//
+struct MeteomaticsAllocationStats
+{
+    MeteomaticsAllocationStats();
+    
+    std::size_t allocations;
+    std::size_t bytesAllocated;
+    std::size_t peakLiveBytes;                  // maximum over all requests
+};
+
+struct MeteomaticsMemoryStats
+{
+    MeteomaticsMemoryStats();
+    
+    std::size_t requests;
+    MeteomaticsAllocationStats receiveBuffer;   // response body and transfer
+    MeteomaticsAllocationStats decodedResult;   // matrices, rows and time strings
+};
+
+
+//
+// Query shape compiled once by MeteomaticsApiClient::prepare*, executed with only the time changing.
+// Keeps the receive buffer between executions, so a prepared query is used by one thread at a time.
+//
+class MeteomaticsPreparedQuery
+{
+public:
+    enum Kind
+    {
+        None = 0,
+        MultiPointTimeSeries,
+        Grid
+    };
+    
+    MeteomaticsPreparedQuery();
+    
+    Kind kind() const;
+    std::size_t numCoordinates() const;         // time series: number of coordinates
+    std::size_t numParameters() const;
+    int numLat() const;                         // grid: shape of the result
+    int numLon() const;
+    
+private:
+    friend class MeteomaticsApiClient;
+    
+    Kind queryKind;
+    std::string pathSuffix;                     // everything after the time component
+    std::size_t coordinates;
+    std::size_t parameters;
+    int gridLat;
+    int gridLon;
+    std::vector<char> receiveBuffer;
+};
 
-typedef std::vector<std::vector<double>> Matrix;
 
 class MeteomaticsApiClient
 {
 public:
 
+    enum QueryType
+    {
+        PointQuery = 0,
+        GridQuery,
+        TimeSeriesQuery,
+        MultiPointTimeSeriesQuery,
+        MultiPointsQuery,
+        NumQueryTypes
+    };
+
     MeteomaticsApiClient(const std::string& _user, const std::string& password, const int timeout_seconds);
     
     //
     // -- query for a single point (one time, one coordinate)
     //
-    bool getPoint(const std::string& time, const std::vector<std::string>& parameters, double lat, double lon, std::vector<double>& result, std::string& msg, const std::vector<std::string>& optionals={}) const;
+    bool getPoint(const std::string& time, const std::vector<std::string>& parameters, double lat, double lon, std::vector<double>& result, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
     
     //
     // -- query for points on a grid points (one time, coordinate grid)
     //
-    bool getGrid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nrGridPts_Lat, const int nrGridPts_Lon, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const std::vector<std::string>& optionals={}) const;
+    bool getGrid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nrGridPts_Lat, const int nrGridPts_Lon, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    
+    //
+    // -- same in single precision: the grid is requested as float and decoded without widening, at half the memory
+    //
+    bool getGrid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nrGridPts_Lat, const int nrGridPts_Lon, FloatMatrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
     
 
     //
     // -- query for several times at a single point (multiple times, single coordinate)
     //
-    bool getTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, double lat, double lon, Matrix& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals={}) const;
+    bool getTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, double lat, double lon, Matrix& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
     
     //
     // -- query for several times at multiple points (several times, multiple points)
     //
-    bool getMultiPointTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, std::vector<double> lats, std::vector<double> lons, std::vector<Matrix>& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals={}) const;
+    bool getMultiPointTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, std::vector<double> lats, std::vector<double> lons, std::vector<Matrix>& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
     
     //
     // -- query for a single time and multiple points (one time, multiple points)
     //
-    bool getMultiPoints(const std::string& time, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, Matrix& result, std::string& msg, const std::vector<std::string>& optionals={}) const;
+    bool getMultiPoints(const std::string& time, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, Matrix& result, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+
+    //
+    // -- same as the three getters above, but transferred in the csv format of the API (e.g. for options only available there)
+    //
+    bool getTimeSeriesCsv(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, double lat, double lon, Matrix& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool getMultiPointTimeSeriesCsv(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, std::vector<Matrix>& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool getMultiPointsCsv(const std::string& time, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, Matrix& result, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
 
+    //
+    // -- compile the time independent part of a query once (validating all inputs), for queries repeated with different times
+    //
+    bool prepareMultiPointTimeSeries(const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, MeteomaticsPreparedQuery& query, std::string& msg, const std::vector<std::string>& optionals={}) const;
+    bool prepareGrid(const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, MeteomaticsPreparedQuery& query, std::string& msg, const std::vector<std::string>& optionals={}) const;
+    
+    //
+    // -- execute a prepared query, results of the same shape as in the previous execution reuse their buffers
+    //
+    bool executeMultiPointTimeSeries(MeteomaticsPreparedQuery& query, const std::string& startTime, const std::string& stopTime, std::vector<Matrix>& result, std::vector<std::string>& times, std::string& msg, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool executeGrid(MeteomaticsPreparedQuery& query, const std::string& time, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    
+    //
+    // -- query the coordinates [firstCoordinate, firstCoordinate+numCoordinates) and times [firstTime, firstTime+numTimes)
+    //    of a memory-mapped series (see Meteomatics_MappedResult.h), the values are decoded straight into the file
+    //
+    bool getMultiPointTimeSeries(MeteomaticsMappedTimeSeries& series, const std::size_t firstCoordinate, const std::size_t numCoordinates, const std::size_t firstTime, const std::size_t numTimes, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    
+    //
+    // -- evaluate the operators of a reduction while the response is decoded, only the aggregates are kept
+    //    (see Meteomatics_Reduction.h), e.g. daily extremes per station or the mean over a grid
+    //
+    bool getGrid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nrGridPts_Lat, const int nrGridPts_Lon, MeteomaticsReduction& reduction, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool getMultiPointTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, MeteomaticsReduction& reduction, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    
+    //
+    // -- the getters for a parameter set declared at compile time (see Meteomatics_ParameterSet.h), e.g. getTimeSeries<Weather>(...),
+    //    every time decoded into a ParameterSet::Row with a column per parameter of the set
+    //
+    template<class ParameterSet>
+    bool getPoint(const std::string& time, double lat, double lon, typename ParameterSet::Row& result, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    template<class ParameterSet>
+    bool getTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, double lat, double lon, std::vector<typename ParameterSet::Row>& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    template<class ParameterSet>
+    bool getMultiPointTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<double>& lats, const std::vector<double>& lons, std::vector<std::vector<typename ParameterSet::Row>>& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    template<class ParameterSet>
+    bool getMultiPoints(const std::string& time, const std::vector<double>& lats, const std::vector<double>& lons, std::vector<typename ParameterSet::Row>& result, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    
     //
     // -- returns an iso-date string for 6 ints (or for a vector with 6 ints)
     //
@@ -73,6 +393,38 @@ public:
     int getTomorrowsMonth() const;
     int getTomorrowsYear() const;
     
+    //
+    // -- routes all requests of this client through a (shared) rate limiter, within the given priority lane
+    //
+    void setRateLimiter(const std::shared_ptr<MeteomaticsRateLimiter>& rateLimiter, const MeteomaticsRateLimiter::Priority priority=MeteomaticsRateLimiter::Interactive);
+    
+    //
+    // -- records all responses of this client into the archive, or serves them from it without network
+    //
+    void setTransportArchive(const std::shared_ptr<MeteomaticsTransportArchive>& archive);
+    
+    //
+    // -- emits a trace span per phase of every request of this client into the tracer
+    //
+    void setTracer(const std::shared_ptr<MeteomaticsTracer>& tracer);
+    
+    //
+    // -- resolves the server and opens numConnections connections ahead of the first query, returns the number opened
+    //
+    std::size_t warmUp(const std::size_t numConnections=4) const;
+    
+    //
+    // -- decode large multi point time series on numThreads threads (including the calling one), 1 disables it
+    //
+    void setDecodeThreads(const std::size_t numThreads);
+    
+    //
+    // -- allocations of the synchronous getters per query type, split into receive buffer and decoded result
+    //
+    MeteomaticsMemoryStats getMemoryStats(const QueryType type) const;
+    void resetMemoryStats();
+    static bool memoryStatsAvailable();         // false unless built with METEOMATICS_COUNT_ALLOCATIONS
+    
     // free ressources
     ~MeteomaticsApiClient();
     
@@ -86,14 +438,48 @@ protected:
 
     static std::string getOptionalSelectString(const std::vector<std::string>& optionals);
 
-    bool readSinglePointTimeSeriesBin(MMIntern::MemoryClass& mem, Matrix& results, std::vector<std::string>& times) const;
-    bool readMultiPointTimeSeriesBin(MMIntern::MemoryClass& mem, std::vector<Matrix>& results, std::vector<std::string>& times) const;
-    bool readGridAndMatrixFromMBG2Format(MMIntern::MemoryClass& mem, Matrix& results, std::vector<double>& lats, std::vector<double>& lons) const;
+    static std::string createGridQuery(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, const std::vector<std::string>& optionals);
+    static std::string createMultiPointTimeSeriesQuery(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, const std::vector<std::string>& optionals, const std::string& format="bin");
+    static std::string createMultiPointTimeSeriesQuery(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const char* parameterList, const std::vector<double>& lats, const std::vector<double>& lons, const std::vector<std::string>& optionals, const std::string& format="bin");
+
+    // getGrid for values of type T (double or float), requesting the matching precision
+    template<class T>
+    bool requestGrid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, BasicMatrix<T>& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const;
+
+    // false with msg set if the request expired or the server answered with an error (body is its message)
+    bool checkResponse(const int httpReturnCode, const char* body, const std::size_t size, std::string& msg, const MeteomaticsRequestControl& control) const;
+    // request a binary body and check the response
+    bool fetchBinary(const std::string& queryString, MMIntern::MemoryClass& mem, int& httpReturnCode, std::string& msg, const MeteomaticsRequestControl& control) const;
+    bool fetchBinary(const std::string& queryString, MMIntern::MemoryClass& mem, int& httpReturnCode, std::string& msg, const MeteomaticsRequestControl& control, const std::vector<std::string>& requestHeaders, MMIntern::ResponseHeaders& responseHeaders) const;
+
+    // check the http code and decode a received body, shared by the synchronous and asynchronous getters
+    template<class T>
+    bool decodeGrid(MMIntern::MemoryClass& mem, const int httpReturnCode, BasicMatrix<T>& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool decodeMultiPointTimeSeries(MMIntern::MemoryClass& mem, const int httpReturnCode, const std::size_t numCoordinates, std::vector<Matrix>& result, std::vector<std::string>& times, std::string& msg, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool decodeMultiPointTimeSeriesCsv(const std::string& csv, const int httpReturnCode, const std::size_t numCoordinates, std::vector<Matrix>& result, std::vector<std::string>& times, std::string& msg, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+
+    bool readSinglePointTimeSeriesBin(MMIntern::MemoryClass& mem, Matrix& results, std::vector<std::string>& times, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool readMultiPointTimeSeriesBin(MMIntern::MemoryClass& mem, std::vector<Matrix>& results, std::vector<std::string>& times, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool readMultiPointTimeSeriesBinParallel(MMIntern::MemoryClass& mem, std::vector<Matrix>& results, std::vector<std::string>& times, MMIntern::ThreadPool& pool, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool readMultiPointTimeSeriesBinInPlace(MMIntern::MemoryClass& mem, const std::size_t numCoordinates, std::vector<Matrix>& results, std::vector<std::string>& times, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool readMultiPointTimeSeriesCsv(const std::string& csv, const std::size_t numCoordinates, std::vector<Matrix>& results, std::vector<std::string>& times, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    template<std::size_t N>
+    bool readMultiPointTimeSeriesBinRows(MMIntern::MemoryClass& mem, const std::size_t numCoordinates, std::vector<std::vector<std::array<double, N>>>& results, std::vector<std::string>& times, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool readMultiPointTimeSeriesBinInto(MMIntern::MemoryClass& mem, MeteomaticsMappedTimeSeries& series, const std::size_t firstCoordinate, const std::size_t numCoordinates, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool reduceMultiPointTimeSeriesBin(MMIntern::MemoryClass& mem, const std::size_t numCoordinates, MeteomaticsReduction& reduction, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool reduceGridMBG2(MMIntern::MemoryClass& mem, MeteomaticsReduction& reduction, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    bool readMBG2Header(MMIntern::MemoryClass& mem, int32_t& precision, double& forecastDateUx, std::vector<double>& lats, std::vector<double>& lons) const;
+    template<class T>
+    bool readGridAndMatrixFromMBG2Format(MMIntern::MemoryClass& mem, BasicMatrix<T>& results, std::vector<double>& lats, std::vector<double>& lons, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
 
     void datevec(double time, double& year, double& month, double& day, double& hour, double& minute, double& second) const;
     std::string convDateIso8601(double date) const;
 
-    const MMIntern::HttpClient* httpClient;
+    MMIntern::HttpClient* httpClient;
+    MMIntern::ThreadPool* decodePool;
+    MMIntern::MemoryStatsTable* memoryStats;
+    
+    static const std::size_t parallelDecodeMinBytes = 1 << 20;
 
     const int dataRequestTimeout;
 
@@ -0,0 +1,470 @@
+//
+//  Meteomatics_Async.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_Async_h
+#define Meteomatics_Async_h
+
+#include "Meteomatics_ApiClient.h"
+
+#include <deque>
+#include <functional>
+#include <map>
+
+#if METEOMATICS_COROUTINES
+#include <coroutine>
+#include <exception>
+#endif
+
+
+struct MeteomaticsGridResult
+{
+    bool success = false;
+    Matrix gridResult;                          // [lat][lon]
+    std::vector<double> latGridPts;
+    std::vector<double> lonGridPts;
+    std::string msg;
+};
+
+struct MeteomaticsTimeSeriesResult
+{
+    bool success = false;
+    std::vector<Matrix> result;                 // [coordinate][time][parameter]
+    std::vector<std::string> times;
+    std::string msg;
+};
+
+namespace MMIntern {
+    class TransferEngine;
+}
+
+
+//
+//  METEOMATICS TRANSFER ENGINE
+//
+//  Non-blocking transfers on top of the libcurl multi interface. A single thread drives
+//  any number of outstanding transfers by calling poll(); completion callbacks are invoked
+//  from within poll() on that thread. submit() and poll() must be called from the same thread.
+//
+class MMIntern::TransferEngine
+{
+public:
+    typedef std::function<void(MemoryClass& mem, int http_code)> Completion;
+
+    TransferEngine(const HttpClient& httpClient, const int timeout, const std::size_t maxConcurrentTransfers);
+    ~TransferEngine();
+
+    void submit(const std::string& path, const Completion& completion, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    // drives the transfers for at most timeoutMilliseconds, returns the number of outstanding transfers
+    std::size_t poll(const int timeoutMilliseconds);
+    std::size_t numOutstanding() const;
+
+private:
+    struct Transfer
+    {
+        std::string path;
+        std::string query;
+        MemoryClass mem;
+        ResponseHeaders responseHeaders;
+        struct curl_slist* headers;
+        Completion completion;
+        MeteomaticsRequestControl control;
+        int attempts;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    double startPending();                      // returns the time until the rate limiter admits the next transfer
+    void finish(CURL* curl, CURLcode res);
+
+    const HttpClient& httpClient;
+    const int timeout;
+    const std::size_t maxConcurrent;
+
+    CURLM* multi;
+    std::deque<std::unique_ptr<Transfer>> pending;
+    std::map<CURL*, std::unique_ptr<Transfer>> running;
+
+    static const int maxRetries = 3;
+};
+
+MMIntern::TransferEngine::TransferEngine(const HttpClient& _httpClient, const int _timeout, const std::size_t maxConcurrentTransfers)
+: httpClient(_httpClient)
+, timeout(_timeout)
+, maxConcurrent(std::max<std::size_t>(1, maxConcurrentTransfers))
+, multi(curl_multi_init())
+{
+    if (!multi)
+    {
+        std::cout << "curl_multi_init failed" << std::endl;
+        assert(false);
+    }
+}
+
+MMIntern::TransferEngine::~TransferEngine()
+{
+    for (auto& r : running)
+    {
+        curl_multi_remove_handle(multi, r.first);
+        curl_easy_cleanup(r.first);
+        curl_slist_free_all(r.second->headers);
+    }
+    curl_multi_cleanup(multi);
+}
+
+void MMIntern::TransferEngine::submit(const std::string& path, const Completion& completion, const MeteomaticsRequestControl& control)
+{
+    std::unique_ptr<Transfer> transfer(new Transfer());
+    transfer->path = path;
+    transfer->query = httpClient.getServer() + path;
+    transfer->mem.mem.reserve(500);
+    transfer->headers = nullptr;
+    transfer->completion = completion;
+    transfer->control = control;
+    transfer->attempts = 0;
+    pending.push_back(std::move(transfer));
+}
+
+std::size_t MMIntern::TransferEngine::numOutstanding() const
+{
+    return pending.size() + running.size();
+}
+
+double MMIntern::TransferEngine::startPending()
+{
+    MeteomaticsRateLimiter* rateLimiter = httpClient.getRateLimiter();
+    while (!pending.empty() && running.size() < maxConcurrent)
+    {
+        if (pending.front()->control.expired())
+        {
+            std::unique_ptr<Transfer> transfer = std::move(pending.front());
+            pending.pop_front();
+            transfer->completion(transfer->mem, 0);     // never started, the decoder reports the reason
+            continue;
+        }
+
+        int replayedCode = 0;
+        if (httpClient.replay(pending.front()->path, HttpClient::writeMemoryCallback, &pending.front()->mem, replayedCode, pending.front()->responseHeaders))
+        {
+            std::unique_ptr<Transfer> transfer = std::move(pending.front());
+            pending.pop_front();
+            transfer->mem.resetReadPos();
+            transfer->completion(transfer->mem, replayedCode);
+            continue;
+        }
+
+        double waitSeconds = 0.0;
+        if (rateLimiter && !rateLimiter->tryAcquire(httpClient.getPriority(), waitSeconds))
+        {
+            return waitSeconds;
+        }
+
+        std::unique_ptr<Transfer> transfer = std::move(pending.front());
+        pending.pop_front();
+
+        CURL* curl = curl_easy_init();
+        if (!curl)
+        {
+            std::cout << "curl_easy_init failed, cannot query " << transfer->query << std::endl;
+            transfer->completion(transfer->mem, 0);
+            continue;
+        }
+
+        std::cout << "requesting binary from " << transfer->query << std::endl;
+        transfer->mem.mem.clear();
+        transfer->mem.resetReadPos();
+        transfer->responseHeaders.clear();
+        transfer->headers = httpClient.configureHandle(curl, transfer->query, HttpClient::writeMemoryCallback, &transfer->mem, transfer->responseHeaders, timeout, transfer->control);
+        transfer->attempts++;
+        transfer->started = std::chrono::steady_clock::now();
+        curl_multi_add_handle(multi, curl);
+        running[curl] = std::move(transfer);
+    }
+    return 0.0;
+}
+
+void MMIntern::TransferEngine::finish(CURL* curl, CURLcode res)
+{
+    std::map<CURL*, std::unique_ptr<Transfer>>::iterator it = running.find(curl);
+    if (it == running.end())
+    {
+        return;
+    }
+    std::unique_ptr<Transfer> transfer = std::move(it->second);
+    running.erase(it);
+
+    long l_http_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &l_http_code);
+    httpClient.traceTransfer(curl, transfer->started, transfer->query);
+    curl_multi_remove_handle(multi, curl);
+    curl_easy_cleanup(curl);
+    curl_slist_free_all(transfer->headers);
+    transfer->headers = nullptr;
+
+    MeteomaticsRateLimiter* rateLimiter = httpClient.getRateLimiter();
+    if (rateLimiter)
+    {
+        rateLimiter->consumeBytes(transfer->mem.size());
+    }
+
+    if (res != CURLE_OK)
+    {
+        std::cout << "curl transfer of query " << transfer->query << " failed: " << curl_easy_strerror(res) << std::endl;
+        transfer->mem.mem.clear();
+        transfer->completion(transfer->mem, 0);
+        return;
+    }
+
+    // same retry policy as the blocking client, the rate limiter holds back the retry instead of sleeping
+    const double retryAfter = rateLimiter ? retryDelaySeconds(l_http_code, transfer->responseHeaders, transfer->attempts - 1, maxRetries, timeout, transfer->control) : -1.0;
+    if (retryAfter >= 0)
+    {
+        std::cout << "Server replied with code " << l_http_code << ", retrying in " << retryAfter << "s" << std::endl;
+        rateLimiter->holdFor(retryAfter);
+        pending.push_front(std::move(transfer));
+        return;
+    }
+
+    const int http_code = static_cast<int>(l_http_code);
+    httpClient.record(transfer->path, http_code, transfer->responseHeaders, transfer->mem.mem.data(), transfer->mem.size());
+    if (!http_server_available(http_code))
+    {
+        std::cout << "Query " << transfer->query << " replied with code " << http_code << std::endl;
+    }
+    transfer->mem.resetReadPos();
+    transfer->completion(transfer->mem, http_code);
+}
+
+std::size_t MMIntern::TransferEngine::poll(const int timeoutMilliseconds)
+{
+    const double waitSeconds = startPending();
+
+    int stillRunning = 0;
+    curl_multi_perform(multi, &stillRunning);
+
+    int waitMilliseconds = timeoutMilliseconds;
+    if (waitSeconds > 0.0)
+    {
+        waitMilliseconds = std::min(waitMilliseconds, static_cast<int>(std::ceil(waitSeconds * 1000.0)));
+    }
+    if (!running.empty())
+    {
+        curl_multi_poll(multi, nullptr, 0, waitMilliseconds, nullptr);
+        curl_multi_perform(multi, &stillRunning);
+    }
+    else if (!pending.empty() && waitMilliseconds > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(waitMilliseconds));
+    }
+
+    int msgsLeft = 0;
+    CURLMsg* msg = nullptr;
+    while ((msg = curl_multi_info_read(multi, &msgsLeft)))
+    {
+        if (msg->msg == CURLMSG_DONE)
+        {
+            finish(msg->easy_handle, msg->data.result);     // completions may submit new transfers
+        }
+    }
+
+    startPending();
+    return numOutstanding();
+}
+
+
+
+
+#if METEOMATICS_COROUTINES
+
+//
+// -- awaitable returned by the coroutine getters of MeteomaticsAsyncClient, resumed from within poll()
+//
+template<class Result>
+class MeteomaticsAwaitable
+{
+public:
+    typedef std::function<void(const std::function<void(Result&)>&)> Starter;
+
+    explicit MeteomaticsAwaitable(const Starter& _start) : start(_start) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        start([this, handle](Result& r) { result = std::move(r); handle.resume(); });
+    }
+    Result await_resume() { return std::move(result); }
+
+private:
+    Starter start;
+    Result result;
+};
+
+//
+// -- minimal eagerly started coroutine type, the task must outlive its outstanding queries
+//    (awaiting coroutines take their parameters by value, references may dangle once they suspend)
+//
+class MeteomaticsTask
+{
+public:
+    struct promise_type
+    {
+        MeteomaticsTask get_return_object() { return MeteomaticsTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    MeteomaticsTask(MeteomaticsTask&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+    MeteomaticsTask(const MeteomaticsTask&) = delete;
+    MeteomaticsTask& operator=(const MeteomaticsTask&) = delete;
+    ~MeteomaticsTask() { if (handle) handle.destroy(); }
+
+    bool done() const { return !handle || handle.done(); }
+
+private:
+    explicit MeteomaticsTask(std::coroutine_handle<promise_type> _handle) : handle(_handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+#endif
+
+
+
+
+//
+//  METEOMATICS ASYNC CLIENT
+//
+//  Issues queries without blocking: completion callbacks (or resumed coroutines) are run
+//  from within poll(), so one thread can drive thousands of outstanding queries.
+//  The blocking getters of MeteomaticsApiClient remain available on the same object.
+//
+class MeteomaticsAsyncClient : public MeteomaticsApiClient
+{
+public:
+    MeteomaticsAsyncClient(const std::string& user, const std::string& password, const int timeout_seconds, const std::size_t maxConcurrentTransfers=64);
+    ~MeteomaticsAsyncClient();
+
+    void getGridAsync(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, const std::function<void(MeteomaticsGridResult&)>& onDone, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    void getMultiPointTimeSeriesAsync(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, const std::function<void(MeteomaticsTimeSeriesResult&)>& onDone, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    void getTimeSeriesAsync(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, double lat, double lon, const std::function<void(MeteomaticsTimeSeriesResult&)>& onDone, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    //
+    // -- drives all outstanding queries for at most timeoutMilliseconds, returns the number still outstanding
+    //
+    std::size_t poll(const int timeoutMilliseconds);
+
+    //
+    // -- polls until all queries (including those issued from callbacks) are done
+    //
+    void run();
+
+    std::size_t numOutstanding() const;
+
+#if METEOMATICS_COROUTINES
+    //
+    // -- awaitable variants, e.g. MeteomaticsGridResult r = co_await client.grid(...);
+    //
+    MeteomaticsAwaitable<MeteomaticsGridResult> grid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    MeteomaticsAwaitable<MeteomaticsTimeSeriesResult> multiPointTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    MeteomaticsAwaitable<MeteomaticsTimeSeriesResult> timeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, double lat, double lon, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+#endif
+
+private:
+    MMIntern::TransferEngine* transferEngine;
+};
+
+MeteomaticsAsyncClient::MeteomaticsAsyncClient(const std::string& user, const std::string& password, const int timeout_seconds, const std::size_t maxConcurrentTransfers)
+: MeteomaticsApiClient(user, password, timeout_seconds)
+, transferEngine(new MMIntern::TransferEngine(*httpClient, timeout_seconds, maxConcurrentTransfers))
+{
+}
+
+MeteomaticsAsyncClient::~MeteomaticsAsyncClient()
+{
+    delete transferEngine;
+}
+
+void MeteomaticsAsyncClient::getGridAsync(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, const std::function<void(MeteomaticsGridResult&)>& onDone, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    const std::string queryString = createGridQuery(time, parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, optionals);
+
+    transferEngine->submit(queryString, [this, onDone, control](MMIntern::MemoryClass& mem, int httpReturnCode)
+    {
+        MeteomaticsGridResult r;
+        r.success = decodeGrid(mem, httpReturnCode, r.gridResult, r.latGridPts, r.lonGridPts, r.msg, control);
+        onDone(r);
+    }, control);
+}
+
+void MeteomaticsAsyncClient::getMultiPointTimeSeriesAsync(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, const std::function<void(MeteomaticsTimeSeriesResult&)>& onDone, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    const std::string queryString = createMultiPointTimeSeriesQuery(startTime, stopTime, timeStep, parameters, lats, lons, optionals);
+    const std::size_t numCoordinates = lats.size();
+
+    transferEngine->submit(queryString, [this, onDone, numCoordinates, control](MMIntern::MemoryClass& mem, int httpReturnCode)
+    {
+        MeteomaticsTimeSeriesResult r;
+        r.success = decodeMultiPointTimeSeries(mem, httpReturnCode, numCoordinates, r.result, r.times, r.msg, control);
+        onDone(r);
+    }, control);
+}
+
+void MeteomaticsAsyncClient::getTimeSeriesAsync(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, double lat, double lon, const std::function<void(MeteomaticsTimeSeriesResult&)>& onDone, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    getMultiPointTimeSeriesAsync(startTime, stopTime, timeStep, parameters, std::vector<double>(1, lat), std::vector<double>(1, lon), onDone, optionals, control);
+}
+
+std::size_t MeteomaticsAsyncClient::poll(const int timeoutMilliseconds)
+{
+    return transferEngine->poll(timeoutMilliseconds);
+}
+
+void MeteomaticsAsyncClient::run()
+{
+    while (transferEngine->numOutstanding() > 0)
+    {
+        transferEngine->poll(100);
+    }
+}
+
+std::size_t MeteomaticsAsyncClient::numOutstanding() const
+{
+    return transferEngine->numOutstanding();
+}
+
+#if METEOMATICS_COROUTINES
+
+MeteomaticsAwaitable<MeteomaticsGridResult> MeteomaticsAsyncClient::grid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    return MeteomaticsAwaitable<MeteomaticsGridResult>([=, this](const std::function<void(MeteomaticsGridResult&)>& resume)
+    {
+        getGridAsync(time, parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, resume, optionals, control);
+    });
+}
+
+MeteomaticsAwaitable<MeteomaticsTimeSeriesResult> MeteomaticsAsyncClient::multiPointTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    return MeteomaticsAwaitable<MeteomaticsTimeSeriesResult>([=, this](const std::function<void(MeteomaticsTimeSeriesResult&)>& resume)
+    {
+        getMultiPointTimeSeriesAsync(startTime, stopTime, timeStep, parameters, lats, lons, resume, optionals, control);
+    });
+}
+
+MeteomaticsAwaitable<MeteomaticsTimeSeriesResult> MeteomaticsAsyncClient::timeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, double lat, double lon, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    return multiPointTimeSeries(startTime, stopTime, timeStep, parameters, std::vector<double>(1, lat), std::vector<double>(1, lon), optionals, control);
+}
+
+#endif
+
+
+#endif /* Meteomatics_Async_h */
@@ -0,0 +1,365 @@
+//
+//  Meteomatics_Backfill.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_Backfill_h
+#define Meteomatics_Backfill_h
+
+#include "Meteomatics_MappedResult.h"
+
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+
+//
+// progress of MeteomaticsBackfill::run, rates are measured over the windows fetched by this run
+//
+struct MeteomaticsBackfillProgress
+{
+    MeteomaticsBackfillProgress();
+
+    std::size_t windowsTotal;
+    std::size_t windowsDone;                    // including windowsResumed
+    std::size_t windowsResumed;                 // completed by an earlier run according to the manifest
+    std::size_t windowsFailed;                  // failed after all attempts, left for the next run
+    std::size_t requests;                       // including retries
+    std::size_t values;                         // fetched by this run
+    double elapsedSeconds;
+    double windowsPerSecond;
+    double valuesPerSecond;
+    double etaSeconds;                          // for the remaining windows at the current rate
+};
+
+
+//
+//  METEOMATICS BACKFILL
+//
+//  Fills a MeteomaticsMappedTimeSeries covering a long time range and many coordinates. The series is
+//  partitioned into windows of a block of coordinates and a block of times, sized to stay below a
+//  number of values per request. The windows are fetched concurrently by worker threads, each with its
+//  own client (see the caveat on thread-safety), within the limits of an optional shared rate limiter
+//  at Backfill priority. A failed window is retried a few times.
+//
+//  Every completed window is recorded in a manifest file after its values have been written back to
+//  the series file, so a run that was stopped or crashed resumes with the missing windows when run
+//  again on the reopened series with the same manifest. Delete the manifest when recreating the series.
+//
+class MeteomaticsBackfill
+{
+public:
+    MeteomaticsBackfill(const std::string& user, const std::string& password, const int timeout_seconds, const std::size_t numWorkers=4, const std::shared_ptr<MeteomaticsRateLimiter>& rateLimiter=nullptr);
+
+    //
+    // -- window size, applied to series without a manifest yet (resumed runs keep the windows of the manifest)
+    //
+    void setWindowLimits(const std::size_t maxValuesPerRequest, const std::size_t maxCoordinatesPerRequest);
+    void setMaxAttempts(const int maxAttempts);
+
+    //
+    // -- called after every window from the worker threads, one call at a time
+    //
+    void setProgressCallback(const std::function<void(const MeteomaticsBackfillProgress&)>& onProgress);
+
+    //
+    // -- fetches all windows of the series not in the manifest yet, true if the series is complete
+    //
+    bool run(MeteomaticsMappedTimeSeries& series, const std::string& manifestPath, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    MeteomaticsBackfillProgress progress() const;
+
+private:
+    struct Window
+    {
+        std::size_t firstCoordinate;
+        std::size_t numCoordinates;
+        std::size_t firstTime;
+        std::size_t numTimes;
+    };
+
+    bool readManifest(const std::string& path, const MeteomaticsMappedTimeSeries& series, std::vector<bool>& done, std::string& msg);
+    bool startManifest(const std::string& path, const MeteomaticsMappedTimeSeries& series, std::string& msg);
+    void worker(MeteomaticsApiClient& client, MeteomaticsMappedTimeSeries& series, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control);
+    void update(const std::size_t window, const bool success, const std::size_t values, const std::string& msg);
+
+    std::vector<std::unique_ptr<MeteomaticsApiClient>> clients;
+    std::size_t maxValuesPerRequest;
+    std::size_t maxCoordinatesPerRequest;
+    int maxAttempts;
+    std::function<void(const MeteomaticsBackfillProgress&)> onProgress;
+
+    // state of the current run
+    std::size_t coordinatesPerWindow;
+    std::size_t timesPerWindow;
+    std::vector<Window> pending;
+    std::atomic<std::size_t> nextPending;
+    std::atomic<std::size_t> numRequests;
+    std::ofstream manifest;
+    std::string lastError;
+    std::chrono::steady_clock::time_point started;
+    MeteomaticsBackfillProgress current;
+    mutable std::mutex mutex;
+
+    static const char* manifestMagic;
+};
+
+
+const char* MeteomaticsBackfill::manifestMagic = "MMBACKFILL 1";
+
+MeteomaticsBackfillProgress::MeteomaticsBackfillProgress()
+: windowsTotal(0)
+, windowsDone(0)
+, windowsResumed(0)
+, windowsFailed(0)
+, requests(0)
+, values(0)
+, elapsedSeconds(0)
+, windowsPerSecond(0)
+, valuesPerSecond(0)
+, etaSeconds(0)
+{
+}
+
+MeteomaticsBackfill::MeteomaticsBackfill(const std::string& user, const std::string& password, const int timeout_seconds, const std::size_t numWorkers, const std::shared_ptr<MeteomaticsRateLimiter>& rateLimiter)
+: maxValuesPerRequest(100000)
+, maxCoordinatesPerRequest(100)
+, maxAttempts(3)
+, coordinatesPerWindow(0)
+, timesPerWindow(0)
+, nextPending(0)
+, numRequests(0)
+{
+    for (std::size_t i=0; i<std::max<std::size_t>(1, numWorkers); i++)
+    {
+        clients.emplace_back(new MeteomaticsApiClient(user, password, timeout_seconds));
+        if (rateLimiter)
+        {
+            clients.back()->setRateLimiter(rateLimiter, MeteomaticsRateLimiter::Backfill);
+        }
+    }
+}
+
+void MeteomaticsBackfill::setWindowLimits(const std::size_t _maxValuesPerRequest, const std::size_t _maxCoordinatesPerRequest)
+{
+    maxValuesPerRequest = std::max<std::size_t>(1, _maxValuesPerRequest);
+    maxCoordinatesPerRequest = std::max<std::size_t>(1, _maxCoordinatesPerRequest);
+}
+
+void MeteomaticsBackfill::setMaxAttempts(const int _maxAttempts)
+{
+    maxAttempts = std::max(1, _maxAttempts);
+}
+
+void MeteomaticsBackfill::setProgressCallback(const std::function<void(const MeteomaticsBackfillProgress&)>& _onProgress)
+{
+    onProgress = _onProgress;
+}
+
+//
+// -- manifest: a line "MMBACKFILL 1 numParameters numCoordinates numTimes startTime step coordinatesPerWindow timesPerWindow",
+//    then one line "done WINDOW" per completed window. An incomplete last line (crash while appending) is ignored.
+//
+bool MeteomaticsBackfill::readManifest(const std::string& path, const MeteomaticsMappedTimeSeries& series, std::vector<bool>& done, std::string& msg)
+{
+    std::ifstream in(path.c_str());
+    if (!in)
+    {
+        return true;                            // first run
+    }
+
+    std::string line;
+    if (!std::getline(in, line) || line.compare(0, std::strlen(manifestMagic), manifestMagic) != 0)
+    {
+        msg = path + " is not a backfill manifest";
+        return false;
+    }
+    std::stringstream header(line.substr(std::strlen(manifestMagic)));
+    std::size_t numParameters = 0, numCoordinates = 0, numTimes = 0;
+    long long startTime = 0, step = 0;
+    header >> numParameters >> numCoordinates >> numTimes >> startTime >> step >> coordinatesPerWindow >> timesPerWindow;
+    if (!header || numParameters != series.numParameters() || numCoordinates != series.numCoordinates() || numTimes != series.numTimes()
+        || startTime != std::llround(series.unixTime(0)) || step != std::llround(series.stepSeconds()) || coordinatesPerWindow == 0 || timesPerWindow == 0)
+    {
+        msg = path + " belongs to a different series";
+        return false;
+    }
+
+    const std::size_t numWindows = ((numCoordinates + coordinatesPerWindow - 1) / coordinatesPerWindow) * ((numTimes + timesPerWindow - 1) / timesPerWindow);
+    done.assign(numWindows, false);
+    while (std::getline(in, line))
+    {
+        std::size_t window;
+        if (std::sscanf(line.c_str(), "done %zu", &window) == 1 && window < numWindows)
+        {
+            done[window] = true;
+        }
+    }
+    return true;
+}
+
+bool MeteomaticsBackfill::startManifest(const std::string& path, const MeteomaticsMappedTimeSeries& series, std::string& msg)
+{
+    const bool exists = std::ifstream(path.c_str()).good();
+    manifest.open(path.c_str(), std::ios::app);
+    if (!manifest)
+    {
+        msg = "cannot open " + path;
+        return false;
+    }
+    if (!exists)
+    {
+        manifest << manifestMagic << ' ' << series.numParameters() << ' ' << series.numCoordinates() << ' ' << series.numTimes() << ' '
+                 << std::llround(series.unixTime(0)) << ' ' << std::llround(series.stepSeconds()) << ' ' << coordinatesPerWindow << ' ' << timesPerWindow << std::endl;
+    }
+    else
+    {
+        manifest << std::endl;                  // terminates a last line cut off by a crash
+    }
+    return manifest.good();
+}
+
+bool MeteomaticsBackfill::run(MeteomaticsMappedTimeSeries& series, const std::string& manifestPath, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    msg.clear();
+    if (!series.isOpen() || !series.isWritable())
+    {
+        msg = "mapped time series not open for writing";
+        return false;
+    }
+
+    // window size: a block of coordinates times as many times as fit into a request
+    coordinatesPerWindow = std::min(series.numCoordinates(), maxCoordinatesPerRequest);
+    timesPerWindow = std::max<std::size_t>(1, std::min(series.numTimes(), maxValuesPerRequest / (series.numParameters() * coordinatesPerWindow)));
+
+    std::vector<bool> done;
+    if (!readManifest(manifestPath, series, done, msg) || !startManifest(manifestPath, series, msg))
+    {
+        manifest.close();
+        return false;
+    }
+
+    // windows ordered by time, so an interrupted backfill covers a contiguous range of times
+    const std::size_t numCoordinateBlocks = (series.numCoordinates() + coordinatesPerWindow - 1) / coordinatesPerWindow;
+    const std::size_t numTimeBlocks = (series.numTimes() + timesPerWindow - 1) / timesPerWindow;
+    done.resize(numCoordinateBlocks * numTimeBlocks, false);
+
+    pending.clear();
+    current = MeteomaticsBackfillProgress();
+    current.windowsTotal = done.size();
+    for (std::size_t w=0; w<done.size(); w++)
+    {
+        if (done[w])
+        {
+            current.windowsResumed++;
+            continue;
+        }
+        Window window;
+        window.firstCoordinate = (w % numCoordinateBlocks) * coordinatesPerWindow;
+        window.numCoordinates = std::min(coordinatesPerWindow, series.numCoordinates() - window.firstCoordinate);
+        window.firstTime = (w / numCoordinateBlocks) * timesPerWindow;
+        window.numTimes = std::min(timesPerWindow, series.numTimes() - window.firstTime);
+        pending.push_back(window);
+    }
+    current.windowsDone = current.windowsResumed;
+    nextPending = 0;
+    numRequests = 0;
+    lastError.clear();
+    started = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (std::size_t i=0; i<clients.size() && i<pending.size(); i++)
+    {
+        workers.emplace_back(&MeteomaticsBackfill::worker, this, std::ref(*clients[i]), std::ref(series), std::cref(optionals), std::cref(control));
+    }
+    for (auto& w : workers)
+    {
+        w.join();
+    }
+    manifest.close();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    current.requests = numRequests;
+    if (current.windowsDone != current.windowsTotal)
+    {
+        std::stringstream ss;
+        ss << current.windowsTotal - current.windowsDone << " of " << current.windowsTotal << " windows missing";
+        if (!lastError.empty())
+        {
+            ss << ", last error: " << lastError;
+        }
+        msg = ss.str();
+        return false;
+    }
+    return true;
+}
+
+void MeteomaticsBackfill::worker(MeteomaticsApiClient& client, MeteomaticsMappedTimeSeries& series, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    for (std::size_t i=nextPending++; i<pending.size() && !control.expired(); i=nextPending++)
+    {
+        const Window& window = pending[i];
+        const std::size_t windowIndex = (window.firstTime / timesPerWindow) * ((series.numCoordinates() + coordinatesPerWindow - 1) / coordinatesPerWindow) + window.firstCoordinate / coordinatesPerWindow;
+
+        bool success = false;
+        std::string msg;
+        for (int attempt=0; attempt<maxAttempts && !success && !control.expired(); attempt++)
+        {
+            if (attempt > 0)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(500 << attempt));
+            }
+            numRequests++;
+            success = client.getMultiPointTimeSeries(series, window.firstCoordinate, window.numCoordinates, window.firstTime, window.numTimes, msg, optionals, control);
+        }
+
+        // the values must be on disk before the window is recorded as done
+        if (success && !series.flush())
+        {
+            success = false;
+            msg = "cannot write back the mapped time series";
+        }
+        update(windowIndex, success, success ? series.numParameters() * window.numCoordinates * window.numTimes : 0, msg.empty() ? "request failed" : msg);
+    }
+}
+
+void MeteomaticsBackfill::update(const std::size_t window, const bool success, const std::size_t values, const std::string& msg)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (success)
+    {
+        manifest << "done " << window << std::endl;
+        current.windowsDone++;
+        current.values += values;
+    }
+    else
+    {
+        current.windowsFailed++;
+        lastError = msg;
+    }
+
+    current.requests = numRequests;
+    current.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    const double elapsed = std::max(current.elapsedSeconds, 1e-9);
+    current.windowsPerSecond = (current.windowsDone - current.windowsResumed) / elapsed;
+    current.valuesPerSecond = current.values / elapsed;
+    const std::size_t remaining = current.windowsTotal - current.windowsDone - current.windowsFailed;
+    current.etaSeconds = current.windowsPerSecond > 0 ? remaining / current.windowsPerSecond : 0;
+
+    if (onProgress)
+    {
+        onProgress(current);
+    }
+}
+
+MeteomaticsBackfillProgress MeteomaticsBackfill::progress() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return current;
+}
+
+
+#endif /* Meteomatics_Backfill_h */
@@ -0,0 +1,269 @@
+//
+//  Meteomatics_CachingClient.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_CachingClient_h
+#define Meteomatics_CachingClient_h
+
+#include "Meteomatics_ApiClient.h"
+
+#include <cmath>
+#include <map>
+
+
+//
+//  METEOMATICS CACHING CLIENT
+//
+//  Keeps the decoded grids of getGrid and revalidates them instead of downloading them again:
+//  If-None-Match / If-Modified-Since are sent from the ETag / Last-Modified of the cached
+//  response, and a 304 answer is served from the cache. With a model run schedule set, a
+//  cached grid is not even revalidated before the next model run is expected to be available.
+//  Like MeteomaticsApiClient, a single instance must not be used from several threads at once.
+//
+class MeteomaticsCachingClient : protected MeteomaticsApiClient
+{
+public:
+    MeteomaticsCachingClient(const std::string& user, const std::string& password, const int timeout_seconds, const std::size_t maxEntries=64);
+
+    // the uncached getters and the helpers of the client stay available, the client itself isn't: code holding
+    // a MeteomaticsApiClient& could not tell that it bypasses the cache
+    using MeteomaticsApiClient::getGrid;
+    using MeteomaticsApiClient::getIsoTimeStr;
+    using MeteomaticsApiClient::getTimeStepStr;
+    using MeteomaticsApiClient::getCurrentYear;
+    using MeteomaticsApiClient::getCurrentMonth;
+    using MeteomaticsApiClient::getCurrentDay;
+    using MeteomaticsApiClient::getTomorrow;
+    using MeteomaticsApiClient::getTomorrowsMonth;
+    using MeteomaticsApiClient::getTomorrowsYear;
+    using MeteomaticsApiClient::setRateLimiter;
+    using MeteomaticsApiClient::setTransportArchive;
+    using MeteomaticsApiClient::setTracer;
+    using MeteomaticsApiClient::warmUp;
+    using MeteomaticsApiClient::getMemoryStats;
+    using MeteomaticsApiClient::resetMemoryStats;
+    using MeteomaticsApiClient::memoryStatsAvailable;
+
+    //
+    // -- same semantics as MeteomaticsApiClient::getGrid, served from the cache where possible
+    //
+    bool getGridCached(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nrGridPts_Lat, const int nrGridPts_Lon, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    //
+    // -- model runs start every runIntervalHours (at 00 UTC and multiples) and are available availabilityDelayHours later,
+    //    e.g. (6, 4) for a model initialised at 00/06/12/18 UTC. Unchanged grids (304) are revalidated every retryMinutes
+    //    until the next run is due. A run interval <= 0 revalidates on every call (default).
+    //
+    void setModelRunSchedule(const double runIntervalHours, const double availabilityDelayHours, const double retryMinutes=5);
+
+    void clear();
+
+    std::size_t numDownloads() const;           // full responses (200)
+    std::size_t numNotModified() const;         // revalidated with 304
+    std::size_t numSkipped() const;             // served without a request, due to the model run schedule
+    std::size_t bytesReceived() const;          // bodies of all responses
+
+private:
+    struct Entry
+    {
+        Matrix gridResult;
+        std::vector<double> latGridPts;
+        std::vector<double> lonGridPts;
+        std::string etag;
+        std::string lastModified;
+        double freshUntil;                      // unix seconds, no request before
+        std::size_t lastUse;
+    };
+
+    static double unixNow();
+    double nextRunAvailable(const double now) const;
+    void evict();
+
+    const std::size_t maxEntries;
+    double runIntervalSeconds;
+    double availabilityDelaySeconds;
+    double retrySeconds;
+
+    std::map<std::string, Entry> entries;
+    std::size_t useCounter;
+    std::size_t downloads;
+    std::size_t notModified;
+    std::size_t skipped;
+    std::size_t bytes;
+};
+
+MeteomaticsCachingClient::MeteomaticsCachingClient(const std::string& user, const std::string& password, const int timeout_seconds, const std::size_t _maxEntries)
+: MeteomaticsApiClient(user, password, timeout_seconds)
+, maxEntries(std::max<std::size_t>(1, _maxEntries))
+, runIntervalSeconds(0)
+, availabilityDelaySeconds(0)
+, retrySeconds(0)
+, useCounter(0)
+, downloads(0)
+, notModified(0)
+, skipped(0)
+, bytes(0)
+{
+}
+
+void MeteomaticsCachingClient::setModelRunSchedule(const double runIntervalHours, const double availabilityDelayHours, const double retryMinutes)
+{
+    runIntervalSeconds = std::max(0.0, runIntervalHours * 3600.0);
+    availabilityDelaySeconds = std::max(0.0, availabilityDelayHours * 3600.0);
+    retrySeconds = std::max(0.0, retryMinutes * 60.0);
+    for (auto& entry : entries)
+    {
+        entry.second.freshUntil = 0;
+    }
+}
+
+double MeteomaticsCachingClient::unixNow()
+{
+    return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+double MeteomaticsCachingClient::nextRunAvailable(const double now) const
+{
+    if (runIntervalSeconds <= 0)
+    {
+        return 0;
+    }
+    // latest run available at now, the next one follows one interval later
+    const double latestRun = std::floor((now - availabilityDelaySeconds) / runIntervalSeconds) * runIntervalSeconds;
+    return latestRun + runIntervalSeconds + availabilityDelaySeconds;
+}
+
+void MeteomaticsCachingClient::evict()
+{
+    while (entries.size() >= maxEntries)
+    {
+        std::map<std::string, Entry>::iterator oldest = entries.begin();
+        for (std::map<std::string, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+            if (it->second.lastUse < oldest->second.lastUse)
+            {
+                oldest = it;
+            }
+        }
+        entries.erase(oldest);
+    }
+}
+
+bool MeteomaticsCachingClient::getGridCached(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, GridQuery);
+
+    gridResult.clear();
+    latGridPts.clear();
+    lonGridPts.clear();
+    msg.clear();
+
+    const std::string queryString = createGridQuery(time, parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, optionals);
+    const double now = unixNow();
+
+    std::map<std::string, Entry>::iterator cached = entries.find(queryString);
+    std::vector<std::string> requestHeaders;
+    if (cached != entries.end())
+    {
+        cached->second.lastUse = ++useCounter;
+        if (now < cached->second.freshUntil)
+        {
+            skipped++;
+            gridResult = cached->second.gridResult;
+            latGridPts = cached->second.latGridPts;
+            lonGridPts = cached->second.lonGridPts;
+            return true;
+        }
+        if (!cached->second.etag.empty())
+        {
+            requestHeaders.push_back("If-None-Match: " + cached->second.etag);
+        }
+        if (!cached->second.lastModified.empty())
+        {
+            requestHeaders.push_back("If-Modified-Since: " + cached->second.lastModified);
+        }
+    }
+
+    int httpReturnCode = 0;
+    MMIntern::ResponseHeaders responseHeaders;
+    MMIntern::MemoryClass mem(500);
+    const bool fetched = fetchBinary(queryString, mem, httpReturnCode, msg, control, requestHeaders, responseHeaders);
+    bytes += mem.size();
+    if (!fetched)
+    {
+        return false;
+    }
+
+    if (httpReturnCode == 304 && cached != entries.end())
+    {
+        // unchanged: either the due run is late or it didn't change this grid, look again after a while
+        notModified++;
+        if (runIntervalSeconds > 0)
+        {
+            cached->second.freshUntil = std::min(nextRunAvailable(now), now + retrySeconds);
+        }
+        gridResult = cached->second.gridResult;
+        latGridPts = cached->second.latGridPts;
+        lonGridPts = cached->second.lonGridPts;
+        return true;
+    }
+
+    if (!decodeGrid(mem, httpReturnCode, gridResult, latGridPts, lonGridPts, msg, control))
+    {
+        return false;
+    }
+    downloads++;
+
+    const std::string etag = responseHeaders.get("etag");
+    const std::string lastModified = responseHeaders.get("last-modified");
+    if (etag.empty() && lastModified.empty() && runIntervalSeconds <= 0)
+    {
+        return true;                            // can neither be revalidated nor skipped
+    }
+
+    if (cached == entries.end())
+    {
+        evict();
+        cached = entries.insert(std::make_pair(queryString, Entry())).first;
+    }
+    Entry& entry = cached->second;
+    entry.gridResult = gridResult;
+    entry.latGridPts = latGridPts;
+    entry.lonGridPts = lonGridPts;
+    entry.etag = etag;
+    entry.lastModified = lastModified;
+    entry.freshUntil = nextRunAvailable(now);
+    entry.lastUse = ++useCounter;
+    return true;
+}
+
+void MeteomaticsCachingClient::clear()
+{
+    entries.clear();
+}
+
+std::size_t MeteomaticsCachingClient::numDownloads() const
+{
+    return downloads;
+}
+
+std::size_t MeteomaticsCachingClient::numNotModified() const
+{
+    return notModified;
+}
+
+std::size_t MeteomaticsCachingClient::numSkipped() const
+{
+    return skipped;
+}
+
+std::size_t MeteomaticsCachingClient::bytesReceived() const
+{
+    return bytes;
+}
+
+
+#endif /* Meteomatics_CachingClient_h */
@@ -0,0 +1,414 @@
+//
+//  Meteomatics_GridPyramid.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_GridPyramid_h
+#define Meteomatics_GridPyramid_h
+
+#include "Meteomatics_ApiClient.h"
+
+#include <cmath>
+#include <limits>
+
+
+namespace MMIntern {
+    class PyramidKernels;
+}
+
+
+//
+//  METEOMATICS PYRAMID KERNELS
+//
+//  Reduce two rows of a level to one row of the next coarser level, each output value from a
+//  2x2 block (1 or 2 values at an odd last row or column). NaN propagates into the block's value.
+//  Mean and max handle 2 output values per iteration with SSE2.
+//
+class MMIntern::PyramidKernels
+{
+public:
+    // bottom is top at an odd last row (counting it twice keeps the weights), inCols is the length of the input rows
+    static void mean(const double* top, const double* bottom, const std::size_t inCols, double* out);
+    static void maximum(const double* top, const double* bottom, const std::size_t inCols, double* out);
+    static void nearest(const double* top, const std::size_t inCols, double* out);
+};
+
+void MMIntern::PyramidKernels::mean(const double* top, const double* bottom, const std::size_t inCols, double* out)
+{
+    const std::size_t outCols = (inCols + 1) / 2;
+    std::size_t j = 0;
+#if defined(__SSE2__)
+    const __m128d weight = _mm_set1_pd(0.25);
+    for (; 2*j + 4 <= inCols; j += 2)
+    {
+        const __m128d t0 = _mm_loadu_pd(top + 2*j);
+        const __m128d t1 = _mm_loadu_pd(top + 2*j + 2);
+        const __m128d b0 = _mm_loadu_pd(bottom + 2*j);
+        const __m128d b1 = _mm_loadu_pd(bottom + 2*j + 2);
+        const __m128d columns = _mm_add_pd(_mm_add_pd(_mm_unpacklo_pd(t0, t1), _mm_unpackhi_pd(t0, t1)),
+                                           _mm_add_pd(_mm_unpacklo_pd(b0, b1), _mm_unpackhi_pd(b0, b1)));
+        _mm_storeu_pd(out + j, _mm_mul_pd(columns, weight));
+    }
+#endif
+    for (; j < outCols; j++)
+    {
+        if (2*j + 1 < inCols)
+        {
+            out[j] = (top[2*j] + top[2*j + 1] + bottom[2*j] + bottom[2*j + 1]) * 0.25;
+        }
+        else
+        {
+            out[j] = (top[2*j] + bottom[2*j]) * 0.5;
+        }
+    }
+}
+
+void MMIntern::PyramidKernels::maximum(const double* top, const double* bottom, const std::size_t inCols, double* out)
+{
+    const std::size_t outCols = (inCols + 1) / 2;
+    std::size_t j = 0;
+#if defined(__SSE2__)
+    for (; 2*j + 4 <= inCols; j += 2)
+    {
+        const __m128d t0 = _mm_loadu_pd(top + 2*j);
+        const __m128d t1 = _mm_loadu_pd(top + 2*j + 2);
+        const __m128d b0 = _mm_loadu_pd(bottom + 2*j);
+        const __m128d b1 = _mm_loadu_pd(bottom + 2*j + 2);
+        const __m128d even = _mm_max_pd(_mm_unpacklo_pd(t0, t1), _mm_unpacklo_pd(b0, b1));
+        const __m128d odd = _mm_max_pd(_mm_unpackhi_pd(t0, t1), _mm_unpackhi_pd(b0, b1));
+        const __m128d result = _mm_max_pd(even, odd);
+        // maxpd drops NaN operands, the sum is NaN if any value of the block is
+        const __m128d sum = _mm_add_pd(_mm_add_pd(_mm_unpacklo_pd(t0, t1), _mm_unpackhi_pd(t0, t1)),
+                                       _mm_add_pd(_mm_unpacklo_pd(b0, b1), _mm_unpackhi_pd(b0, b1)));
+        const __m128d nan = _mm_cmpunord_pd(sum, sum);
+        _mm_storeu_pd(out + j, _mm_or_pd(_mm_andnot_pd(nan, result), _mm_and_pd(nan, sum)));
+    }
+#endif
+    for (; j < outCols; j++)
+    {
+        const std::size_t end = std::min(2*j + 2, inCols);
+        double value = -std::numeric_limits<double>::infinity();
+        for (std::size_t k=2*j; k<end; k++)
+        {
+            if (std::isnan(top[k]) || std::isnan(bottom[k]))
+            {
+                value = std::numeric_limits<double>::quiet_NaN();
+                break;
+            }
+            value = std::max(value, std::max(top[k], bottom[k]));
+        }
+        out[j] = value;
+    }
+}
+
+void MMIntern::PyramidKernels::nearest(const double* top, const std::size_t inCols, double* out)
+{
+    const std::size_t outCols = (inCols + 1) / 2;
+    for (std::size_t j=0; j<outCols; j++)
+    {
+        out[j] = top[2*j];
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METEOMATICS GRID PYRAMID
+//
+//  Zoom levels of a grid: level 0 is the grid itself, every further level halves the number of
+//  points in both directions (mean, max or nearest of 2x2 blocks) down to a single point. Only the
+//  finest grid is downloaded, the coarser levels are derived locally on numThreads threads. Region
+//  requests are served from the coarsest level that still has the requested resolution. Concurrent
+//  reads are fine, build and fetch need exclusive access.
+//
+class MeteomaticsGridPyramid
+{
+public:
+    enum Method
+    {
+        Mean,
+        Max,
+        Nearest
+    };
+
+    MeteomaticsGridPyramid(const Method method=Mean, const std::size_t numThreads=1);
+    ~MeteomaticsGridPyramid();
+
+    //
+    // -- builds all levels from a grid as returned by getGrid ([lat][lon])
+    //
+    bool build(const Matrix& grid, const std::vector<double>& latGridPts, const std::vector<double>& lonGridPts, std::string& msg);
+
+    //
+    // -- downloads the finest grid with client.getGrid and builds the levels from it
+    //
+    bool fetch(const MeteomaticsApiClient& client, const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, std::string& msg, const std::vector<std::string>& optionals={});
+
+    std::size_t numLevels() const;
+    bool levelSize(const std::size_t level, std::size_t& numLat, std::size_t& numLon) const;
+
+    //
+    // -- the points of a level within the box (all of them for getLevel), in the order of the grid
+    //
+    bool getLevel(const std::size_t level, Matrix& grid, std::vector<double>& latGridPts, std::vector<double>& lonGridPts) const;
+    bool getRegion(const std::size_t level, const double lat_N, const double lon_W, const double lat_S, const double lon_E, Matrix& region, std::vector<double>& latGridPts, std::vector<double>& lonGridPts) const;
+
+    //
+    // -- the box from the coarsest level with at least nGridPts_Lat x nGridPts_Lon points in it (the finest if none has)
+    //
+    bool getGrid(const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, Matrix& region, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::size_t& level) const;
+
+private:
+    struct Level
+    {
+        std::size_t numLat;
+        std::size_t numLon;
+        std::vector<double> values;             // row-major
+        std::vector<double> latGridPts;
+        std::vector<double> lonGridPts;
+    };
+
+    void reduce(const Level& fine, Level& coarse) const;
+    static std::vector<double> reduceCoordinates(const std::vector<double>& points, const bool nearest);
+    static void indexRange(const std::vector<double>& points, const double a, const double b, std::size_t& begin, std::size_t& end);
+
+    const Method method;
+    std::unique_ptr<MMIntern::ThreadPool> pool;
+    std::vector<Level> levels;
+};
+
+
+MeteomaticsGridPyramid::MeteomaticsGridPyramid(const Method _method, const std::size_t numThreads)
+: method(_method)
+, pool(numThreads > 1 ? new MMIntern::ThreadPool(numThreads) : nullptr)
+{
+}
+
+MeteomaticsGridPyramid::~MeteomaticsGridPyramid()
+{
+}
+
+std::vector<double> MeteomaticsGridPyramid::reduceCoordinates(const std::vector<double>& points, const bool nearest)
+{
+    std::vector<double> result((points.size() + 1) / 2);
+    for (std::size_t i=0; i<result.size(); i++)
+    {
+        const bool pair = 2*i + 1 < points.size() && !nearest;
+        result[i] = pair ? 0.5 * (points[2*i] + points[2*i + 1]) : points[2*i];
+    }
+    return result;
+}
+
+void MeteomaticsGridPyramid::reduce(const Level& fine, Level& coarse) const
+{
+    coarse.numLat = (fine.numLat + 1) / 2;
+    coarse.numLon = (fine.numLon + 1) / 2;
+    coarse.values.resize(coarse.numLat * coarse.numLon);
+    coarse.latGridPts = reduceCoordinates(fine.latGridPts, method == Nearest);
+    coarse.lonGridPts = reduceCoordinates(fine.lonGridPts, method == Nearest);
+
+    // blocks of output rows per task, such that small levels don't pay for the synchronization
+    const std::size_t rowsPerTask = std::max<std::size_t>(1, 16384 / std::max<std::size_t>(1, fine.numLon));
+    const std::size_t numTasks = (coarse.numLat + rowsPerTask - 1) / rowsPerTask;
+    const std::function<void(std::size_t)> task = [this, &fine, &coarse, rowsPerTask](std::size_t t)
+    {
+        const std::size_t end = std::min(coarse.numLat, (t + 1) * rowsPerTask);
+        for (std::size_t i=t*rowsPerTask; i<end; i++)
+        {
+            const double* top = fine.values.data() + 2*i * fine.numLon;
+            const double* bottom = 2*i + 1 < fine.numLat ? top + fine.numLon : top;
+            double* out = coarse.values.data() + i * coarse.numLon;
+            switch (method)
+            {
+                case Mean:
+                    MMIntern::PyramidKernels::mean(top, bottom, fine.numLon, out);
+                    break;
+                case Max:
+                    MMIntern::PyramidKernels::maximum(top, bottom, fine.numLon, out);
+                    break;
+                case Nearest:
+                    MMIntern::PyramidKernels::nearest(top, fine.numLon, out);
+                    break;
+            }
+        }
+    };
+
+    if (pool && numTasks > 1)
+    {
+        pool->parallelFor(numTasks, task);
+    }
+    else
+    {
+        for (std::size_t t=0; t<numTasks; t++)
+        {
+            task(t);
+        }
+    }
+}
+
+bool MeteomaticsGridPyramid::build(const Matrix& grid, const std::vector<double>& latGridPts, const std::vector<double>& lonGridPts, std::string& msg)
+{
+    msg.clear();
+    levels.clear();
+    if (grid.empty() || grid.size() != latGridPts.size() || grid[0].size() != lonGridPts.size() || lonGridPts.empty())
+    {
+        msg = "grid does not match its coordinates";
+        return false;
+    }
+
+    Level finest;
+    finest.numLat = latGridPts.size();
+    finest.numLon = lonGridPts.size();
+    finest.latGridPts = latGridPts;
+    finest.lonGridPts = lonGridPts;
+    finest.values.reserve(finest.numLat * finest.numLon);
+    for (const auto& row : grid)
+    {
+        if (row.size() != finest.numLon)
+        {
+            msg = "grid rows of different length";
+            return false;
+        }
+        finest.values.insert(finest.values.end(), row.begin(), row.end());
+    }
+    levels.push_back(std::move(finest));
+
+    while (levels.back().numLat > 1 || levels.back().numLon > 1)
+    {
+        Level coarse;
+        reduce(levels.back(), coarse);
+        levels.push_back(std::move(coarse));
+    }
+    return true;
+}
+
+bool MeteomaticsGridPyramid::fetch(const MeteomaticsApiClient& client, const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, std::string& msg, const std::vector<std::string>& optionals)
+{
+    Matrix grid;
+    std::vector<double> latGridPts, lonGridPts;
+    if (!client.getGrid(time, parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, grid, latGridPts, lonGridPts, msg, optionals))
+    {
+        levels.clear();
+        return false;
+    }
+    return build(grid, latGridPts, lonGridPts, msg);
+}
+
+std::size_t MeteomaticsGridPyramid::numLevels() const
+{
+    return levels.size();
+}
+
+bool MeteomaticsGridPyramid::levelSize(const std::size_t level, std::size_t& numLat, std::size_t& numLon) const
+{
+    if (level >= levels.size())
+    {
+        return false;
+    }
+    numLat = levels[level].numLat;
+    numLon = levels[level].numLon;
+    return true;
+}
+
+bool MeteomaticsGridPyramid::getLevel(const std::size_t level, Matrix& grid, std::vector<double>& latGridPts, std::vector<double>& lonGridPts) const
+{
+    if (level >= levels.size())
+    {
+        return false;
+    }
+    const Level& l = levels[level];
+    grid.resize(l.numLat);
+    for (std::size_t i=0; i<l.numLat; i++)
+    {
+        grid[i].assign(l.values.begin() + i * l.numLon, l.values.begin() + (i + 1) * l.numLon);
+    }
+    latGridPts = l.latGridPts;
+    lonGridPts = l.lonGridPts;
+    return true;
+}
+
+// [begin, end) of the points within [min(a,b), max(a,b)], the points are monotonic in either direction
+void MeteomaticsGridPyramid::indexRange(const std::vector<double>& points, const double a, const double b, std::size_t& begin, std::size_t& end)
+{
+    const double low = std::min(a, b);
+    const double high = std::max(a, b);
+    begin = points.size();
+    end = 0;
+    for (std::size_t i=0; i<points.size(); i++)
+    {
+        if (points[i] >= low && points[i] <= high)
+        {
+            begin = std::min(begin, i);
+            end = i + 1;
+        }
+    }
+    if (begin > end)
+    {
+        begin = end = 0;
+    }
+}
+
+bool MeteomaticsGridPyramid::getRegion(const std::size_t level, const double lat_N, const double lon_W, const double lat_S, const double lon_E, Matrix& region, std::vector<double>& latGridPts, std::vector<double>& lonGridPts) const
+{
+    region.clear();
+    latGridPts.clear();
+    lonGridPts.clear();
+    if (level >= levels.size())
+    {
+        return false;
+    }
+
+    const Level& l = levels[level];
+    std::size_t latBegin, latEnd, lonBegin, lonEnd;
+    indexRange(l.latGridPts, lat_N, lat_S, latBegin, latEnd);
+    indexRange(l.lonGridPts, lon_W, lon_E, lonBegin, lonEnd);
+
+    region.resize(latEnd - latBegin);
+    for (std::size_t i=latBegin; i<latEnd; i++)
+    {
+        const std::vector<double>::const_iterator row = l.values.begin() + i * l.numLon;
+        region[i - latBegin].assign(row + lonBegin, row + lonEnd);
+    }
+    latGridPts.assign(l.latGridPts.begin() + latBegin, l.latGridPts.begin() + latEnd);
+    lonGridPts.assign(l.lonGridPts.begin() + lonBegin, l.lonGridPts.begin() + lonEnd);
+    return true;
+}
+
+bool MeteomaticsGridPyramid::getGrid(const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, Matrix& region, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::size_t& level) const
+{
+    if (levels.empty())
+    {
+        return false;
+    }
+
+    level = 0;
+    for (std::size_t k=levels.size(); k-- > 0; )
+    {
+        std::size_t latBegin, latEnd, lonBegin, lonEnd;
+        indexRange(levels[k].latGridPts, lat_N, lat_S, latBegin, latEnd);
+        indexRange(levels[k].lonGridPts, lon_W, lon_E, lonBegin, lonEnd);
+        if (static_cast<int>(latEnd - latBegin) >= nGridPts_Lat && static_cast<int>(lonEnd - lonBegin) >= nGridPts_Lon)
+        {
+            level = k;
+            break;
+        }
+    }
+    return getRegion(level, lat_N, lon_W, lat_S, lon_E, region, latGridPts, lonGridPts);
+}
+
+
+#endif /* Meteomatics_GridPyramid_h */
@@ -0,0 +1,538 @@
+//
+//  Meteomatics_GridStore.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_GridStore_h
+#define Meteomatics_GridStore_h
+
+#include "Meteomatics_ApiClient.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+
+
+struct MeteomaticsGridStoreStats
+{
+    MeteomaticsGridStoreStats();
+
+    std::size_t numGrids;
+    std::size_t numValues;
+    std::size_t rawBytes;                       // as Matrix of doubles
+    std::size_t storedBytes;                    // compressed values, coordinates not included
+    double compressionRatio;
+    std::size_t decodedValues;                  // by all reads so far
+    double decodeSeconds;
+    double decodeThroughput;                    // values per second
+};
+
+namespace MMIntern {
+    class GridStoreKernels;
+}
+
+
+//
+//  METEOMATICS GRID STORE KERNELS
+//
+//  Conversions between doubles and the 16 bit codes of the grid store. The decoders are the
+//  hot path of every read and convert 8 values per iteration with SSE2.
+//
+class MMIntern::GridStoreKernels
+{
+public:
+    static const uint16_t nonFiniteCode = 0xFFFF;   // quantized tiles: NaN, +-inf are kept as NaN
+    static const uint16_t maxCode = 0xFFFE;
+
+    static uint16_t floatToHalf(float value);
+    static float halfToFloat(uint16_t half);
+
+    // value = offset + code * scale
+    static void decodeQuantized(const uint16_t* codes, const std::size_t n, const double offset, const double scale, const bool hasNonFinite, double* out);
+    static void decodeHalf(const uint16_t* codes, const std::size_t n, double* out);
+};
+
+uint16_t MMIntern::GridStoreKernels::floatToHalf(float value)
+{
+    // round to nearest even, overflow to inf, underflow to subnormals
+    const uint32_t f32infinity = 255u << 23;
+    const uint32_t f16max = (127u + 16u) << 23;
+    const uint32_t denormMagic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+    uint32_t f;
+    std::memcpy(&f, &value, sizeof(f));
+    const uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+
+    uint16_t half;
+    if (f >= f16max)
+    {
+        half = f > f32infinity ? 0x7E00 : 0x7C00;
+    }
+    else if (f < (113u << 23))
+    {
+        float magic;
+        std::memcpy(&magic, &denormMagic, sizeof(magic));
+        float shifted;
+        std::memcpy(&shifted, &f, sizeof(shifted));
+        shifted += magic;
+        uint32_t bits;
+        std::memcpy(&bits, &shifted, sizeof(bits));
+        half = static_cast<uint16_t>(bits - denormMagic);
+    }
+    else
+    {
+        const uint32_t mantissaOdd = (f >> 13) & 1u;
+        f += (static_cast<uint32_t>(15 - 127) << 23) + 0xFFFu;
+        f += mantissaOdd;
+        half = static_cast<uint16_t>(f >> 13);
+    }
+    return static_cast<uint16_t>(half | (sign >> 16));
+}
+
+float MMIntern::GridStoreKernels::halfToFloat(uint16_t half)
+{
+    // exponent and mantissa moved into place and rescaled by 2^112, which also normalizes subnormals
+    const uint32_t magic = 0x77800000u;
+    uint32_t bits = static_cast<uint32_t>(half & 0x7FFF) << 13;
+    const bool infOrNaN = bits > 0x0F7FE000u;
+
+    float value, scale;
+    std::memcpy(&value, &bits, sizeof(value));
+    std::memcpy(&scale, &magic, sizeof(scale));
+    value *= scale;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if (infOrNaN)
+    {
+        bits |= 0x7F800000u;
+    }
+    bits |= static_cast<uint32_t>(half & 0x8000) << 16;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void MMIntern::GridStoreKernels::decodeQuantized(const uint16_t* codes, const std::size_t n, const double offset, const double scale, const bool hasNonFinite, double* out)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    if (!hasNonFinite)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128d vOffset = _mm_set1_pd(offset);
+        const __m128d vScale = _mm_set1_pd(scale);
+        for (; i + 8 <= n; i += 8)
+        {
+            const __m128i c16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(codes + i));
+            const __m128i lo = _mm_unpacklo_epi16(c16, zero);
+            const __m128i hi = _mm_unpackhi_epi16(c16, zero);
+            _mm_storeu_pd(out + i,     _mm_add_pd(vOffset, _mm_mul_pd(_mm_cvtepi32_pd(lo), vScale)));
+            _mm_storeu_pd(out + i + 2, _mm_add_pd(vOffset, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(lo, 8)), vScale)));
+            _mm_storeu_pd(out + i + 4, _mm_add_pd(vOffset, _mm_mul_pd(_mm_cvtepi32_pd(hi), vScale)));
+            _mm_storeu_pd(out + i + 6, _mm_add_pd(vOffset, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(hi, 8)), vScale)));
+        }
+    }
+#else
+    (void)hasNonFinite;
+#endif
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    for (; i < n; i++)
+    {
+        out[i] = codes[i] == nonFiniteCode ? nan : offset + codes[i] * scale;
+    }
+}
+
+void MMIntern::GridStoreKernels::decodeHalf(const uint16_t* codes, const std::size_t n, double* out)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i exponentMantissa = _mm_set1_epi32(0x7FFF);
+    const __m128i signBit = _mm_set1_epi32(0x8000);
+    const __m128i infNaNLimit = _mm_set1_epi32(0x0F7FE000);
+    const __m128i infNaNExponent = _mm_set1_epi32(0x7F800000);
+    const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32(0x77800000));
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m128i c16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(codes + i));
+        const __m128i halves[2] = {_mm_unpacklo_epi16(c16, zero), _mm_unpackhi_epi16(c16, zero)};
+        for (int k=0; k<2; k++)
+        {
+            const __m128i h = halves[k];
+            const __m128i bits = _mm_slli_epi32(_mm_and_si128(h, exponentMantissa), 13);
+            __m128i f = _mm_castps_si128(_mm_mul_ps(_mm_castsi128_ps(bits), magic));
+            f = _mm_or_si128(f, _mm_and_si128(_mm_cmpgt_epi32(bits, infNaNLimit), infNaNExponent));
+            f = _mm_or_si128(f, _mm_slli_epi32(_mm_and_si128(h, signBit), 16));
+            const __m128 values = _mm_castsi128_ps(f);
+            _mm_storeu_pd(out + i + 4*k,     _mm_cvtps_pd(values));
+            _mm_storeu_pd(out + i + 4*k + 2, _mm_cvtps_pd(_mm_movehl_ps(values, values)));
+        }
+    }
+#endif
+    for (; i < n; i++)
+    {
+        out[i] = halfToFloat(codes[i]);
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METEOMATICS GRID STORE
+//
+//  Holds grids in compressed form, split into square tiles that are compressed independently:
+//  Quantized maps every tile onto 16 bit steps of at most twice the error bound (tiles with a
+//  range too wide for 16 bit are kept as doubles), Half stores IEEE fp16 (about 3 significant
+//  digits, up to 65504). Reads only decode the rows of the tiles that are touched. Concurrent
+//  reads are fine, writes (put, erase) need exclusive access.
+//
+class MeteomaticsGridStore
+{
+public:
+    enum Codec
+    {
+        Quantized,
+        Half
+    };
+
+    MeteomaticsGridStore(const Codec codec=Quantized, const double errorBound=0.01, const std::size_t tileSize=64);
+
+    //
+    // -- compresses a grid as returned by getGrid ([lat][lon]), replacing a grid of the same key
+    //
+    bool put(const std::string& key, const Matrix& grid, const std::vector<double>& latGridPts, const std::vector<double>& lonGridPts, std::string& msg);
+
+    bool contains(const std::string& key) const;
+    void erase(const std::string& key);
+    void clear();
+
+    //
+    // -- decompressed reads: the whole grid, rows [latBegin, latEnd) x columns [lonBegin, lonEnd), or a single value
+    //
+    bool getGrid(const std::string& key, Matrix& grid, std::vector<double>& latGridPts, std::vector<double>& lonGridPts) const;
+    bool getRegion(const std::string& key, const std::size_t latBegin, const std::size_t latEnd, const std::size_t lonBegin, const std::size_t lonEnd, Matrix& region) const;
+    bool getValue(const std::string& key, const std::size_t latIndex, const std::size_t lonIndex, double& value) const;
+    bool getNearest(const std::string& key, const double lat, const double lon, double& value) const;   // nearest grid point
+
+    MeteomaticsGridStoreStats stats() const;
+
+private:
+    struct Tile
+    {
+        std::vector<uint16_t> codes;            // row-major within the tile
+        std::vector<double> raw;                // instead of codes if the range is too wide
+        double offset;
+        double scale;
+        bool hasNonFinite;
+    };
+
+    struct StoredGrid
+    {
+        std::size_t numLat;
+        std::size_t numLon;
+        std::size_t tilesPerRow;
+        std::vector<double> latGridPts;
+        std::vector<double> lonGridPts;
+        std::vector<Tile> tiles;
+        std::size_t storedBytes;
+    };
+
+    void compressTile(const Matrix& grid, const std::size_t row0, const std::size_t col0, const std::size_t rows, const std::size_t cols, Tile& tile) const;
+    void decodeRow(const StoredGrid& stored, const std::size_t row, const std::size_t colBegin, const std::size_t colEnd, double* out) const;
+    void accountDecode(const std::size_t numValues, const std::chrono::steady_clock::time_point& start) const;
+    static std::size_t nearestIndex(const std::vector<double>& points, const double coordinate);
+
+    const Codec codec;
+    const double errorBound;
+    const std::size_t tileSize;
+
+    std::map<std::string, StoredGrid> grids;
+
+    mutable std::atomic<std::size_t> decodedValues;
+    mutable std::atomic<long long> decodeNanoseconds;
+};
+
+MeteomaticsGridStoreStats::MeteomaticsGridStoreStats()
+: numGrids(0)
+, numValues(0)
+, rawBytes(0)
+, storedBytes(0)
+, compressionRatio(0)
+, decodedValues(0)
+, decodeSeconds(0)
+, decodeThroughput(0)
+{
+}
+
+MeteomaticsGridStore::MeteomaticsGridStore(const Codec _codec, const double _errorBound, const std::size_t _tileSize)
+: codec(_codec)
+, errorBound(_errorBound > 0 ? _errorBound : 0.01)
+, tileSize(std::max<std::size_t>(8, _tileSize))
+, decodedValues(0)
+, decodeNanoseconds(0)
+{
+}
+
+void MeteomaticsGridStore::compressTile(const Matrix& grid, const std::size_t row0, const std::size_t col0, const std::size_t rows, const std::size_t cols, Tile& tile) const
+{
+    tile.offset = 0;
+    tile.scale = 0;
+    tile.hasNonFinite = false;
+    tile.codes.resize(rows * cols);
+
+    if (codec == Half)
+    {
+        for (std::size_t i=0; i<rows; i++)
+        {
+            for (std::size_t j=0; j<cols; j++)
+            {
+                tile.codes[i*cols + j] = MMIntern::GridStoreKernels::floatToHalf(static_cast<float>(grid[row0 + i][col0 + j]));
+            }
+        }
+        return;
+    }
+
+    double minValue = std::numeric_limits<double>::max();
+    double maxValue = -std::numeric_limits<double>::max();
+    for (std::size_t i=0; i<rows; i++)
+    {
+        for (std::size_t j=0; j<cols; j++)
+        {
+            const double value = grid[row0 + i][col0 + j];
+            if (!std::isfinite(value))
+            {
+                tile.hasNonFinite = true;
+                continue;
+            }
+            minValue = std::min(minValue, value);
+            maxValue = std::max(maxValue, value);
+        }
+    }
+    if (minValue > maxValue)
+    {
+        minValue = maxValue = 0;                // no finite value at all
+    }
+
+    const double step = 2.0 * errorBound;
+    if ((maxValue - minValue) / step >= MMIntern::GridStoreKernels::maxCode)
+    {
+        tile.codes.clear();
+        tile.raw.resize(rows * cols);
+        for (std::size_t i=0; i<rows; i++)
+        {
+            std::memcpy(&tile.raw[i*cols], &grid[row0 + i][col0], cols * sizeof(double));
+        }
+        return;
+    }
+
+    tile.offset = minValue;
+    tile.scale = step;
+    for (std::size_t i=0; i<rows; i++)
+    {
+        for (std::size_t j=0; j<cols; j++)
+        {
+            const double value = grid[row0 + i][col0 + j];
+            tile.codes[i*cols + j] = std::isfinite(value)
+                ? static_cast<uint16_t>(std::floor((value - minValue) / step + 0.5))
+                : MMIntern::GridStoreKernels::nonFiniteCode;
+        }
+    }
+}
+
+bool MeteomaticsGridStore::put(const std::string& key, const Matrix& grid, const std::vector<double>& latGridPts, const std::vector<double>& lonGridPts, std::string& msg)
+{
+    const std::size_t numLat = grid.size();
+    const std::size_t numLon = numLat > 0 ? grid[0].size() : 0;
+    for (const auto& row : grid)
+    {
+        if (row.size() != numLon)
+        {
+            msg = "grid rows differ in length";
+            return false;
+        }
+    }
+
+    StoredGrid stored;
+    stored.numLat = numLat;
+    stored.numLon = numLon;
+    stored.tilesPerRow = (numLon + tileSize - 1) / tileSize;
+    stored.latGridPts = latGridPts;
+    stored.lonGridPts = lonGridPts;
+    stored.storedBytes = 0;
+
+    const std::size_t tilesPerColumn = (numLat + tileSize - 1) / tileSize;
+    stored.tiles.resize(tilesPerColumn * stored.tilesPerRow);
+    for (std::size_t ti=0; ti<tilesPerColumn; ti++)
+    {
+        for (std::size_t tj=0; tj<stored.tilesPerRow; tj++)
+        {
+            const std::size_t row0 = ti * tileSize;
+            const std::size_t col0 = tj * tileSize;
+            Tile& tile = stored.tiles[ti * stored.tilesPerRow + tj];
+            compressTile(grid, row0, col0, std::min(tileSize, numLat - row0), std::min(tileSize, numLon - col0), tile);
+            stored.storedBytes += tile.codes.size() * sizeof(uint16_t) + tile.raw.size() * sizeof(double);
+        }
+    }
+
+    grids[key] = std::move(stored);
+    return true;
+}
+
+bool MeteomaticsGridStore::contains(const std::string& key) const
+{
+    return grids.find(key) != grids.end();
+}
+
+void MeteomaticsGridStore::erase(const std::string& key)
+{
+    grids.erase(key);
+}
+
+void MeteomaticsGridStore::clear()
+{
+    grids.clear();
+}
+
+void MeteomaticsGridStore::decodeRow(const StoredGrid& stored, const std::size_t row, const std::size_t colBegin, const std::size_t colEnd, double* out) const
+{
+    const std::size_t ti = row / tileSize;
+    const std::size_t rowInTile = row - ti * tileSize;
+    std::size_t col = colBegin;
+    while (col < colEnd)
+    {
+        const std::size_t tj = col / tileSize;
+        const std::size_t col0 = tj * tileSize;
+        const std::size_t tileCols = std::min(tileSize, stored.numLon - col0);
+        const std::size_t n = std::min(colEnd, col0 + tileCols) - col;
+        const Tile& tile = stored.tiles[ti * stored.tilesPerRow + tj];
+        const std::size_t first = rowInTile * tileCols + (col - col0);
+
+        if (!tile.raw.empty())
+        {
+            std::memcpy(out, &tile.raw[first], n * sizeof(double));
+        }
+        else if (codec == Half)
+        {
+            MMIntern::GridStoreKernels::decodeHalf(&tile.codes[first], n, out);
+        }
+        else
+        {
+            MMIntern::GridStoreKernels::decodeQuantized(&tile.codes[first], n, tile.offset, tile.scale, tile.hasNonFinite, out);
+        }
+        out += n;
+        col += n;
+    }
+}
+
+void MeteomaticsGridStore::accountDecode(const std::size_t numValues, const std::chrono::steady_clock::time_point& start) const
+{
+    decodedValues += numValues;
+    decodeNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool MeteomaticsGridStore::getRegion(const std::string& key, const std::size_t latBegin, const std::size_t latEnd, const std::size_t lonBegin, const std::size_t lonEnd, Matrix& region) const
+{
+    std::map<std::string, StoredGrid>::const_iterator it = grids.find(key);
+    if (it == grids.end())
+    {
+        return false;
+    }
+    const StoredGrid& stored = it->second;
+    if (latBegin > latEnd || latEnd > stored.numLat || lonBegin > lonEnd || lonEnd > stored.numLon)
+    {
+        return false;
+    }
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    region.resize(latEnd - latBegin);
+    for (std::size_t i=latBegin; i<latEnd; i++)
+    {
+        std::vector<double>& row = region[i - latBegin];
+        row.resize(lonEnd - lonBegin);
+        decodeRow(stored, i, lonBegin, lonEnd, row.data());
+    }
+    accountDecode((latEnd - latBegin) * (lonEnd - lonBegin), start);
+    return true;
+}
+
+bool MeteomaticsGridStore::getGrid(const std::string& key, Matrix& grid, std::vector<double>& latGridPts, std::vector<double>& lonGridPts) const
+{
+    std::map<std::string, StoredGrid>::const_iterator it = grids.find(key);
+    if (it == grids.end())
+    {
+        return false;
+    }
+    latGridPts = it->second.latGridPts;
+    lonGridPts = it->second.lonGridPts;
+    return getRegion(key, 0, it->second.numLat, 0, it->second.numLon, grid);
+}
+
+bool MeteomaticsGridStore::getValue(const std::string& key, const std::size_t latIndex, const std::size_t lonIndex, double& value) const
+{
+    std::map<std::string, StoredGrid>::const_iterator it = grids.find(key);
+    if (it == grids.end() || latIndex >= it->second.numLat || lonIndex >= it->second.numLon)
+    {
+        return false;
+    }
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    decodeRow(it->second, latIndex, lonIndex, lonIndex + 1, &value);
+    accountDecode(1, start);
+    return true;
+}
+
+std::size_t MeteomaticsGridStore::nearestIndex(const std::vector<double>& points, const double coordinate)
+{
+    std::size_t nearest = 0;
+    for (std::size_t i=1; i<points.size(); i++)
+    {
+        if (std::fabs(points[i] - coordinate) < std::fabs(points[nearest] - coordinate))
+        {
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+bool MeteomaticsGridStore::getNearest(const std::string& key, const double lat, const double lon, double& value) const
+{
+    std::map<std::string, StoredGrid>::const_iterator it = grids.find(key);
+    if (it == grids.end() || it->second.latGridPts.empty() || it->second.lonGridPts.empty())
+    {
+        return false;
+    }
+    return getValue(key, nearestIndex(it->second.latGridPts, lat), nearestIndex(it->second.lonGridPts, lon), value);
+}
+
+MeteomaticsGridStoreStats MeteomaticsGridStore::stats() const
+{
+    MeteomaticsGridStoreStats s;
+    s.numGrids = grids.size();
+    for (const auto& entry : grids)
+    {
+        s.numValues += entry.second.numLat * entry.second.numLon;
+        s.storedBytes += entry.second.storedBytes;
+    }
+    s.rawBytes = s.numValues * sizeof(double);
+    s.compressionRatio = s.storedBytes > 0 ? static_cast<double>(s.rawBytes) / s.storedBytes : 0;
+    s.decodedValues = decodedValues;
+    s.decodeSeconds = 1e-9 * static_cast<double>(decodeNanoseconds.load());
+    s.decodeThroughput = s.decodeSeconds > 0 ? s.decodedValues / s.decodeSeconds : 0;
+    return s;
+}
+
+
+#endif /* Meteomatics_GridStore_h */
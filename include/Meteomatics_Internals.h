@@ -19,13 +19,50 @@
 #include <ctime>
 #include <chrono>
 #include <array>
+#include <map>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace MMIntern {
     class MemoryClass;
     class HttpClient;
+    class ThreadPool;
+    class MemoryStatsTable;
+    class CsvScanner;
+    class TraceSpan;
+    struct ResponseHeaders;
     
     bool http_code_success(int http_code);
     bool http_server_available(int http_code);   
+    
+    // seconds to wait before retrying a request whose attempt (0 based) was rate limited, negative to give up
+    double retryDelaySeconds(long http_code, const ResponseHeaders& responseHeaders, int attempt, int maxRetries, int timeout, const MeteomaticsRequestControl& control);
+    
+    bool parseIsoTime(const char* str, std::size_t len, double& unixSeconds);
+    bool parseIsoTime(const std::string& str, double& unixSeconds);
+    
+    bool parseCsvDouble(const char* begin, const char* end, double& value);
+    
+    template<class T> struct GridPrecision;
+    template<class Stored, class T>
+    bool readGridValues(MemoryClass& mem, BasicMatrix<T>& results, const MeteomaticsRequestControl& control);
 }
 
 
@@ -40,6 +77,8 @@ public:
     ~MemoryClass();
     
     void resetReadPos();                        // reading starts from beginning again
+    std::size_t getReadPos() const;
+    void setReadPos(std::size_t pos);
     
     std::size_t size() const;
     
@@ -87,6 +126,16 @@ void MMIntern::MemoryClass::resetReadPos()
     readPos = 0;
 }
 
+std::size_t MMIntern::MemoryClass::getReadPos() const
+{
+    return readPos;
+}
+
+void MMIntern::MemoryClass::setReadPos(std::size_t pos)
+{
+    readPos = std::min(pos, mem.size());
+}
+
 std::size_t MMIntern::MemoryClass::size() const
 {
     return mem.size();
@@ -166,205 +215,223 @@ MMIntern::MemoryClass& MMIntern::MemoryClass::operator<<(const T& v)
 
 
 //
-//  METEOMATICS HTTP CLIENT
+//  METEOMATICS THREAD POOL
 //
 
-bool MMIntern::http_code_success(int http_code)
-{
-    return http_code >= 200 && http_code < 400;
-}
-
-bool MMIntern::http_server_available(int http_code)
-{
-    return http_code >= 200 && http_code < 500;
-}
-
-// Caveat: This HttpClient implementation is not thread-safe, due to libcurl
-class MMIntern::HttpClient
+// Fixed set of workers executing parallel loops; the calling thread takes part in the loop.
+// One loop runs at a time, a concurrent caller executes its loop on its own thread instead.
+class MMIntern::ThreadPool
 {
 public:
-    HttpClient(const std::string& _url, const std::string& _user, const std::string& _password);
-    ~HttpClient();
+    explicit ThreadPool(std::size_t numThreads);
+    ~ThreadPool();
     
-    static std::size_t writeMemoryCallback(void* contents, std::size_t size, std::size_t nmemb, void* userp);
-    static std::size_t writeStringCallback(void* contents, std::size_t size, std::size_t nmemb, void* userp);
+    std::size_t size() const;                   // number of threads including the caller
     
-    std::size_t requestString(const std::string& url, const std::string& path, std::string& readBuffer, int timeout, int& http_code);
-    std::size_t requestBinary(const std::string& url, const std::string& path, MemoryClass& mem, int timeout, int& http_code) const;
+    // calls task(i) for all i in [0, numTasks) and returns when all are done
+    void parallelFor(std::size_t numTasks, const std::function<void(std::size_t)>& task);
     
 private:
-    std::string server;
-    std::string user;
-    std::string password;
+    struct Loop
+    {
+        const std::function<void(std::size_t)>* task;
+        std::size_t numTasks;
+        std::atomic<std::size_t> nextTask;
+        std::atomic<std::size_t> numDone;
+    };
+    
+    void workerLoop();
+    void runTasks(Loop& loop);
+    
+    std::vector<std::thread> workers;
+    std::mutex loopMutex;                       // serializes parallel loops
+    std::mutex mutex;
+    std::condition_variable wakeCond;
+    std::condition_variable doneCond;
+    std::shared_ptr<Loop> currentLoop;          // workers waking up late only find an exhausted loop
+    bool stop;
 };
 
-
-std::size_t MMIntern::HttpClient::writeMemoryCallback(void* contents, std::size_t size, std::size_t nmemb, void* userp)
+MMIntern::ThreadPool::ThreadPool(std::size_t numThreads)
+: stop(false)
 {
-    if (nullptr == contents)
-    {
-        assert(!"HttpClient::writeMemoryCallback got NULL-pointer from libcurl");
-        return 0;
-    }
-    
-    MemoryClass* mem = static_cast<MemoryClass*>(userp);
-    if (nullptr == mem)
+    for (std::size_t i=1; i<numThreads; i++)
     {
-        assert(!"HttpClient::writeMemoryCallback got NULL-pointer from user");
-        return 0;
+        workers.emplace_back(&ThreadPool::workerLoop, this);
     }
-    
-    std::size_t realsize = size * nmemb;
-    
-    char* inCPtr = static_cast<char*>(contents);
-    mem->mem.insert(mem->mem.end(), inCPtr, inCPtr+realsize);   // exceptions not caught...
-    
-    return realsize;
 }
 
-std::size_t MMIntern::HttpClient::writeStringCallback(void* contents, std::size_t size, std::size_t nmemb, void* userp)
+MMIntern::ThreadPool::~ThreadPool()
 {
-    if (nullptr == userp)
     {
-        assert(!"HttpClient::writeMemoryCallback got NULL-pointer from user");
-        return 0;
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
     }
-    if (nullptr == contents)
+    wakeCond.notify_all();
+    for (auto& w : workers)
     {
-        assert(!"HttpClient::writeMemoryCallback got NULL-pointer from libcurl");
-        return 0;
+        w.join();
     }
-    
-    ((std::string*)userp)->append((char*)contents, size * nmemb);
-    return size * nmemb;
 }
 
-MMIntern::HttpClient::HttpClient(const std::string& _url, const std::string& _user, const std::string& _password)
-: server(_url)
-, user(_user)
-, password(_password)
+std::size_t MMIntern::ThreadPool::size() const
 {
-    CURLcode res = curl_global_init(CURL_GLOBAL_ALL);
-    if(res != CURLE_OK)
-    {
-        std::cout << "curl_global_init() failed: " << curl_easy_strerror(res) << std::endl;
-        assert(false);
-    }
+    return workers.size() + 1;
 }
 
-MMIntern::HttpClient::~HttpClient()
+void MMIntern::ThreadPool::runTasks(Loop& loop)
 {
-    curl_global_cleanup();
+    for (std::size_t i = loop.nextTask.fetch_add(1); i < loop.numTasks; i = loop.nextTask.fetch_add(1))
+    {
+        (*loop.task)(i);
+        if (loop.numDone.fetch_add(1) + 1 == loop.numTasks)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            doneCond.notify_all();
+        }
+    }
 }
 
-std::size_t MMIntern::HttpClient::requestString(const std::string& url, const std::string& path, std::string& readBuffer, int timeout, int& http_code)
+void MMIntern::ThreadPool::workerLoop()
 {
-    http_code = 0;
-    std::string query(url);
-    query += path;
-    
-    readBuffer.clear();
-    
-    std::cout << "requesting string from " << query << std::endl;
-    CURL* curl = curl_easy_init();
-    if(curl)
+    std::shared_ptr<Loop> seenLoop;
+    while (true)
     {
-        struct curl_slist *headers=nullptr; // init to NULL is important
-        headers = curl_slist_append(headers, "Content-Type: text/plain");
-        
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers );
-        curl_easy_setopt(curl, CURLOPT_URL, query.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeStringCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
-        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
-        if (!user.empty() && !password.empty())
+        std::shared_ptr<Loop> loop;
         {
-            const std::string auth=user+":"+password;
-            curl_easy_setopt(curl, CURLOPT_USERPWD, auth.c_str());
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCond.wait(lock, [&]() { return stop || currentLoop != seenLoop; });
+            if (stop)
+            {
+                return;
+            }
+            loop = seenLoop = currentLoop;
         }
-        
-        CURLcode res = curl_easy_perform(curl);
-        if(res != CURLE_OK)
+        if (loop)
         {
-            std::cout << "curl_easy_perform() to server " << url << " with query " << query <<" failed: " << curl_easy_strerror(res) << std::endl;
-            return 0;
+            runTasks(*loop);
         }
-        long l_http_code = 0;
-        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &l_http_code);
-        curl_easy_cleanup(curl);
-        http_code = static_cast<int>(l_http_code);
-        
-        if (!http_server_available(http_code))
+    }
+}
+
+void MMIntern::ThreadPool::parallelFor(std::size_t numTasks, const std::function<void(std::size_t)>& task)
+{
+    std::unique_lock<std::mutex> loopLock(loopMutex, std::try_to_lock);
+    if (!loopLock.owns_lock() || workers.empty() || numTasks < 2)
+    {
+        for (std::size_t i=0; i<numTasks; i++)
         {
-            readBuffer.clear();
-            std::cout << "Server " << url << " with query " << query <<" replied with code " << http_code << std::endl;
-            return 0;
+            task(i);
         }
-        
-        return readBuffer.length();
+        return;
     }
-    else
+    
+    std::shared_ptr<Loop> loop = std::make_shared<Loop>();
+    loop->task = &task;
+    loop->numTasks = numTasks;
+    loop->nextTask = 0;
+    loop->numDone = 0;
     {
-        std::cout << "curl_easy_init failed, cannot query server " << url << " with query " << query << std::endl;
+        std::lock_guard<std::mutex> lock(mutex);
+        currentLoop = loop;
     }
+    wakeCond.notify_all();
     
-    return 0;
+    runTasks(*loop);
+    
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCond.wait(lock, [&loop]() { return loop->numDone.load() == loop->numTasks; });
 }
 
-std::size_t MMIntern::HttpClient::requestBinary(const std::string& url, const std::string& path, MemoryClass& memClass, int timeout, int& http_code) const
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METEOMATICS ISO TIME PARSING
+//
+
+// parses "YYYY-MM-DDTHH:MM:SS[.fff][Z|+HH:MM]" into seconds since 1970-01-01T00:00:00Z
+bool MMIntern::parseIsoTime(const char* str, std::size_t len, double& unixSeconds)
 {
-    http_code = 0;
-    std::string query(url);
-    query += path;
-    memClass.resetReadPos();
+    if (len < 19 || str[4] != '-' || str[7] != '-' || (str[10] != 'T' && str[10] != ' ') || str[13] != ':' || str[16] != ':')
+    {
+        return false;
+    }
     
-    std::cout << "requesting binary from " << query << std::endl;
-    CURL* curl = curl_easy_init();
-    if(curl)
+    static const int digitPos[14] = {0,1,2,3, 5,6, 8,9, 11,12, 14,15, 17,18};
+    int d[14];
+    for (int i=0; i<14; i++)
     {
-        struct curl_slist *headers=nullptr; // init to NULL is important
-        headers = curl_slist_append(headers, "Content-Type: text/plain");
-        
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers );
-        curl_easy_setopt(curl, CURLOPT_URL, (query).c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeMemoryCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &memClass);
-        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
-        if (!user.empty() && !password.empty())
-        {
-            const std::string auth=user+":"+password;
-            curl_easy_setopt(curl, CURLOPT_USERPWD, auth.c_str());
-        }
-        
-        CURLcode res = curl_easy_perform(curl);
-        if(res != CURLE_OK)
+        const char c = str[digitPos[i]];
+        if (c < '0' || c > '9')
         {
-            std::cout << "curl_easy_perform() to server " << url << " with query " << query <<" failed: " << curl_easy_strerror(res) << std::endl;
-            return 0;
+            return false;
         }
-        long l_http_code = 0;
-        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &l_http_code);
-        curl_easy_cleanup(curl);
-        http_code = static_cast<int>(l_http_code);
-        
-        if (!http_server_available(http_code))
+        d[i] = c - '0';
+    }
+    
+    int y = d[0]*1000 + d[1]*100 + d[2]*10 + d[3];
+    const int m = d[4]*10 + d[5];
+    const int day = d[6]*10 + d[7];
+    const int hour = d[8]*10 + d[9];
+    const int min = d[10]*10 + d[11];
+    const int sec = d[12]*10 + d[13];
+    if (m < 1 || m > 12 || day < 1 || day > 31 || hour > 24 || min > 59 || sec > 60)
+    {
+        return false;
+    }
+    
+    double frac = 0.0;
+    std::size_t pos = 19;
+    if (pos < len && str[pos] == '.')
+    {
+        double scale = 0.1;
+        for (pos++; pos < len && str[pos] >= '0' && str[pos] <= '9'; pos++, scale *= 0.1)
         {
-            memClass.resetReadPos();
-            std::cout << "Server " << url << " with query " << query <<" replied with code " << http_code << std::endl;
-            return 0;
+            frac += scale * (str[pos] - '0');
         }
-        
-        return memClass.size();
     }
-    else
+    
+    long offset = 0;
+    if (pos + 6 <= len && (str[pos] == '+' || str[pos] == '-') && str[pos+3] == ':')
     {
-        std::cout << "curl_easy_init failed, cannot query server " << url << " with query " << query << std::endl;
+        const long oh = (str[pos+1]-'0')*10 + (str[pos+2]-'0');
+        const long om = (str[pos+4]-'0')*10 + (str[pos+5]-'0');
+        offset = (str[pos] == '+' ? 1 : -1) * (oh*3600 + om*60);
     }
-    return 0;
+    
+    // days since epoch of the civil date (proleptic gregorian calendar)
+    y -= m <= 2;
+    const long era = (y >= 0 ? y : y-399) / 400;
+    const long yoe = y - era * 400;
+    const long doy = (153*(m + (m > 2 ? -3 : 9)) + 2)/5 + day-1;
+    const long doe = yoe * 365 + yoe/4 - yoe/100 + doy;
+    const long days = era * 146097 + doe - 719468;
+    
+    unixSeconds = static_cast<double>(days*86400L + hour*3600L + min*60L + sec - offset) + frac;
+    return true;
 }
 
+bool MMIntern::parseIsoTime(const std::string& str, double& unixSeconds)
+{
+    return parseIsoTime(str.data(), str.size(), unixSeconds);
+}
+
+
+
+
+
 
 
 
@@ -377,108 +444,2097 @@ std::size_t MMIntern::HttpClient::requestBinary(const std::string& url, const st
 
 
 //
-//  METOMATICS API METHODS
+//  METEOMATICS CSV PARSER
 //
-MeteomaticsApiClient::MeteomaticsApiClient(const std::string& user, const std::string& password, const int timeout_seconds)
-: httpClient(new MMIntern::HttpClient("api.meteomatics.com", user, password))
-, dataRequestTimeout(timeout_seconds)
+
+// Splits ';' separated lines into fields without copying them. Delimiters are searched
+// 16 bytes at a time with SSE2 where available.
+class MMIntern::CsvScanner
+{
+public:
+    CsvScanner(const char* data, std::size_t size);
+    
+    bool atEnd() const;
+    const char* position() const;
+    
+    bool field(const char*& begin, const char*& end);   // next field of the current line, false after its last field
+    void nextLine();                                    // skips the remaining fields of the current line
+    
+    static std::size_t countLines(const char* data, std::size_t size);
+    
+private:
+    const char* findDelimiter(const char* p) const;
+    
+    const char* pos;
+    const char* const end;
+    bool lineEnded;
+};
+
+MMIntern::CsvScanner::CsvScanner(const char* data, std::size_t size)
+: pos(data)
+, end(data + size)
+, lineEnded(false)
 {
 }
 
-std::string MeteomaticsApiClient::getIsoTimeStr(const int year, const int month, const int day, const int hour, const int min, const int sec) const
+bool MMIntern::CsvScanner::atEnd() const
 {
-    std::stringstream ss;
-    ss << std::setprecision(4);
-    ss << std::setw(4) << std::setfill('0') << year << '-';
-    ss << std::setprecision(2);
-    ss << std::setw(2) << std::setfill('0') << month << '-';
-    ss << std::setw(2) << std::setfill('0') << day << 'T';
-    ss << std::setw(2) << std::setfill('0') << hour << ':';
-    ss << std::setw(2) << std::setfill('0') << min << ':';
-    ss << std::setw(2) << std::setfill('0') << sec << 'Z';
-    return ss.str();
+    return pos >= end;
 }
 
-std::string MeteomaticsApiClient::getTimeStepStr(const int year, const int month, const int day, const int hour, const int min, const int sec) const
+const char* MMIntern::CsvScanner::position() const
 {
-    std::stringstream ss;
-    if (year > 0)
-        ss << year << "Y";
-    if (month > 0)
-        ss << month << "M";
-    if (day > 0)
-        ss << day << "D";
-    if (hour+min+sec > 0)
-        ss << "T";
-    if (hour > 0)
-        ss << hour << "H";
-    if (min > 0)
-        ss << min << "M";
-    if (sec > 0)
-        ss << sec << "S";
-    if (ss.str() == "")
-        return "0D";
-    else
-        return ss.str();
+    return pos;
 }
 
-std::string MeteomaticsApiClient::getOptionalSelectString(const std::vector<std::string>& optionals)
+const char* MMIntern::CsvScanner::findDelimiter(const char* p) const
 {
-    if (optionals.empty())
-    {
-        return "";
-    }
-    
-    std::string ret="?";
-    for (std::size_t i=0; i<optionals.size(); i++)
+#if defined(__SSE2__)
+    const __m128i semicolon = _mm_set1_epi8(';');
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; end - p >= 16; p += 16)
     {
-        ret += optionals[i];
-        if (i != optionals.size()-1)
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, semicolon), _mm_cmpeq_epi8(chunk, newline)));
+        if (mask != 0)
         {
-            ret += "&";
+            return p + __builtin_ctz(static_cast<unsigned>(mask));
         }
     }
-    return ret;
+#endif
+    while (p < end && *p != ';' && *p != '\n')
+    {
+        p++;
+    }
+    return p;
 }
 
-bool MeteomaticsApiClient::readMultiPointTimeSeriesBin(MMIntern::MemoryClass& mem, std::vector<Matrix>& results, std::vector<std::string>& times) const
+bool MMIntern::CsvScanner::field(const char*& fieldBegin, const char*& fieldEnd)
 {
-    int32_t nCoords;
-    mem.read(nCoords);
-    
-    for (int32_t i=0; i<nCoords; i++)
+    if (lineEnded || pos >= end)
     {
-        int32_t nTimes;
-        mem.read(nTimes);
-        
-        Matrix tmpMat;
-        tmpMat.reserve(nTimes);
-        for (int32_t j=0; j<nTimes; j++)
-        {
-            int32_t nParameter;
-            mem.read(nParameter);
-            
-            double t;
-            mem.read(t);
-            times.push_back(convDateIso8601(t));
-            
-            std::vector<double> tmpValues;
-            tmpValues.reserve(nParameter);
-            for (int32_t k=0; k<nParameter; k++)
-            {
-                double value;
-                mem.read(value);
-                tmpValues.push_back(value);
-            }
-            tmpMat.push_back(tmpValues);
-        }
-        results.push_back(tmpMat);
+        return false;
     }
-    
+    const char* delimiter = findDelimiter(pos);
+    fieldBegin = pos;
+    fieldEnd = delimiter;
+    if (fieldEnd > fieldBegin && fieldEnd[-1] == '\r')
+    {
+        fieldEnd--;
+    }
+    lineEnded = delimiter == end || *delimiter == '\n';
+    pos = delimiter < end ? delimiter + 1 : end;
     return true;
 }
 
-bool MeteomaticsApiClient::readSinglePointTimeSeriesBin(MMIntern::MemoryClass& mem, Matrix& results, std::vector<std::string>& times) const
+void MMIntern::CsvScanner::nextLine()
+{
+    const char* b;
+    const char* e;
+    while (field(b, e))
+    {
+    }
+    lineEnded = false;
+}
+
+std::size_t MMIntern::CsvScanner::countLines(const char* data, std::size_t size)
+{
+    std::size_t lines = 0;
+    const char* p = data;
+    const char* const dataEnd = data + size;
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; dataEnd - p >= 16; p += 16)
+    {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        lines += static_cast<std::size_t>(__builtin_popcount(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)))));
+    }
+#endif
+    for (; p < dataEnd; p++)
+    {
+        lines += *p == '\n';
+    }
+    if (size > 0 && data[size-1] != '\n')
+    {
+        lines++;                                // last line without newline
+    }
+    return lines;
+}
+
+bool MMIntern::parseCsvDouble(const char* begin, const char* end, double& value)
+{
+    // exact fast path for up to 15 significant digits and small exponents (both operands
+    // of the final multiplication are exact doubles), anything else goes to strtod
+    static const double powersOf10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char* p = begin;
+    const bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        p++;
+    }
+    
+    uint64_t mantissa = 0;
+    int numDigits = 0;
+    int exponent = 0;
+    bool anyDigit = false;
+    for (; p < end && static_cast<unsigned>(*p - '0') < 10; p++)
+    {
+        mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+        numDigits += mantissa != 0;
+        anyDigit = true;
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && static_cast<unsigned>(*p - '0') < 10; p++)
+        {
+            mantissa = mantissa * 10 + static_cast<unsigned>(*p - '0');
+            numDigits += mantissa != 0;
+            exponent--;
+            anyDigit = true;
+        }
+    }
+    if (anyDigit && p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* q = p + 1;
+        const bool negativeExponent = q < end && *q == '-';
+        if (q < end && (*q == '-' || *q == '+'))
+        {
+            q++;
+        }
+        int e = 0;
+        for (; q < end && static_cast<unsigned>(*q - '0') < 10 && e < 10000; q++)
+        {
+            e = e * 10 + (*q - '0');
+        }
+        exponent += negativeExponent ? -e : e;
+        p = q;
+    }
+    
+    if (anyDigit && p == end && numDigits <= 15 && exponent >= -22 && exponent <= 22)
+    {
+        const double m = static_cast<double>(mantissa);
+        value = exponent < 0 ? m / powersOf10[-exponent] : m * powersOf10[exponent];
+        value = negative ? -value : value;
+        return true;
+    }
+    
+    // nan, inf, long mantissas or big exponents, the field is followed by a delimiter or the terminating 0
+    char* stop = nullptr;
+    value = std::strtod(begin, &stop);
+    return stop == end && stop != begin;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METEOMATICS TRACER
+//
+
+// span from construction to end() or destruction, does nothing without a tracer
+class MMIntern::TraceSpan
+{
+public:
+    TraceSpan(MeteomaticsTracer* tracer, const char* name, const char* category, const std::string* detail=nullptr);
+    ~TraceSpan();
+    
+    void end();
+    
+private:
+    MeteomaticsTracer* tracer;
+    const char* name;
+    const char* category;
+    const std::string* detail;                  // must outlive the span
+    MeteomaticsTracer::Clock::time_point start;
+};
+
+MMIntern::TraceSpan::TraceSpan(MeteomaticsTracer* _tracer, const char* _name, const char* _category, const std::string* _detail)
+: tracer(_tracer)
+, name(_name)
+, category(_category)
+, detail(_detail)
+{
+    if (tracer)
+    {
+        start = MeteomaticsTracer::Clock::now();
+    }
+}
+
+MMIntern::TraceSpan::~TraceSpan()
+{
+    end();
+}
+
+void MMIntern::TraceSpan::end()
+{
+    if (tracer)
+    {
+        tracer->addSpan(name, category, start, MeteomaticsTracer::Clock::now(), detail ? *detail : std::string());
+        tracer = nullptr;
+    }
+}
+
+MeteomaticsTracer::MeteomaticsTracer(const std::size_t _maxEvents)
+: maxEvents(_maxEvents)
+, epoch(Clock::now())
+, dropped(0)
+{
+}
+
+void MeteomaticsTracer::addSpan(const char* name, const char* category, const Clock::time_point& start, const Clock::time_point& end, const std::string& detail)
+{
+    const std::thread::id id = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (events.size() >= maxEvents)
+    {
+        dropped++;
+        return;
+    }
+    
+    const std::size_t thread = std::find(threads.begin(), threads.end(), id) - threads.begin();
+    if (thread == threads.size())
+    {
+        threads.push_back(id);
+    }
+    
+    Event e;
+    e.name = name;
+    e.category = category;
+    e.thread = thread;
+    e.start = std::chrono::duration_cast<std::chrono::microseconds>(start - epoch).count();
+    e.duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    e.detail = detail;
+    events.push_back(std::move(e));
+}
+
+std::string MeteomaticsTracer::toJson() const
+{
+    const auto quoted = [](const std::string& str)
+    {
+        std::string result("\"");
+        for (const char c : str)
+        {
+            if (c == '"' || c == '\\')
+            {
+                result += '\\';
+                result += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                result += escaped;
+            }
+            else
+            {
+                result += c;
+            }
+        }
+        return result + "\"";
+    };
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    const int pid = static_cast<int>(getpid());
+    std::stringstream ss;
+    ss << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (std::size_t t=0; t<threads.size(); t++)
+    {
+        ss << (t > 0 ? ",\n" : "\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid << ",\"tid\":" << t + 1
+           << ",\"args\":{\"name\":\"thread " << t + 1 << "\"}}";
+    }
+    for (const auto& e : events)
+    {
+        ss << ",\n{\"ph\":\"X\",\"name\":" << quoted(e.name) << ",\"cat\":" << quoted(e.category) << ",\"pid\":" << pid << ",\"tid\":" << e.thread + 1
+           << ",\"ts\":" << e.start << ",\"dur\":" << e.duration;
+        if (!e.detail.empty())
+        {
+            ss << ",\"args\":{\"query\":" << quoted(e.detail) << "}";
+        }
+        ss << "}";
+    }
+    ss << "\n]}\n";
+    return ss.str();
+}
+
+bool MeteomaticsTracer::write(const std::string& path, std::string& msg) const
+{
+    std::FILE* out = std::fopen(path.c_str(), "wb");
+    if (!out)
+    {
+        msg = "cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    const std::string json = toJson();
+    const bool success = std::fwrite(json.data(), 1, json.size(), out) == json.size();
+    if (std::fclose(out) != 0 || !success)
+    {
+        msg = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+void MeteomaticsTracer::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    events.clear();
+    dropped = 0;
+}
+
+std::size_t MeteomaticsTracer::numEvents() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return events.size();
+}
+
+std::size_t MeteomaticsTracer::numDropped() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return dropped;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METEOMATICS HTTP CLIENT
+//
+
+bool MMIntern::http_code_success(int http_code)
+{
+    return http_code >= 200 && http_code < 400;
+}
+
+bool MMIntern::http_server_available(int http_code)
+{
+    return http_code >= 200 && http_code < 500;
+}
+
+// response header fields, names are stored in lower case
+struct MMIntern::ResponseHeaders
+{
+    std::map<std::string, std::string> fields;
+    
+    void clear();
+    std::string get(const std::string& lowerCaseName) const;
+    double retryAfterSeconds() const;           // negative if not present
+};
+
+void MMIntern::ResponseHeaders::clear()
+{
+    fields.clear();
+}
+
+std::string MMIntern::ResponseHeaders::get(const std::string& lowerCaseName) const
+{
+    std::map<std::string, std::string>::const_iterator it = fields.find(lowerCaseName);
+    return it == fields.end() ? std::string() : it->second;
+}
+
+double MMIntern::ResponseHeaders::retryAfterSeconds() const
+{
+    const std::string value = get("retry-after");
+    if (value.empty())
+    {
+        return -1.0;
+    }
+    if (value.find_first_not_of("0123456789") == std::string::npos)
+    {
+        return std::atof(value.c_str());                    // delay-seconds
+    }
+    const time_t date = curl_getdate(value.c_str(), nullptr);  // HTTP-date
+    if (date < 0)
+    {
+        return -1.0;
+    }
+    return std::max(0.0, std::difftime(date, std::time(nullptr)));
+}
+
+double MMIntern::retryDelaySeconds(long http_code, const ResponseHeaders& responseHeaders, int attempt, int maxRetries, int timeout, const MeteomaticsRequestControl& control)
+{
+    if (attempt >= maxRetries || (http_code != 429 && http_code != 503))
+    {
+        return -1.0;
+    }
+    double retryAfter = responseHeaders.retryAfterSeconds();
+    if (retryAfter < 0)
+    {
+        if (http_code == 503)
+        {
+            return -1.0;                        // unavailable without advice, don't retry
+        }
+        retryAfter = 1 << attempt;
+    }
+    if (retryAfter > timeout || 1000.0 * retryAfter > control.remainingMilliseconds())
+    {
+        return -1.0;
+    }
+    return retryAfter;
+}
+
+// Caveat: This HttpClient implementation is not thread-safe, due to libcurl
+//   (all handles share the DNS and TLS session caches though, which are protected by locks. libcurl doesn't
+//   support sharing the connection cache between threads, so open connections stay with the easy handle that
+//   made them; idle handles are pooled, such that every concurrent request uses a handle of its own)
+class MMIntern::HttpClient
+{
+public:
+    HttpClient(const std::string& _url, const std::string& _user, const std::string& _password);
+    ~HttpClient();
+    
+    static std::size_t writeMemoryCallback(void* contents, std::size_t size, std::size_t nmemb, void* userp);
+    static std::size_t writeStringCallback(void* contents, std::size_t size, std::size_t nmemb, void* userp);
+    static std::size_t headerCallback(char* buffer, std::size_t size, std::size_t nitems, void* userp);
+    
+    std::size_t requestString(const std::string& url, const std::string& path, std::string& readBuffer, int timeout, int& http_code, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+    std::size_t requestBinary(const std::string& url, const std::string& path, MemoryClass& mem, int timeout, int& http_code, const MeteomaticsRequestControl& control=MeteomaticsRequestControl()) const;
+    // additionally sends requestHeaders (e.g. "If-None-Match: ...") and returns the headers of the final response
+    std::size_t requestBinary(const std::string& url, const std::string& path, MemoryClass& mem, int timeout, int& http_code, const MeteomaticsRequestControl& control, const std::vector<std::string>& requestHeaders, ResponseHeaders& responseHeaders) const;
+    
+    static int xferInfoCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+    
+    void setRateLimiter(const std::shared_ptr<MeteomaticsRateLimiter>& _rateLimiter, const MeteomaticsRateLimiter::Priority _priority);
+    void setTransportArchive(const std::shared_ptr<MeteomaticsTransportArchive>& _archive);
+    void setTracer(const std::shared_ptr<MeteomaticsTracer>& _tracer);
+    MeteomaticsRateLimiter* getRateLimiter() const;
+    MeteomaticsTracer* getTracer() const;
+    MeteomaticsRateLimiter::Priority getPriority() const;
+    const std::string& getServer() const;
+    
+    // pre-resolves the server and opens a connection on each of numConnections pooled handles, returns the number opened
+    std::size_t warmUp(const std::size_t numConnections, int timeout) const;
+    
+    // sets all options of a request on the handle, the returned header list must be freed after the transfer
+    struct curl_slist* configureHandle(CURL* curl, const std::string& query, std::size_t (*writeFunction)(void*, std::size_t, std::size_t, void*), void* writeData, ResponseHeaders& responseHeaders, int timeout, const MeteomaticsRequestControl& control, const std::vector<std::string>& requestHeaders=std::vector<std::string>()) const;
+    
+    // serves a recorded response while the archive replays, records a received response while it records
+    bool replay(const std::string& path, std::size_t (*writeFunction)(void*, std::size_t, std::size_t, void*), void* writeData, int& http_code, ResponseHeaders& responseHeaders, const std::vector<std::string>& requestHeaders=std::vector<std::string>()) const;
+    void record(const std::string& path, const int http_code, const ResponseHeaders& responseHeaders, const char* body, const std::size_t size) const;
+    
+    // emits the dns, connect, tls, server wait and transfer spans of a finished transfer started at start
+    void traceTransfer(CURL* curl, const MeteomaticsTracer::Clock::time_point& start, const std::string& query) const;
+    
+private:
+    // performs the request, honoring the rate limiter and retrying on 429/503 with Retry-After
+    CURLcode perform(const std::string& query, std::size_t (*writeFunction)(void*, std::size_t, std::size_t, void*), void* writeData, const std::function<void()>& resetData, const std::function<std::size_t()>& receivedBytes, int timeout, long& http_code, const MeteomaticsRequestControl& control, const std::vector<std::string>& requestHeaders, ResponseHeaders& responseHeaders) const;
+    
+    std::string server;
+    std::string user;
+    std::string password;
+    
+    std::shared_ptr<MeteomaticsRateLimiter> rateLimiter;
+    MeteomaticsRateLimiter::Priority priority;
+    std::shared_ptr<MeteomaticsTransportArchive> archive;
+    std::shared_ptr<MeteomaticsTracer> tracer;
+    
+    static void shareLockCallback(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr);
+    static void shareUnlockCallback(CURL* handle, curl_lock_data data, void* userptr);
+    
+    // an idle handle with its open connections, or a new one; released handles are reset and pooled
+    CURL* acquireHandle() const;
+    void releaseHandle(CURL* curl) const;
+    
+    CURLSH* share;
+    std::mutex shareLocks[CURL_LOCK_DATA_LAST];
+    mutable std::mutex handleMutex;
+    mutable std::vector<CURL*> idleHandles;
+    
+    static const int maxRetries = 3;
+    static const long maxCachedConnections = 64;
+};
+
+
+std::size_t MMIntern::HttpClient::writeMemoryCallback(void* contents, std::size_t size, std::size_t nmemb, void* userp)
+{
+    if (nullptr == contents)
+    {
+        assert(!"HttpClient::writeMemoryCallback got NULL-pointer from libcurl");
+        return 0;
+    }
+    
+    MemoryClass* mem = static_cast<MemoryClass*>(userp);
+    if (nullptr == mem)
+    {
+        assert(!"HttpClient::writeMemoryCallback got NULL-pointer from user");
+        return 0;
+    }
+    
+    std::size_t realsize = size * nmemb;
+    
+    char* inCPtr = static_cast<char*>(contents);
+    mem->mem.insert(mem->mem.end(), inCPtr, inCPtr+realsize);   // exceptions not caught...
+    
+    return realsize;
+}
+
+std::size_t MMIntern::HttpClient::writeStringCallback(void* contents, std::size_t size, std::size_t nmemb, void* userp)
+{
+    if (nullptr == userp)
+    {
+        assert(!"HttpClient::writeMemoryCallback got NULL-pointer from user");
+        return 0;
+    }
+    if (nullptr == contents)
+    {
+        assert(!"HttpClient::writeMemoryCallback got NULL-pointer from libcurl");
+        return 0;
+    }
+    
+    ((std::string*)userp)->append((char*)contents, size * nmemb);
+    return size * nmemb;
+}
+
+std::size_t MMIntern::HttpClient::headerCallback(char* buffer, std::size_t size, std::size_t nitems, void* userp)
+{
+    ResponseHeaders* headers = static_cast<ResponseHeaders*>(userp);
+    const std::size_t realsize = size * nitems;
+    if (nullptr == headers || nullptr == buffer)
+    {
+        return realsize;
+    }
+    
+    const std::string line(buffer, realsize);
+    const std::size_t colon = line.find(':');
+    if (colon == std::string::npos)
+    {
+        if (line.compare(0, 5, "HTTP/") == 0)
+        {
+            headers->clear();                   // new response (e.g. after a redirect)
+        }
+        return realsize;
+    }
+    
+    std::string name = line.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    const std::size_t begin = line.find_first_not_of(" \t", colon+1);
+    const std::size_t end = line.find_last_not_of(" \t\r\n");
+    headers->fields[name] = (begin == std::string::npos || end < begin) ? std::string() : line.substr(begin, end-begin+1);
+    return realsize;
+}
+
+MMIntern::HttpClient::HttpClient(const std::string& _url, const std::string& _user, const std::string& _password)
+: server(_url)
+, user(_user)
+, password(_password)
+, priority(MeteomaticsRateLimiter::Interactive)
+{
+    CURLcode res = curl_global_init(CURL_GLOBAL_ALL);
+    if(res != CURLE_OK)
+    {
+        std::cout << "curl_global_init() failed: " << curl_easy_strerror(res) << std::endl;
+        assert(false);
+    }
+    
+    share = curl_share_init();
+    if (share)
+    {
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, shareLockCallback);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, shareUnlockCallback);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+    else
+    {
+        std::cout << "curl_share_init() failed, handles won't share caches" << std::endl;
+    }
+}
+
+MMIntern::HttpClient::~HttpClient()
+{
+    for (CURL* curl : idleHandles)
+    {
+        curl_easy_cleanup(curl);
+    }
+    if (share)
+    {
+        curl_share_cleanup(share);
+    }
+    curl_global_cleanup();
+}
+
+void MMIntern::HttpClient::shareLockCallback(CURL*, curl_lock_data data, curl_lock_access, void* userptr)
+{
+    static_cast<HttpClient*>(userptr)->shareLocks[data].lock();
+}
+
+void MMIntern::HttpClient::shareUnlockCallback(CURL*, curl_lock_data data, void* userptr)
+{
+    static_cast<HttpClient*>(userptr)->shareLocks[data].unlock();
+}
+
+CURL* MMIntern::HttpClient::acquireHandle() const
+{
+    {
+        std::lock_guard<std::mutex> lock(handleMutex);
+        if (!idleHandles.empty())
+        {
+            CURL* curl = idleHandles.back();
+            idleHandles.pop_back();
+            return curl;
+        }
+    }
+    return curl_easy_init();
+}
+
+void MMIntern::HttpClient::releaseHandle(CURL* curl) const
+{
+    curl_easy_reset(curl);                              // keeps the open connections of the handle
+    {
+        std::lock_guard<std::mutex> lock(handleMutex);
+        if (idleHandles.size() < static_cast<std::size_t>(maxCachedConnections))
+        {
+            idleHandles.push_back(curl);
+            return;
+        }
+    }
+    curl_easy_cleanup(curl);
+}
+
+std::size_t MMIntern::HttpClient::warmUp(const std::size_t numConnections, int timeout) const
+{
+    // concurrent HEAD requests, such that every one acquires a handle of its own and leaves its connection on it
+    const std::string query = server + "/";
+    const std::size_t n = std::min(numConnections, static_cast<std::size_t>(maxCachedConnections));
+    std::vector<CURL*> handles;
+    for (std::size_t i=0; i<n; i++)
+    {
+        CURL* curl = acquireHandle();
+        if (!curl)
+        {
+            std::cout << "curl_easy_init failed, cannot warm up connections to " << server << std::endl;
+            break;
+        }
+        handles.push_back(curl);
+    }
+    
+    std::atomic<std::size_t> numOpened(0);
+    std::vector<std::thread> threads;
+    for (CURL* curl : handles)
+    {
+        threads.emplace_back([this, curl, &query, timeout, &numOpened]()
+        {
+            MemoryClass discard;
+            ResponseHeaders responseHeaders;
+            struct curl_slist* headers = configureHandle(curl, query, writeMemoryCallback, &discard, responseHeaders, timeout, MeteomaticsRequestControl());
+            curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+            if (curl_easy_perform(curl) == CURLE_OK)
+            {
+                numOpened++;
+            }
+            curl_slist_free_all(headers);
+        });
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    for (CURL* curl : handles)
+    {
+        releaseHandle(curl);
+    }
+    return numOpened;
+}
+
+void MMIntern::HttpClient::setRateLimiter(const std::shared_ptr<MeteomaticsRateLimiter>& _rateLimiter, const MeteomaticsRateLimiter::Priority _priority)
+{
+    rateLimiter = _rateLimiter;
+    priority = _priority;
+}
+
+int MMIntern::HttpClient::xferInfoCallback(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
+{
+    const MeteomaticsRequestControl* control = static_cast<const MeteomaticsRequestControl*>(clientp);
+    return (control && control->expired()) ? 1 : 0;    // non-zero aborts the transfer
+}
+
+struct curl_slist* MMIntern::HttpClient::configureHandle(CURL* curl, const std::string& query, std::size_t (*writeFunction)(void*, std::size_t, std::size_t, void*), void* writeData, ResponseHeaders& responseHeaders, int timeout, const MeteomaticsRequestControl& control, const std::vector<std::string>& requestHeaders) const
+{
+    struct curl_slist *headers=nullptr; // init to NULL is important
+    headers = curl_slist_append(headers, "Content-Type: text/plain");
+    for (const auto& header : requestHeaders)
+    {
+        headers = curl_slist_append(headers, header.c_str());
+    }
+    
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers );
+    curl_easy_setopt(curl, CURLOPT_URL, query.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeFunction);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, writeData);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &responseHeaders);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+    if (share)
+    {
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+    }
+    if (control.hasDeadline() || control.cancellation.canBeCancelled())
+    {
+        const long remaining = control.remainingMilliseconds();
+        if (remaining < 1000L * timeout)
+        {
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, std::max(1L, remaining));
+        }
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferInfoCallback);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &control);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    }
+    if (!user.empty() && !password.empty())
+    {
+        const std::string auth=user+":"+password;
+        curl_easy_setopt(curl, CURLOPT_USERPWD, auth.c_str());
+    }
+    return headers;
+}
+
+void MMIntern::HttpClient::setTransportArchive(const std::shared_ptr<MeteomaticsTransportArchive>& _archive)
+{
+    archive = _archive;
+}
+
+bool MMIntern::HttpClient::replay(const std::string& path, std::size_t (*writeFunction)(void*, std::size_t, std::size_t, void*), void* writeData, int& http_code, ResponseHeaders& responseHeaders, const std::vector<std::string>& requestHeaders) const
+{
+    if (!archive || !archive->isReplaying())
+    {
+        return false;
+    }
+    
+    std::string headers;
+    const char* body = nullptr;
+    std::size_t size = 0;
+    responseHeaders.clear();
+    if (!archive->find(path, requestHeaders, http_code, headers, body, size))
+    {
+        std::cout << "no recording of " << path << std::endl;
+        http_code = 404;
+        return true;
+    }
+    
+    std::stringstream lines(headers);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        headerCallback(&line[0], 1, line.size(), &responseHeaders);
+    }
+    if (size > 0)
+    {
+        writeFunction(const_cast<char*>(body), 1, size, writeData);
+    }
+    return true;
+}
+
+void MMIntern::HttpClient::record(const std::string& path, const int http_code, const ResponseHeaders& responseHeaders, const char* body, const std::size_t size) const
+{
+    if (!archive || !archive->isRecording())
+    {
+        return;
+    }
+    
+    std::string headers;
+    for (const auto& field : responseHeaders.fields)
+    {
+        headers += field.first + ": " + field.second + "\n";
+    }
+    archive->add(path, http_code, headers, body, size);
+}
+
+MeteomaticsRateLimiter* MMIntern::HttpClient::getRateLimiter() const
+{
+    return rateLimiter.get();
+}
+
+void MMIntern::HttpClient::setTracer(const std::shared_ptr<MeteomaticsTracer>& _tracer)
+{
+    tracer = _tracer;
+}
+
+MeteomaticsTracer* MMIntern::HttpClient::getTracer() const
+{
+    return tracer.get();
+}
+
+void MMIntern::HttpClient::traceTransfer(CURL* curl, const MeteomaticsTracer::Clock::time_point& start, const std::string& query) const
+{
+    if (!tracer)
+    {
+        return;
+    }
+    
+    // libcurl reports the end of every phase in microseconds since the start of the transfer, 0 if skipped (e.g. reused connection)
+    curl_off_t nameLookup = 0, connect = 0, appConnect = 0, startTransfer = 0, total = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &nameLookup);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appConnect);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &startTransfer);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+    
+    const auto at = [&start](const curl_off_t microseconds) { return start + std::chrono::microseconds(microseconds); };
+    tracer->addSpan("http", "transfer", start, at(total), query);
+    if (nameLookup > 0)
+    {
+        tracer->addSpan("dns", "transfer", start, at(nameLookup));
+    }
+    if (connect > nameLookup)
+    {
+        tracer->addSpan("connect", "transfer", at(nameLookup), at(connect));
+    }
+    if (appConnect > connect)
+    {
+        tracer->addSpan("tls", "transfer", at(connect), at(appConnect));
+    }
+    const curl_off_t requestSent = std::max(std::max(nameLookup, connect), appConnect);
+    if (startTransfer > requestSent)
+    {
+        tracer->addSpan("server wait", "transfer", at(requestSent), at(startTransfer));
+    }
+    if (total > startTransfer && startTransfer > 0)
+    {
+        tracer->addSpan("transfer", "transfer", at(startTransfer), at(total));
+    }
+}
+
+MeteomaticsRateLimiter::Priority MMIntern::HttpClient::getPriority() const
+{
+    return priority;
+}
+
+const std::string& MMIntern::HttpClient::getServer() const
+{
+    return server;
+}
+
+CURLcode MMIntern::HttpClient::perform(const std::string& query, std::size_t (*writeFunction)(void*, std::size_t, std::size_t, void*), void* writeData, const std::function<void()>& resetData, const std::function<std::size_t()>& receivedBytes, int timeout, long& http_code, const MeteomaticsRequestControl& control, const std::vector<std::string>& requestHeaders, ResponseHeaders& responseHeaders) const
+{
+    CURLcode res = CURLE_FAILED_INIT;
+    for (int attempt=0; attempt<=maxRetries; attempt++)
+    {
+        http_code = 0;
+        resetData();
+        
+        if (control.expired())
+        {
+            return CURLE_ABORTED_BY_CALLBACK;
+        }
+        TraceSpan queueWait(rateLimiter ? tracer.get() : nullptr, "queue wait", "client");
+        if (rateLimiter && !rateLimiter->acquire(priority, control.deadline))
+        {
+            return CURLE_OPERATION_TIMEDOUT;
+        }
+        queueWait.end();
+        
+        CURL* curl = acquireHandle();
+        if (!curl)
+        {
+            return CURLE_FAILED_INIT;
+        }
+        
+        responseHeaders.clear();
+        struct curl_slist *headers = configureHandle(curl, query, writeFunction, writeData, responseHeaders, timeout, control, requestHeaders);
+        
+        const MeteomaticsTracer::Clock::time_point started = MeteomaticsTracer::Clock::now();
+        res = curl_easy_perform(curl);
+        curl_easy_getinfo (curl, CURLINFO_RESPONSE_CODE, &http_code);
+        traceTransfer(curl, started, query);
+        releaseHandle(curl);
+        curl_slist_free_all(headers);
+        
+        if (rateLimiter)
+        {
+            rateLimiter->consumeBytes(receivedBytes());
+        }
+        
+        // only rate limited requests are retried, such that the quota isn't hammered in a tight loop
+        const double retryAfter = (res == CURLE_OK && rateLimiter) ? retryDelaySeconds(http_code, responseHeaders, attempt, maxRetries, timeout, control) : -1.0;
+        if (retryAfter < 0)
+        {
+            break;
+        }
+        std::cout << "Server replied with code " << http_code << ", retrying in " << retryAfter << "s" << std::endl;
+        rateLimiter->pauseFor(retryAfter);
+    }
+    return res;
+}
+
+std::size_t MMIntern::HttpClient::requestString(const std::string& url, const std::string& path, std::string& readBuffer, int timeout, int& http_code, const MeteomaticsRequestControl& control)
+{
+    http_code = 0;
+    std::string query(url);
+    query += path;
+    
+    readBuffer.clear();
+    
+    ResponseHeaders responseHeaders;
+    if (replay(path, writeStringCallback, &readBuffer, http_code, responseHeaders))
+    {
+        if (!http_server_available(http_code))
+        {
+            readBuffer.clear();
+            return 0;
+        }
+        return readBuffer.length();
+    }
+    
+    std::cout << "requesting string from " << query << std::endl;
+    long l_http_code = 0;
+    CURLcode res = perform(query, writeStringCallback, &readBuffer, [&readBuffer]() { readBuffer.clear(); }, [&readBuffer]() { return readBuffer.size(); }, timeout, l_http_code, control, std::vector<std::string>(), responseHeaders);
+    if (res == CURLE_FAILED_INIT)
+    {
+        std::cout << "curl_easy_init failed, cannot query server " << url << " with query " << query << std::endl;
+        return 0;
+    }
+    if(res != CURLE_OK)
+    {
+        std::cout << "curl_easy_perform() to server " << url << " with query " << query <<" failed: " << curl_easy_strerror(res) << std::endl;
+        return 0;
+    }
+    http_code = static_cast<int>(l_http_code);
+    record(path, http_code, responseHeaders, readBuffer.data(), readBuffer.size());
+    
+    if (!http_server_available(http_code))
+    {
+        readBuffer.clear();
+        std::cout << "Server " << url << " with query " << query <<" replied with code " << http_code << std::endl;
+        return 0;
+    }
+    
+    return readBuffer.length();
+}
+
+std::size_t MMIntern::HttpClient::requestBinary(const std::string& url, const std::string& path, MemoryClass& memClass, int timeout, int& http_code, const MeteomaticsRequestControl& control) const
+{
+    ResponseHeaders responseHeaders;
+    return requestBinary(url, path, memClass, timeout, http_code, control, std::vector<std::string>(), responseHeaders);
+}
+
+std::size_t MMIntern::HttpClient::requestBinary(const std::string& url, const std::string& path, MemoryClass& memClass, int timeout, int& http_code, const MeteomaticsRequestControl& control, const std::vector<std::string>& requestHeaders, ResponseHeaders& responseHeaders) const
+{
+    http_code = 0;
+    std::string query(url);
+    query += path;
+    memClass.mem.clear();
+    memClass.resetReadPos();
+    
+    if (replay(path, writeMemoryCallback, &memClass, http_code, responseHeaders, requestHeaders))
+    {
+        if (!http_server_available(http_code))
+        {
+            memClass.resetReadPos();
+            return 0;
+        }
+        return memClass.size();
+    }
+    
+    std::cout << "requesting binary from " << query << std::endl;
+    long l_http_code = 0;
+    CURLcode res = perform(query, writeMemoryCallback, &memClass, [&memClass]() { memClass.mem.clear(); memClass.resetReadPos(); }, [&memClass]() { return memClass.size(); }, timeout, l_http_code, control, requestHeaders, responseHeaders);
+    if (res == CURLE_FAILED_INIT)
+    {
+        std::cout << "curl_easy_init failed, cannot query server " << url << " with query " << query << std::endl;
+        return 0;
+    }
+    if(res != CURLE_OK)
+    {
+        std::cout << "curl_easy_perform() to server " << url << " with query " << query <<" failed: " << curl_easy_strerror(res) << std::endl;
+        return 0;
+    }
+    http_code = static_cast<int>(l_http_code);
+    record(path, http_code, responseHeaders, memClass.mem.data(), memClass.size());
+    
+    if (!http_server_available(http_code))
+    {
+        memClass.resetReadPos();
+        std::cout << "Server " << url << " with query " << query <<" replied with code " << http_code << std::endl;
+        return 0;
+    }
+    
+    return memClass.size();
+}
+
+
+
+//
+//  METEOMATICS RATE LIMITER
+//
+
+MeteomaticsRateLimiter::MeteomaticsRateLimiter(const double requestsPerSecond, const double bytesPerSecond, const double burstSeconds)
+: requestRate(requestsPerSecond)
+, byteRate(bytesPerSecond)
+, requestCapacity(std::max(1.0, requestsPerSecond * burstSeconds))
+, byteCapacity(std::max(1.0, bytesPerSecond * burstSeconds))
+, requestTokens(std::max(1.0, requestsPerSecond * burstSeconds))
+, byteTokens(std::max(1.0, bytesPerSecond * burstSeconds))
+, lastRefill(Clock::now())
+, pausedUntil(Clock::now())
+{
+    waiting[Interactive] = 0;
+    waiting[Backfill] = 0;
+}
+
+void MeteomaticsRateLimiter::refill(const Clock::time_point now)
+{
+    const double elapsed = std::chrono::duration<double>(now - lastRefill).count();
+    lastRefill = now;
+    if (requestRate > 0)
+    {
+        requestTokens = std::min(requestCapacity, requestTokens + elapsed * requestRate);
+    }
+    if (byteRate > 0)
+    {
+        byteTokens = std::min(byteCapacity, byteTokens + elapsed * byteRate);
+    }
+}
+
+bool MeteomaticsRateLimiter::take(const Priority priority, double& waitSeconds)
+{
+    const Clock::time_point now = Clock::now();
+    refill(now);
+    waitSeconds = 0.0;
+    
+    if (now < pausedUntil)
+    {
+        waitSeconds = std::chrono::duration<double>(pausedUntil - now).count();
+        return false;
+    }
+    if (priority == Backfill && waiting[Interactive] > 0)
+    {
+        return false;                           // interactive requests jump ahead
+    }
+    
+    const bool requestAvailable = requestRate <= 0 || requestTokens >= 1.0;
+    const bool bytesAvailable = byteRate <= 0 || byteTokens >= 0.0;
+    if (requestAvailable && bytesAvailable)
+    {
+        if (requestRate > 0)
+        {
+            requestTokens -= 1.0;
+        }
+        return true;
+    }
+    
+    if (!requestAvailable)
+    {
+        waitSeconds = std::max(waitSeconds, (1.0 - requestTokens) / requestRate);
+    }
+    if (!bytesAvailable)
+    {
+        waitSeconds = std::max(waitSeconds, -byteTokens / byteRate);
+    }
+    return false;
+}
+
+bool MeteomaticsRateLimiter::acquire(const Priority priority, const std::chrono::steady_clock::time_point& deadline)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    waiting[priority]++;
+    
+    bool acquired = false;
+    while (!acquired)
+    {
+        double waitSeconds = 0.0;
+        acquired = take(priority, waitSeconds);
+        if (acquired || Clock::now() >= deadline)
+        {
+            break;
+        }
+        Clock::time_point until = deadline;
+        if (waitSeconds > 0.0)
+        {
+            until = std::min(until, Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(waitSeconds)));
+        }
+        if (until == Clock::time_point::max())
+        {
+            cond.wait(lock);
+        }
+        else
+        {
+            cond.wait_until(lock, until);
+        }
+    }
+    
+    waiting[priority]--;
+    lock.unlock();
+    cond.notify_all();
+    return acquired;
+}
+
+bool MeteomaticsRateLimiter::tryAcquire(const Priority priority, double& waitSeconds)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return take(priority, waitSeconds);
+}
+
+void MeteomaticsRateLimiter::consumeBytes(const std::size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (byteRate > 0)
+    {
+        refill(Clock::now());
+        byteTokens -= static_cast<double>(bytes);
+    }
+}
+
+void MeteomaticsRateLimiter::holdFor(const double seconds)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        const Clock::time_point until = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+        pausedUntil = std::max(pausedUntil, until);
+    }
+    cond.notify_all();
+}
+
+void MeteomaticsRateLimiter::pauseFor(const double seconds)
+{
+    holdFor(seconds);
+    
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait_until(lock, pausedUntil, [this]() { return Clock::now() >= pausedUntil; });
+}
+
+std::size_t MeteomaticsRateLimiter::numWaiting(const Priority priority) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return waiting[priority];
+}
+
+
+
+//
+//  METEOMATICS TRANSPORT ARCHIVE
+//
+//  The file is a sequence of records: uint32 magic, int32 http code, uint32 path bytes, uint32 header bytes,
+//  uint64 body bytes, then path, headers and body. A record cut off at the end (e.g. by a crash) is ignored.
+//
+
+MeteomaticsTransportArchive::MeteomaticsTransportArchive()
+: out(nullptr)
+, mapping(nullptr)
+, data(nullptr)
+, dataBytes(0)
+, replaying(false)
+, recorded(0)
+, replayed(0)
+, missing(0)
+{
+}
+
+MeteomaticsTransportArchive::~MeteomaticsTransportArchive()
+{
+    close();
+}
+
+bool MeteomaticsTransportArchive::record(const std::string& path, std::string& msg, const bool append)
+{
+    close();
+    std::lock_guard<std::mutex> lock(mutex);
+    out = std::fopen(path.c_str(), append ? "ab" : "wb");
+    if (!out)
+    {
+        msg = "cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool MeteomaticsTransportArchive::replay(const std::string& path, std::string& msg, const bool mapped)
+{
+    close();
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        msg = "cannot open " + path + ": " + std::strerror(errno);
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        return false;
+    }
+    dataBytes = static_cast<std::size_t>(st.st_size);
+    if (dataBytes > 0 && mapped)
+    {
+        mapping = mmap(nullptr, dataBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            mapping = nullptr;
+            msg = std::string("mmap failed: ") + std::strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        data = static_cast<const char*>(mapping);
+    }
+    else if (dataBytes > 0)
+    {
+        buffer.resize(dataBytes);
+        std::size_t done = 0;
+        while (done < dataBytes)
+        {
+            const ssize_t n = ::read(fd, &buffer[done], dataBytes - done);
+            if (n <= 0)
+            {
+                break;
+            }
+            done += static_cast<std::size_t>(n);
+        }
+        dataBytes = done;
+        data = buffer.data();
+    }
+    ::close(fd);
+    replaying = true;
+    
+    const std::size_t headerBytes = 3 * sizeof(uint32_t) + sizeof(int32_t) + sizeof(uint64_t);
+    std::size_t pos = 0;
+    while (pos + headerBytes <= dataBytes)
+    {
+        uint32_t magic, pathBytes, fieldBytes;
+        int32_t httpCode;
+        uint64_t bodyBytes;
+        std::memcpy(&magic, data + pos, sizeof(magic));
+        std::memcpy(&httpCode, data + pos + 4, sizeof(httpCode));
+        std::memcpy(&pathBytes, data + pos + 8, sizeof(pathBytes));
+        std::memcpy(&fieldBytes, data + pos + 12, sizeof(fieldBytes));
+        std::memcpy(&bodyBytes, data + pos + 16, sizeof(bodyBytes));
+        if (magic != recordMagic || dataBytes - pos - headerBytes < static_cast<uint64_t>(pathBytes) + fieldBytes + bodyBytes)
+        {
+            break;
+        }
+        pos += headerBytes;
+        
+        Record r;
+        r.httpCode = httpCode;
+        r.headers.assign(data + pos + pathBytes, fieldBytes);
+        r.offset = pos + pathBytes + fieldBytes;
+        r.size = static_cast<std::size_t>(bodyBytes);
+        records[std::string(data + pos, pathBytes)].push_back(r);
+        pos = r.offset + r.size;
+        recorded++;
+    }
+    if (pos != dataBytes)
+    {
+        std::cout << "Ignoring " << dataBytes - pos << " bytes of an incomplete record at the end of " << path << std::endl;
+    }
+    return true;
+}
+
+void MeteomaticsTransportArchive::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (out)
+    {
+        std::fclose(out);
+        out = nullptr;
+    }
+    if (mapping)
+    {
+        munmap(mapping, dataBytes);
+        mapping = nullptr;
+    }
+    buffer.clear();
+    data = nullptr;
+    dataBytes = 0;
+    replaying = false;
+    records.clear();
+    cursors.clear();
+    requests.clear();
+    recorded = replayed = missing = 0;
+}
+
+bool MeteomaticsTransportArchive::isRecording() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return out != nullptr;
+}
+
+bool MeteomaticsTransportArchive::isReplaying() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return replaying;
+}
+
+std::vector<std::string> MeteomaticsTransportArchive::requestHeaders(const std::string& query, const std::size_t n) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, std::vector<std::vector<std::string>>>::const_iterator it = requests.find(query);
+    return (it == requests.end() || n >= it->second.size()) ? std::vector<std::string>() : it->second[n];
+}
+
+std::vector<std::string> MeteomaticsTransportArchive::queries() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> result;
+    for (const auto& r : records)
+    {
+        result.push_back(r.first);
+    }
+    return result;
+}
+
+std::size_t MeteomaticsTransportArchive::numRecords() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return recorded;
+}
+
+std::size_t MeteomaticsTransportArchive::numReplayed() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return replayed;
+}
+
+std::size_t MeteomaticsTransportArchive::numMissing() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return missing;
+}
+
+void MeteomaticsTransportArchive::add(const std::string& query, const int httpCode, const std::string& headers, const char* body, const std::size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!out)
+    {
+        return;
+    }
+    
+    const uint32_t magic = recordMagic;
+    const int32_t code = httpCode;
+    const uint32_t pathBytes = static_cast<uint32_t>(query.size());
+    const uint32_t fieldBytes = static_cast<uint32_t>(headers.size());
+    const uint64_t bodyBytes = size;
+    std::fwrite(&magic, sizeof(magic), 1, out);
+    std::fwrite(&code, sizeof(code), 1, out);
+    std::fwrite(&pathBytes, sizeof(pathBytes), 1, out);
+    std::fwrite(&fieldBytes, sizeof(fieldBytes), 1, out);
+    std::fwrite(&bodyBytes, sizeof(bodyBytes), 1, out);
+    std::fwrite(query.data(), 1, query.size(), out);
+    std::fwrite(headers.data(), 1, headers.size(), out);
+    std::fwrite(body, 1, size, out);
+    std::fflush(out);
+    recorded++;
+}
+
+bool MeteomaticsTransportArchive::find(const std::string& query, const std::vector<std::string>& requestHeaders, int& httpCode, std::string& headers, const char*& body, std::size_t& size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, std::vector<Record>>::const_iterator it = records.find(query);
+    if (it == records.end())
+    {
+        missing++;
+        return false;
+    }
+    
+    std::size_t& cursor = cursors[query];
+    const Record& r = it->second[std::min(cursor, it->second.size() - 1)];
+    bool conditional = false;
+    for (const auto& header : requestHeaders)
+    {
+        conditional = conditional || header.compare(0, 14, "If-None-Match:") == 0 || header.compare(0, 18, "If-Modified-Since:") == 0;
+    }
+    if (r.httpCode == 304 && !conditional)
+    {
+        missing++;
+        return false;
+    }
+    requests[query].push_back(requestHeaders);
+    cursor++;
+    replayed++;
+    
+    httpCode = r.httpCode;
+    headers = r.headers;
+    body = data + r.offset;
+    size = r.size;
+    return true;
+}
+
+
+
+//
+//  METEOMATICS REQUEST CONTROL
+//
+
+MeteomaticsCancellationToken::MeteomaticsCancellationToken()
+{
+}
+
+MeteomaticsCancellationToken MeteomaticsCancellationToken::create()
+{
+    MeteomaticsCancellationToken token;
+    token.flag = std::make_shared<std::atomic<bool>>(false);
+    return token;
+}
+
+void MeteomaticsCancellationToken::cancel() const
+{
+    if (flag)
+    {
+        flag->store(true);
+    }
+}
+
+bool MeteomaticsCancellationToken::isCancelled() const
+{
+    return flag && flag->load(std::memory_order_relaxed);
+}
+
+bool MeteomaticsCancellationToken::canBeCancelled() const
+{
+    return flag != nullptr;
+}
+
+MeteomaticsRequestControl::MeteomaticsRequestControl()
+: deadline(std::chrono::steady_clock::time_point::max())
+{
+}
+
+MeteomaticsRequestControl::MeteomaticsRequestControl(const std::chrono::steady_clock::time_point& _deadline, const MeteomaticsCancellationToken& _cancellation)
+: deadline(_deadline)
+, cancellation(_cancellation)
+{
+}
+
+MeteomaticsRequestControl::MeteomaticsRequestControl(const MeteomaticsCancellationToken& _cancellation)
+: deadline(std::chrono::steady_clock::time_point::max())
+, cancellation(_cancellation)
+{
+}
+
+MeteomaticsRequestControl MeteomaticsRequestControl::withTimeout(const std::chrono::milliseconds& timeout, const MeteomaticsCancellationToken& cancellation)
+{
+    return MeteomaticsRequestControl(std::chrono::steady_clock::now() + timeout, cancellation);
+}
+
+bool MeteomaticsRequestControl::hasDeadline() const
+{
+    return deadline != std::chrono::steady_clock::time_point::max();
+}
+
+bool MeteomaticsRequestControl::expired() const
+{
+    return cancellation.isCancelled() || (hasDeadline() && std::chrono::steady_clock::now() >= deadline);
+}
+
+long MeteomaticsRequestControl::remainingMilliseconds() const
+{
+    if (!hasDeadline())
+    {
+        return LONG_MAX;
+    }
+    const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    return std::max(0L, static_cast<long>(remaining));
+}
+
+std::string MeteomaticsRequestControl::reason() const
+{
+    return cancellation.isCancelled() ? "Request cancelled." : "Request deadline exceeded.";
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METEOMATICS ALLOCATION COUNTING
+//
+
+namespace MMIntern {
+    // one phase (receive or decode) of a request, shared with the decode threads of the request
+    struct AllocationCounter
+    {
+        AllocationCounter();
+        
+        void allocated(std::size_t bytes);
+        void freed(std::size_t bytes);
+        MeteomaticsAllocationStats stats() const;
+        static std::atomic<uint64_t>& nextId();
+        
+        const uint64_t id;                          // blocks remember the id of the counter they were allocated on
+        std::atomic<std::size_t> allocations;
+        std::atomic<std::size_t> bytes;
+        std::atomic<std::size_t> live;
+        std::atomic<std::size_t> peak;
+    };
+    
+    // counter charged with the allocations of the current thread, nullptr outside of requests
+    AllocationCounter*& threadAllocationCounter();
+    
+    // attaches a thread (e.g. a decode worker) to a counter for its lifetime
+    class AllocationCounterGuard
+    {
+    public:
+        explicit AllocationCounterGuard(AllocationCounter* counter);
+        ~AllocationCounterGuard();
+        
+    private:
+        AllocationCounter* previous;
+    };
+    
+    class MemoryStatsTable
+    {
+    public:
+        void record(const MeteomaticsApiClient::QueryType type, const AllocationCounter& receive, const AllocationCounter& decode);
+        MeteomaticsMemoryStats get(const MeteomaticsApiClient::QueryType type) const;
+        void reset();
+        
+    private:
+        static void add(MeteomaticsAllocationStats& total, const MeteomaticsAllocationStats& request);
+        
+        std::array<MeteomaticsMemoryStats, MeteomaticsApiClient::NumQueryTypes> stats;
+        mutable std::mutex mutex;
+    };
+    
+    // Counts the allocations of a getter call. Getters called by other getters (getPoint -> getTimeSeries -> ...)
+    // join the scope of the outermost one, which records the request on destruction.
+    class AllocationScope
+    {
+    public:
+        enum Phase
+        {
+            Receive,
+            Decode
+        };
+        
+        AllocationScope(MemoryStatsTable* table, const MeteomaticsApiClient::QueryType type);
+        ~AllocationScope();
+        
+        static void enterPhase(const Phase phase);  // switches the outermost scope of this thread
+        
+    private:
+        static AllocationScope*& active();
+        
+        MemoryStatsTable* const table;
+        const MeteomaticsApiClient::QueryType type;
+        const bool outermost;
+        AllocationCounter receive;
+        AllocationCounter decode;
+    };
+    
+    struct AllocationHeader
+    {
+        std::size_t size;
+        uint64_t counterId;
+    };
+    static_assert(sizeof(AllocationHeader) % alignof(std::max_align_t) == 0, "allocation header breaks the alignment of blocks");
+}
+
+MeteomaticsAllocationStats::MeteomaticsAllocationStats()
+: allocations(0)
+, bytesAllocated(0)
+, peakLiveBytes(0)
+{
+}
+
+MeteomaticsMemoryStats::MeteomaticsMemoryStats()
+: requests(0)
+{
+}
+
+MMIntern::AllocationCounter::AllocationCounter()
+: id(nextId()++)
+, allocations(0)
+, bytes(0)
+, live(0)
+, peak(0)
+{
+}
+
+std::atomic<uint64_t>& MMIntern::AllocationCounter::nextId()
+{
+    static std::atomic<uint64_t> id(1);         // 0 marks blocks allocated outside of requests
+    return id;
+}
+
+void MMIntern::AllocationCounter::allocated(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_add(size, std::memory_order_relaxed);
+    const std::size_t now = live.fetch_add(size, std::memory_order_relaxed) + size;
+    std::size_t previousPeak = peak.load(std::memory_order_relaxed);
+    while (now > previousPeak && !peak.compare_exchange_weak(previousPeak, now, std::memory_order_relaxed))
+    {
+    }
+}
+
+void MMIntern::AllocationCounter::freed(std::size_t size)
+{
+    live.fetch_sub(size, std::memory_order_relaxed);
+}
+
+MeteomaticsAllocationStats MMIntern::AllocationCounter::stats() const
+{
+    MeteomaticsAllocationStats s;
+    s.allocations = allocations.load();
+    s.bytesAllocated = bytes.load();
+    s.peakLiveBytes = peak.load();
+    return s;
+}
+
+MMIntern::AllocationCounter*& MMIntern::threadAllocationCounter()
+{
+    static thread_local AllocationCounter* counter = nullptr;
+    return counter;
+}
+
+MMIntern::AllocationCounterGuard::AllocationCounterGuard(AllocationCounter* counter)
+: previous(threadAllocationCounter())
+{
+    threadAllocationCounter() = counter;
+}
+
+MMIntern::AllocationCounterGuard::~AllocationCounterGuard()
+{
+    threadAllocationCounter() = previous;
+}
+
+void MMIntern::MemoryStatsTable::add(MeteomaticsAllocationStats& total, const MeteomaticsAllocationStats& request)
+{
+    total.allocations += request.allocations;
+    total.bytesAllocated += request.bytesAllocated;
+    total.peakLiveBytes = std::max(total.peakLiveBytes, request.peakLiveBytes);
+}
+
+void MMIntern::MemoryStatsTable::record(const MeteomaticsApiClient::QueryType type, const AllocationCounter& receive, const AllocationCounter& decode)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stats[type].requests++;
+    add(stats[type].receiveBuffer, receive.stats());
+    add(stats[type].decodedResult, decode.stats());
+}
+
+MeteomaticsMemoryStats MMIntern::MemoryStatsTable::get(const MeteomaticsApiClient::QueryType type) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats[type];
+}
+
+void MMIntern::MemoryStatsTable::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.fill(MeteomaticsMemoryStats());
+}
+
+MMIntern::AllocationScope*& MMIntern::AllocationScope::active()
+{
+    static thread_local AllocationScope* scope = nullptr;
+    return scope;
+}
+
+MMIntern::AllocationScope::AllocationScope(MemoryStatsTable* _table, const MeteomaticsApiClient::QueryType _type)
+: table(_table)
+, type(_type)
+, outermost(MeteomaticsApiClient::memoryStatsAvailable() && active() == nullptr)
+{
+    if (outermost)
+    {
+        active() = this;
+    }
+}
+
+MMIntern::AllocationScope::~AllocationScope()
+{
+    if (outermost)
+    {
+        threadAllocationCounter() = nullptr;
+        active() = nullptr;
+        table->record(type, receive, decode);
+    }
+}
+
+void MMIntern::AllocationScope::enterPhase(const Phase phase)
+{
+    AllocationScope* scope = active();
+    if (scope)
+    {
+        threadAllocationCounter() = phase == Receive ? &scope->receive : &scope->decode;
+    }
+}
+
+#ifdef METEOMATICS_COUNT_ALLOCATIONS
+
+// every block carries its size and the counter it was charged to, a block is only
+// credited back if it is freed while the same counter is active (e.g. vector growth)
+void* operator new(std::size_t size)
+{
+    MMIntern::AllocationCounter* counter = MMIntern::threadAllocationCounter();
+    void* block = std::malloc(size + sizeof(MMIntern::AllocationHeader));
+    if (block == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    MMIntern::AllocationHeader* header = static_cast<MMIntern::AllocationHeader*>(block);
+    header->size = size;
+    header->counterId = counter ? counter->id : 0;
+    if (counter)
+    {
+        counter->allocated(size);
+    }
+    return header + 1;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    MMIntern::AllocationHeader* header = static_cast<MMIntern::AllocationHeader*>(ptr) - 1;
+    MMIntern::AllocationCounter* counter = MMIntern::threadAllocationCounter();
+    if (counter && header->counterId == counter->id)
+    {
+        counter->freed(header->size);
+    }
+    std::free(header);
+}
+
+#if __cpp_sized_deallocation
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    operator delete(ptr);
+}
+#endif
+
+#endif
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METEOMATICS PREPARED QUERY
+//
+
+MeteomaticsPreparedQuery::MeteomaticsPreparedQuery()
+: queryKind(None)
+, coordinates(0)
+, parameters(0)
+, gridLat(0)
+, gridLon(0)
+{
+}
+
+MeteomaticsPreparedQuery::Kind MeteomaticsPreparedQuery::kind() const
+{
+    return queryKind;
+}
+
+std::size_t MeteomaticsPreparedQuery::numCoordinates() const
+{
+    return coordinates;
+}
+
+std::size_t MeteomaticsPreparedQuery::numParameters() const
+{
+    return parameters;
+}
+
+int MeteomaticsPreparedQuery::numLat() const
+{
+    return gridLat;
+}
+
+int MeteomaticsPreparedQuery::numLon() const
+{
+    return gridLon;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METOMATICS API METHODS
+//
+MeteomaticsApiClient::MeteomaticsApiClient(const std::string& user, const std::string& password, const int timeout_seconds)
+: httpClient(new MMIntern::HttpClient("api.meteomatics.com", user, password))
+, decodePool(nullptr)
+, memoryStats(new MMIntern::MemoryStatsTable())
+, dataRequestTimeout(timeout_seconds)
+{
+}
+
+std::string MeteomaticsApiClient::getIsoTimeStr(const int year, const int month, const int day, const int hour, const int min, const int sec) const
+{
+    std::stringstream ss;
+    ss << std::setprecision(4);
+    ss << std::setw(4) << std::setfill('0') << year << '-';
+    ss << std::setprecision(2);
+    ss << std::setw(2) << std::setfill('0') << month << '-';
+    ss << std::setw(2) << std::setfill('0') << day << 'T';
+    ss << std::setw(2) << std::setfill('0') << hour << ':';
+    ss << std::setw(2) << std::setfill('0') << min << ':';
+    ss << std::setw(2) << std::setfill('0') << sec << 'Z';
+    return ss.str();
+}
+
+std::string MeteomaticsApiClient::getTimeStepStr(const int year, const int month, const int day, const int hour, const int min, const int sec) const
+{
+    std::stringstream ss;
+    if (year > 0)
+        ss << year << "Y";
+    if (month > 0)
+        ss << month << "M";
+    if (day > 0)
+        ss << day << "D";
+    if (hour+min+sec > 0)
+        ss << "T";
+    if (hour > 0)
+        ss << hour << "H";
+    if (min > 0)
+        ss << min << "M";
+    if (sec > 0)
+        ss << sec << "S";
+    if (ss.str() == "")
+        return "0D";
+    else
+        return ss.str();
+}
+
+std::string MeteomaticsApiClient::getOptionalSelectString(const std::vector<std::string>& optionals)
+{
+    if (optionals.empty())
+    {
+        return "";
+    }
+    
+    std::string ret="?";
+    for (std::size_t i=0; i<optionals.size(); i++)
+    {
+        ret += optionals[i];
+        if (i != optionals.size()-1)
+        {
+            ret += "&";
+        }
+    }
+    return ret;
+}
+
+bool MeteomaticsApiClient::readMultiPointTimeSeriesBin(MMIntern::MemoryClass& mem, std::vector<Matrix>& results, std::vector<std::string>& times, const MeteomaticsRequestControl& control) const
+{
+    if (decodePool && mem.size() - mem.getReadPos() >= parallelDecodeMinBytes)
+    {
+        if (readMultiPointTimeSeriesBinParallel(mem, results, times, *decodePool, control))
+        {
+            return true;
+        }
+        if (control.expired())
+        {
+            return false;
+        }
+    }
+    
+    int32_t nCoords;
+    mem.read(nCoords);
+    
+    for (int32_t i=0; i<nCoords; i++)
+    {
+        if (control.expired())
+        {
+            return false;
+        }
+        
+        int32_t nTimes;
+        mem.read(nTimes);
+        
+        Matrix tmpMat;
+        tmpMat.reserve(nTimes);
+        for (int32_t j=0; j<nTimes; j++)
+        {
+            int32_t nParameter;
+            mem.read(nParameter);
+            
+            double t;
+            mem.read(t);
+            times.push_back(convDateIso8601(t));
+            
+            std::vector<double> tmpValues;
+            tmpValues.reserve(nParameter);
+            for (int32_t k=0; k<nParameter; k++)
+            {
+                double value;
+                mem.read(value);
+                tmpValues.push_back(value);
+            }
+            tmpMat.push_back(tmpValues);
+        }
+        results.push_back(tmpMat);
+    }
+    
+    return true;
+}
+
+bool MeteomaticsApiClient::readMultiPointTimeSeriesBinParallel(MMIntern::MemoryClass& mem, std::vector<Matrix>& results, std::vector<std::string>& times, MMIntern::ThreadPool& pool, const MeteomaticsRequestControl& control) const
+{
+    // indexing pass: locate every coordinate block by its headers only, such that the blocks
+    // can be decoded independently. Leaves mem untouched if the body is not well-formed.
+    const char* data = mem.mem.data();
+    const std::size_t end = mem.size();
+    std::size_t pos = mem.getReadPos();
+    
+    int32_t nCoords;
+    if (pos + sizeof(nCoords) > end)
+    {
+        return false;
+    }
+    std::memcpy(&nCoords, data + pos, sizeof(nCoords));
+    pos += sizeof(nCoords);
+    if (nCoords < 0)
+    {
+        return false;
+    }
+    
+    std::vector<std::size_t> blockOffsets(nCoords);
+    std::vector<std::size_t> timeOffsets(nCoords + 1, 0);
+    for (int32_t i=0; i<nCoords; i++)
+    {
+        int32_t nTimes;
+        if (pos + sizeof(nTimes) > end)
+        {
+            return false;
+        }
+        std::memcpy(&nTimes, data + pos, sizeof(nTimes));
+        if (nTimes < 0)
+        {
+            return false;
+        }
+        blockOffsets[i] = pos;
+        timeOffsets[i+1] = timeOffsets[i] + static_cast<std::size_t>(nTimes);
+        pos += sizeof(nTimes);
+        
+        for (int32_t j=0; j<nTimes; j++)
+        {
+            int32_t nParameter;
+            if (pos + sizeof(nParameter) > end)
+            {
+                return false;
+            }
+            std::memcpy(&nParameter, data + pos, sizeof(nParameter));
+            if (nParameter < 0)
+            {
+                return false;
+            }
+            pos += sizeof(nParameter) + sizeof(double) * (1 + static_cast<std::size_t>(nParameter));
+            if (pos > end)
+            {
+                return false;
+            }
+        }
+    }
+    
+    // decoding pass: blocks of coordinates in parallel, into preallocated outputs
+    const std::size_t resultBase = results.size();
+    const std::size_t timeBase = times.size();
+    results.resize(resultBase + nCoords);
+    times.resize(timeBase + timeOffsets[nCoords]);
+    
+    const std::size_t numChunks = std::min<std::size_t>(nCoords, 4 * pool.size());
+    std::atomic<bool> aborted(false);
+    MMIntern::AllocationCounter* allocationCounter = MMIntern::threadAllocationCounter();
+    pool.parallelFor(numChunks, [&](std::size_t chunk)
+    {
+        MMIntern::AllocationCounterGuard allocationGuard(allocationCounter);
+        const std::size_t first = chunk * nCoords / numChunks;
+        const std::size_t last = (chunk + 1) * nCoords / numChunks;
+        for (std::size_t i=first; i<last; i++)
+        {
+            if (aborted || control.expired())
+            {
+                aborted = true;
+                return;
+            }
+            
+            const char* p = data + blockOffsets[i];
+            int32_t nTimes;
+            std::memcpy(&nTimes, p, sizeof(nTimes));
+            p += sizeof(nTimes);
+            
+            Matrix& tmpMat = results[resultBase + i];
+            tmpMat.resize(nTimes);
+            for (int32_t j=0; j<nTimes; j++)
+            {
+                int32_t nParameter;
+                std::memcpy(&nParameter, p, sizeof(nParameter));
+                p += sizeof(nParameter);
+                
+                double t;
+                std::memcpy(&t, p, sizeof(t));
+                p += sizeof(t);
+                times[timeBase + timeOffsets[i] + j] = convDateIso8601(t);
+                
+                tmpMat[j].resize(nParameter);
+                if (nParameter > 0)
+                {
+                    std::memcpy(tmpMat[j].data(), p, sizeof(double) * nParameter);
+                    p += sizeof(double) * nParameter;
+                }
+            }
+        }
+    });
+    
+    if (aborted)
+    {
+        results.resize(resultBase);
+        times.resize(timeBase);
+        return false;
+    }
+    mem.setReadPos(pos);
+    return true;
+}
+
+bool MeteomaticsApiClient::readSinglePointTimeSeriesBin(MMIntern::MemoryClass& mem, Matrix& results, std::vector<std::string>& times, const MeteomaticsRequestControl& control) const
 {
     int32_t numDates;
     int32_t numParams;
@@ -490,6 +2546,11 @@ bool MeteomaticsApiClient::readSinglePointTimeSeriesBin(MMIntern::MemoryClass& m
     
     for (int i = 0; i < numDates; i++)
     {
+        if ((i & 1023) == 0 && control.expired())
+        {
+            return false;
+        }
+        
         double date;
         mem.read(numParams);
         mem.read(date);
@@ -503,9 +2564,224 @@ bool MeteomaticsApiClient::readSinglePointTimeSeriesBin(MMIntern::MemoryClass& m
     return true;
 }
 
-bool MeteomaticsApiClient::readGridAndMatrixFromMBG2Format(MMIntern::MemoryClass& mem, Matrix& results, std::vector<double>& lats, std::vector<double>& lons) const
+bool MeteomaticsApiClient::readMultiPointTimeSeriesBinInPlace(MMIntern::MemoryClass& mem, const std::size_t numCoordinates, std::vector<Matrix>& results, std::vector<std::string>& times, const MeteomaticsRequestControl& control) const
+{
+    // overwrites results and times instead of appending, rows of an unchanged shape keep their buffers
+    // and the times of further coordinates are copied from the first one instead of being formatted again
+    int32_t nCoords = 1;
+    if (numCoordinates != 1)
+    {
+        mem.read(nCoords);                      // a single coordinate comes without the coordinate count
+    }
+    if (nCoords < 0 || static_cast<std::size_t>(nCoords) != numCoordinates)
+    {
+        return false;
+    }
+    results.resize(nCoords);
+    
+    std::vector<double> firstTimes;
+    std::size_t row = 0;
+    for (int32_t i=0; i<nCoords; i++)
+    {
+        if (control.expired())
+        {
+            return false;
+        }
+        
+        int32_t nTimes;
+        mem.read(nTimes);
+        if (nTimes < 0)
+        {
+            return false;
+        }
+        
+        Matrix& tmpMat = results[i];
+        tmpMat.resize(nTimes);
+        if (times.size() < row + nTimes)
+        {
+            times.resize(row + nTimes);
+        }
+        for (int32_t j=0; j<nTimes; j++, row++)
+        {
+            int32_t nParameter;
+            mem.read(nParameter);
+            
+            double t;
+            mem.read(t);
+            if (i == 0)
+            {
+                firstTimes.push_back(t);
+                times[row] = convDateIso8601(t);
+            }
+            else if (j < static_cast<int32_t>(firstTimes.size()) && firstTimes[j] == t)
+            {
+                times[row] = times[j];
+            }
+            else
+            {
+                times[row] = convDateIso8601(t);
+            }
+            
+            std::vector<double>& values = tmpMat[j];
+            values.resize(nParameter);
+            for (int32_t k=0; k<nParameter; k++)
+            {
+                mem.read(values[k]);
+            }
+        }
+    }
+    times.resize(row);
+    return true;
+}
+
+bool MeteomaticsApiClient::readMultiPointTimeSeriesCsv(const std::string& csv, const std::size_t numCoordinates, std::vector<Matrix>& results, std::vector<std::string>& times, const MeteomaticsRequestControl& control) const
+{
+    // header "lat;lon;validdate;<parameters>" for several coordinates, "validdate;<parameters>" for one,
+    // followed by the rows of all times of the first coordinate, then of the second one, ...
+    MMIntern::CsvScanner scanner(csv.data(), csv.size());
+    const char* begin;
+    const char* end;
+    std::size_t numColumns = 0;
+    bool withCoordinates = false;
+    while (scanner.field(begin, end))
+    {
+        if (numColumns == 0)
+        {
+            withCoordinates = end - begin == 3 && std::strncmp(begin, "lat", 3) == 0;
+        }
+        numColumns++;
+    }
+    scanner.nextLine();
+    
+    const std::size_t numSkipped = withCoordinates ? 2 : 0;
+    if (numColumns < numSkipped + 1 || numCoordinates == 0)
+    {
+        return false;
+    }
+    const std::size_t numParams = numColumns - numSkipped - 1;
+    const std::size_t numRows = MMIntern::CsvScanner::countLines(scanner.position(), csv.data() + csv.size() - scanner.position());
+    if (numRows % numCoordinates != 0)
+    {
+        return false;
+    }
+    const std::size_t numTimes = numRows / numCoordinates;
+    
+    const std::size_t resultBase = results.size();
+    const std::size_t timeBase = times.size();
+    results.resize(resultBase + numCoordinates, Matrix(numTimes, std::vector<double>(numParams)));
+    times.resize(timeBase + numRows);
+    
+    std::size_t row = 0;
+    for (std::size_t i=0; i<numCoordinates; i++)
+    {
+        Matrix& tmpMat = results[resultBase + i];
+        for (std::size_t j=0; j<numTimes; j++, row++)
+        {
+            if ((row & 1023) == 0 && control.expired())
+            {
+                return false;
+            }
+            
+            for (std::size_t k=0; k<numSkipped; k++)
+            {
+                if (!scanner.field(begin, end))
+                {
+                    return false;
+                }
+            }
+            
+            if (!scanner.field(begin, end))
+            {
+                return false;
+            }
+            std::string& time = times[timeBase + row];
+            if (end - begin == 20 && begin[10] == 'T' && begin[19] == 'Z')
+            {
+                time.assign(begin, end);        // already in the format of convDateIso8601
+            }
+            else
+            {
+                double unixSeconds;
+                if (!MMIntern::parseIsoTime(begin, static_cast<std::size_t>(end - begin), unixSeconds))
+                {
+                    return false;
+                }
+                time = convDateIso8601(unixSeconds / 86400.0 + 719529.0);
+            }
+            
+            double* values = tmpMat[j].data();
+            for (std::size_t k=0; k<numParams; k++)
+            {
+                if (!scanner.field(begin, end) || !MMIntern::parseCsvDouble(begin, end, values[k]))
+                {
+                    return false;
+                }
+            }
+            scanner.nextLine();
+        }
+    }
+    return true;
+}
+
+//
+//  METEOMATICS GRID PRECISION
+//
+//  Value types of the grid getters: the optional selecting the precision of the MBG2 values
+//  (none for the default double precision), and the loop reading them into the result.
+//
+template<>
+struct MMIntern::GridPrecision<double>
+{
+    static void addOption(std::vector<std::string>&)
+    {
+    }
+};
+
+template<>
+struct MMIntern::GridPrecision<float>
+{
+    static void addOption(std::vector<std::string>& optionals)
+    {
+        optionals.push_back("precision=float");
+    }
+};
+
+template<class Stored, class T>
+bool MMIntern::readGridValues(MemoryClass& mem, BasicMatrix<T>& results, const MeteomaticsRequestControl& control)
+{
+    for (auto& row : results)
+    {
+        if (control.expired())
+        {
+            return false;
+        }
+        for (auto& value : row)
+        {
+            Stored stored;
+            mem.read(stored);
+            value = static_cast<T>(stored);
+        }
+    }
+    return true;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+bool MeteomaticsApiClient::readMBG2Header(MMIntern::MemoryClass& mem, int32_t& precision, double& forecastDateUx, std::vector<double>& lats, std::vector<double>& lons) const
 {
-    results.clear();
     if (mem.readString(sizeof(char)*4) != "MBG_")
     {
         std::cout << "ERROR. No MBG received" << std::endl;
@@ -513,11 +2789,9 @@ bool MeteomaticsApiClient::readGridAndMatrixFromMBG2Format(MMIntern::MemoryClass
     }
     
     int32_t version;
-    int32_t precision;
     int32_t numPayloadsPerForecast;
     int32_t payloadMeta;
     int32_t numForecasts;
-    double forecastDateUx;
     int32_t numLat;
     int32_t numLon;
     
@@ -568,32 +2842,31 @@ bool MeteomaticsApiClient::readGridAndMatrixFromMBG2Format(MMIntern::MemoryClass
     {
         mem.read(value);
     }
-    
-    results.resize(numLat,std::vector<double>(numLon));
-    
-    if (precision == sizeof(float))
+    return true;
+}
+
+template<class T>
+bool MeteomaticsApiClient::readGridAndMatrixFromMBG2Format(MMIntern::MemoryClass& mem, BasicMatrix<T>& results, std::vector<double>& lats, std::vector<double>& lons, const MeteomaticsRequestControl& control) const
+{
+    int32_t precision;
+    double forecastDateUx;
+    if (!readMBG2Header(mem, precision, forecastDateUx, lats, lons))
     {
-        for (std::size_t i=0; i<lats.size(); i++)
-        {
-            for (std::size_t j=0; j<lons.size(); j++)
-            {
-                float tmpd;
-                mem.read(tmpd);
-                results[i][j] = static_cast<double>(tmpd);
-            }
-        }
+        return false;
+    }
+    
+    results.resize(lats.size());
+    for (auto& row : results)
+    {
+        row.resize(lons.size());                // keeps the buffers of a previous result of the same shape
     }
-    else
+    
+    // values stay in the precision sent unless the caller asked for the other one
+    if (precision == sizeof(float))
     {
-        for (std::size_t i=0; i<lats.size(); i++)
-        {
-            for (std::size_t j=0; j<lats.size(); j++)
-            {
-                mem.read(results[i][j]);
-            }
-        }
+        return MMIntern::readGridValues<float>(mem, results, control);
     }
-    return true;
+    return MMIntern::readGridValues<double>(mem, results, control);
 }
 
 double MeteomaticsApiClient::round_coordinate(double c)
@@ -664,13 +2937,16 @@ std::string MeteomaticsApiClient::createLatLonListString(const std::vector<doubl
     return ss.str();
 }
 
-bool MeteomaticsApiClient::getPoint(const std::string& time, const std::vector<std::string>& parameters, double lat, double lon, std::vector<double>& result, std::string& msg, const std::vector<std::string>& optionals) const
+bool MeteomaticsApiClient::getPoint(const std::string& time, const std::vector<std::string>& parameters, double lat, double lon, std::vector<double>& result, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
 {
+    MMIntern::AllocationScope allocationScope(memoryStats, PointQuery);
+    
     std::string dummyStep = getTimeStepStr(0, 0, 0, 0, 0, 0);
     Matrix resultMatrix;
     std::vector<std::string> returnTimes;
-    if (getTimeSeries(time, time, dummyStep, parameters, lat, lon, resultMatrix, returnTimes, msg, optionals))
+    if (getTimeSeries(time, time, dummyStep, parameters, lat, lon, resultMatrix, returnTimes, msg, optionals, control))
     {
+        MMIntern::TraceSpan assembly(httpClient->getTracer(), "result assembly", "client");
         result = resultMatrix[0];
     }
     else
@@ -679,14 +2955,17 @@ bool MeteomaticsApiClient::getPoint(const std::string& time, const std::vector<s
     return true;
 }
 
-bool MeteomaticsApiClient::getTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, double lat, double lon, Matrix& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals) const
+bool MeteomaticsApiClient::getTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, double lat, double lon, Matrix& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
 {
+    MMIntern::AllocationScope allocationScope(memoryStats, TimeSeriesQuery);
+    
     result.clear();
     msg.clear();
     
     std::vector<Matrix> tmpM;
-    if (getMultiPointTimeSeries(startTime, stopTime, timeStep, parameters, std::vector<double>(1,lat), std::vector<double>(1,lon), tmpM, times, msg, optionals))
+    if (getMultiPointTimeSeries(startTime, stopTime, timeStep, parameters, std::vector<double>(1,lat), std::vector<double>(1,lon), tmpM, times, msg, optionals, control))
     {
+        MMIntern::TraceSpan assembly(httpClient->getTracer(), "result assembly", "client");
         result = tmpM[0];
     }
     else
@@ -697,84 +2976,123 @@ bool MeteomaticsApiClient::getTimeSeries(const std::string& startTime, const std
     return true;
 }
 
-bool MeteomaticsApiClient::getGrid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const std::vector<std::string>& optionals) const
+std::string MeteomaticsApiClient::createGridQuery(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, const std::vector<std::string>& optionals)
 {
-    gridResult.clear();
-    latGridPts.clear();
-    lonGridPts.clear();
-    msg.clear();
-    
-    std::string queryString = "/" + time
-                            + "/" + parameter
-                            + "/" + createLatLonListString(std::vector<double>{lat_N, lat_S}, std::vector<double>{lon_W, lon_E}, nGridPts_Lon, nGridPts_Lat)
-                            + "/bin"
-                            + getOptionalSelectString(optionals);
-    
-    int httpReturnCode = 0;
-    
-    MMIntern::MemoryClass mem(500);
-    
-    httpClient->requestBinary("api.meteomatics.com", queryString, mem, dataRequestTimeout, httpReturnCode);
-    
+    return "/" + time
+         + "/" + parameter
+         + "/" + createLatLonListString(std::vector<double>{lat_N, lat_S}, std::vector<double>{lon_W, lon_E}, nGridPts_Lon, nGridPts_Lat)
+         + "/bin"
+         + getOptionalSelectString(optionals);
+}
+
+std::string MeteomaticsApiClient::createMultiPointTimeSeriesQuery(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, const std::vector<std::string>& optionals, const std::string& format)
+{
+    return createMultiPointTimeSeriesQuery(startTime, stopTime, timeStep, createParameterListString(parameters).c_str(), lats, lons, optionals, format);
+}
+
+std::string MeteomaticsApiClient::createMultiPointTimeSeriesQuery(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const char* parameterList, const std::vector<double>& lats, const std::vector<double>& lons, const std::vector<std::string>& optionals, const std::string& format)
+{
+    return "/" + startTime + "--" + stopTime + ":P" + timeStep
+         + "/" + parameterList
+         + "/" + createLatLonListString(lats, lons)
+         + "/" + format
+         + getOptionalSelectString(optionals);
+}
+
+bool MeteomaticsApiClient::checkResponse(const int httpReturnCode, const char* body, const std::size_t size, std::string& msg, const MeteomaticsRequestControl& control) const
+{
+    if (control.expired())
+    {
+        msg = control.reason();
+        return false;
+    }
     if (!MMIntern::http_code_success(httpReturnCode))
     {
         std::cout << "Http Error! Code: " << httpReturnCode;
         std::cout << ". For more information see returned msg string!" << std::endl;
-        msg = mem.readString(mem.size());
+        msg.assign(body, size);
+        return false;
+    }
+    return true;
+}
+
+bool MeteomaticsApiClient::fetchBinary(const std::string& queryString, MMIntern::MemoryClass& mem, int& httpReturnCode, std::string& msg, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::ResponseHeaders responseHeaders;
+    return fetchBinary(queryString, mem, httpReturnCode, msg, control, std::vector<std::string>(), responseHeaders);
+}
+
+bool MeteomaticsApiClient::fetchBinary(const std::string& queryString, MMIntern::MemoryClass& mem, int& httpReturnCode, std::string& msg, const MeteomaticsRequestControl& control, const std::vector<std::string>& requestHeaders, MMIntern::ResponseHeaders& responseHeaders) const
+{
+    MMIntern::AllocationScope::enterPhase(MMIntern::AllocationScope::Receive);
+    httpClient->requestBinary("api.meteomatics.com", queryString, mem, dataRequestTimeout, httpReturnCode, control, requestHeaders, responseHeaders);
+    
+    MMIntern::AllocationScope::enterPhase(MMIntern::AllocationScope::Decode);
+    return checkResponse(httpReturnCode, mem.mem.data(), mem.mem.size(), msg, control);
+}
+
+template<class T>
+bool MeteomaticsApiClient::decodeGrid(MMIntern::MemoryClass& mem, const int httpReturnCode, BasicMatrix<T>& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const MeteomaticsRequestControl& control) const
+{
+    if (!checkResponse(httpReturnCode, mem.mem.data(), mem.mem.size(), msg, control))
+    {
         return false;
     }
     
-    if (!readGridAndMatrixFromMBG2Format(mem, gridResult, latGridPts, lonGridPts))
+    MMIntern::TraceSpan decode(httpClient->getTracer(), "decode", "client");
+    if (!readGridAndMatrixFromMBG2Format(mem, gridResult, latGridPts, lonGridPts, control))
     {
+        if (control.expired())
+        {
+            msg = control.reason();
+            return false;
+        }
         std::cout << "Errror while reading grid and matrix MBG2 binary..." << std::endl;
         return false;
     }
+    decode.end();
     
+    MMIntern::TraceSpan reverse(httpClient->getTracer(), "reverse", "client");
     std::reverse(gridResult.begin(), gridResult.end());   // reverse => same order as in csv format
     std::reverse(latGridPts.begin(), latGridPts.end());
     
     return true;
 }
 
-bool MeteomaticsApiClient::getMultiPointTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, std::vector<double> lats, std::vector<double> lons, std::vector<Matrix>& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals) const
+bool MeteomaticsApiClient::decodeMultiPointTimeSeries(MMIntern::MemoryClass& mem, const int httpReturnCode, const std::size_t numCoordinates, std::vector<Matrix>& result, std::vector<std::string>& times, std::string& msg, const MeteomaticsRequestControl& control) const
 {
-    result.clear();
-    msg.clear();
-    
-    std::string queryString = "/" + startTime + "--" + stopTime + ":P" + timeStep
-    + "/" + createParameterListString(parameters)
-    + "/" + createLatLonListString(lats, lons)
-    + "/bin"
-    + getOptionalSelectString(optionals);
-    
-    int httpReturnCode = 0;
-    
-    MMIntern::MemoryClass mem(500);
-    
-    httpClient->requestBinary("api.meteomatics.com", queryString, mem, dataRequestTimeout, httpReturnCode);
-    
-    if (!MMIntern::http_code_success(httpReturnCode))
+    if (!checkResponse(httpReturnCode, mem.mem.data(), mem.mem.size(), msg, control))
     {
-        std::cout << "Http Error! Code: " << httpReturnCode;
-        std::cout << ". For more information see returned msg string!" << std::endl;
-        msg = mem.readString(mem.size());
         return false;
     }
     
-    if (lats.size() == 1)
+    MMIntern::TraceSpan decode(httpClient->getTracer(), "decode", "client");
+    if (numCoordinates == 1)
     {
         Matrix tmpM;
-        if (!readSinglePointTimeSeriesBin(mem, tmpM, times))
+        if (!readSinglePointTimeSeriesBin(mem, tmpM, times, control))
         {
+            if (control.expired())
+            {
+                msg = control.reason();
+                return false;
+            }
             std::cout << "Error while reading mem-object." << std::endl;
             return false;
         }
+        decode.end();
+        MMIntern::TraceSpan assembly(httpClient->getTracer(), "result assembly", "client");
         result.push_back(tmpM);
     }
     else
     {
-        if (!readMultiPointTimeSeriesBin(mem, result, times))
+        if (!readMultiPointTimeSeriesBin(mem, result, times, control))
         {
+            if (control.expired())
+            {
+                msg = control.reason();
+                return false;
+            }
             std::cout << "Error while reading mem-object." << std::endl;
             return false;
         }
@@ -782,13 +3100,93 @@ bool MeteomaticsApiClient::getMultiPointTimeSeries(const std::string& startTime,
     return true;
 }
 
-bool MeteomaticsApiClient::getMultiPoints(const std::string& time, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, Matrix& result, std::string& msg, const std::vector<std::string>& optionals) const
+bool MeteomaticsApiClient::decodeMultiPointTimeSeriesCsv(const std::string& csv, const int httpReturnCode, const std::size_t numCoordinates, std::vector<Matrix>& result, std::vector<std::string>& times, std::string& msg, const MeteomaticsRequestControl& control) const
+{
+    if (!checkResponse(httpReturnCode, csv.data(), csv.size(), msg, control))
+    {
+        return false;
+    }
+    
+    if (!readMultiPointTimeSeriesCsv(csv, numCoordinates, result, times, control))
+    {
+        if (control.expired())
+        {
+            msg = control.reason();
+            return false;
+        }
+        std::cout << "Error while reading csv." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool MeteomaticsApiClient::getGrid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    return requestGrid(time, parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, gridResult, latGridPts, lonGridPts, msg, optionals, control);
+}
+
+bool MeteomaticsApiClient::getGrid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, FloatMatrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    return requestGrid(time, parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, gridResult, latGridPts, lonGridPts, msg, optionals, control);
+}
+
+template<class T>
+bool MeteomaticsApiClient::requestGrid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, BasicMatrix<T>& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, GridQuery);
+    MMIntern::TraceSpan request(httpClient->getTracer(), "getGrid", "request");
+    
+    gridResult.clear();
+    latGridPts.clear();
+    lonGridPts.clear();
+    msg.clear();
+    
+    MMIntern::TraceSpan build(httpClient->getTracer(), "query build", "client");
+    std::vector<std::string> requestOptionals(optionals);
+    MMIntern::GridPrecision<T>::addOption(requestOptionals);
+    std::string queryString = createGridQuery(time, parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, requestOptionals);
+    build.end();
+    
+    int httpReturnCode = 0;
+    MMIntern::MemoryClass mem(500);
+    if (!fetchBinary(queryString, mem, httpReturnCode, msg, control))
+    {
+        return false;
+    }
+    return decodeGrid(mem, httpReturnCode, gridResult, latGridPts, lonGridPts, msg, control);
+}
+
+bool MeteomaticsApiClient::getMultiPointTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, std::vector<double> lats, std::vector<double> lons, std::vector<Matrix>& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, MultiPointTimeSeriesQuery);
+    MMIntern::TraceSpan request(httpClient->getTracer(), "getMultiPointTimeSeries", "request");
+    
+    result.clear();
+    msg.clear();
+    
+    MMIntern::TraceSpan build(httpClient->getTracer(), "query build", "client");
+    std::string queryString = createMultiPointTimeSeriesQuery(startTime, stopTime, timeStep, parameters, lats, lons, optionals);
+    build.end();
+    
+    int httpReturnCode = 0;
+    MMIntern::MemoryClass mem(500);
+    if (!fetchBinary(queryString, mem, httpReturnCode, msg, control))
+    {
+        return false;
+    }
+    return decodeMultiPointTimeSeries(mem, httpReturnCode, lats.size(), result, times, msg, control);
+}
+
+bool MeteomaticsApiClient::getMultiPoints(const std::string& time, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, Matrix& result, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
 {
+    MMIntern::AllocationScope allocationScope(memoryStats, MultiPointsQuery);
+    
     result.clear();
     std::vector<Matrix> tmpResults;
     std::vector<std::string> timeVec;
-    if (getMultiPointTimeSeries(time, time, getTimeStepStr(0, 0, 0, 0, 0, 0), parameters, lats, lons, tmpResults, timeVec, msg, optionals))
+    if (getMultiPointTimeSeries(time, time, getTimeStepStr(0, 0, 0, 0, 0, 0), parameters, lats, lons, tmpResults, timeVec, msg, optionals, control))
     {
+        MMIntern::TraceSpan assembly(httpClient->getTracer(), "result assembly", "client");
         result.resize(lats.size());
         for (std::size_t i = 0; i<lats.size(); i++)
         {
@@ -801,6 +3199,209 @@ bool MeteomaticsApiClient::getMultiPoints(const std::string& time, const std::ve
     return true;
 }
 
+bool MeteomaticsApiClient::getTimeSeriesCsv(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, double lat, double lon, Matrix& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, TimeSeriesQuery);
+    
+    result.clear();
+    msg.clear();
+    
+    std::vector<Matrix> tmpM;
+    if (getMultiPointTimeSeriesCsv(startTime, stopTime, timeStep, parameters, std::vector<double>(1,lat), std::vector<double>(1,lon), tmpM, times, msg, optionals, control))
+    {
+        result.swap(tmpM[0]);
+    }
+    else
+    {
+        return false;
+    }
+    
+    return true;
+}
+
+bool MeteomaticsApiClient::getMultiPointTimeSeriesCsv(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, std::vector<Matrix>& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, MultiPointTimeSeriesQuery);
+    
+    result.clear();
+    times.clear();
+    msg.clear();
+    
+    std::string queryString = createMultiPointTimeSeriesQuery(startTime, stopTime, timeStep, parameters, lats, lons, optionals, "csv");
+    
+    int httpReturnCode = 0;
+    
+    MMIntern::AllocationScope::enterPhase(MMIntern::AllocationScope::Receive);
+    std::string csv;
+    
+    httpClient->requestString("api.meteomatics.com", queryString, csv, dataRequestTimeout, httpReturnCode, control);
+    
+    MMIntern::AllocationScope::enterPhase(MMIntern::AllocationScope::Decode);
+    return decodeMultiPointTimeSeriesCsv(csv, httpReturnCode, lats.size(), result, times, msg, control);
+}
+
+bool MeteomaticsApiClient::getMultiPointsCsv(const std::string& time, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, Matrix& result, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, MultiPointsQuery);
+    
+    result.clear();
+    std::vector<Matrix> tmpResults;
+    std::vector<std::string> timeVec;
+    if (getMultiPointTimeSeriesCsv(time, time, getTimeStepStr(0, 0, 0, 0, 0, 0), parameters, lats, lons, tmpResults, timeVec, msg, optionals, control))
+    {
+        result.resize(lats.size());
+        for (std::size_t i = 0; i<lats.size(); i++)
+        {
+            if (tmpResults[i].empty())
+            {
+                msg = "No time step received.";
+                return false;
+            }
+            result[i].swap(tmpResults[i][0]);
+        }
+    }
+    else
+        return false;
+    
+    return true;
+}
+
+bool MeteomaticsApiClient::prepareMultiPointTimeSeries(const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, MeteomaticsPreparedQuery& query, std::string& msg, const std::vector<std::string>& optionals) const
+{
+    query = MeteomaticsPreparedQuery();
+    msg.clear();
+    
+    if (parameters.empty())
+    {
+        msg = "No parameters given.";
+        return false;
+    }
+    if (lats.empty() || lats.size() != lons.size())
+    {
+        msg = "Received no or a different number of coordinates for lat and lon.";
+        return false;
+    }
+    for (std::size_t i=0; i<lats.size(); i++)
+    {
+        if (!(std::fabs(lats[i]) <= 90.0) || !(std::fabs(lons[i]) <= 180.0))
+        {
+            msg = "Coordinate out of range.";
+            return false;
+        }
+    }
+    
+    query.queryKind = MeteomaticsPreparedQuery::MultiPointTimeSeries;
+    query.pathSuffix = ":P" + timeStep
+                     + "/" + createParameterListString(parameters)
+                     + "/" + createLatLonListString(lats, lons)
+                     + "/bin"
+                     + getOptionalSelectString(optionals);
+    query.coordinates = lats.size();
+    query.parameters = parameters.size();
+    return true;
+}
+
+bool MeteomaticsApiClient::prepareGrid(const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, MeteomaticsPreparedQuery& query, std::string& msg, const std::vector<std::string>& optionals) const
+{
+    query = MeteomaticsPreparedQuery();
+    msg.clear();
+    
+    if (parameter.empty())
+    {
+        msg = "No parameter given.";
+        return false;
+    }
+    if (nGridPts_Lat < 1 || nGridPts_Lon < 1)
+    {
+        msg = "Grid needs at least one point in each direction.";
+        return false;
+    }
+    if (!(std::fabs(lat_N) <= 90.0) || !(std::fabs(lat_S) <= 90.0) || !(std::fabs(lon_W) <= 180.0) || !(std::fabs(lon_E) <= 180.0))
+    {
+        msg = "Coordinate out of range.";
+        return false;
+    }
+    
+    // the grid query with an empty time starts with "//"
+    query.queryKind = MeteomaticsPreparedQuery::Grid;
+    query.pathSuffix = createGridQuery(std::string(), parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, optionals).substr(1);
+    query.parameters = 1;
+    query.gridLat = nGridPts_Lat;
+    query.gridLon = nGridPts_Lon;
+    return true;
+}
+
+bool MeteomaticsApiClient::executeMultiPointTimeSeries(MeteomaticsPreparedQuery& query, const std::string& startTime, const std::string& stopTime, std::vector<Matrix>& result, std::vector<std::string>& times, std::string& msg, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, MultiPointTimeSeriesQuery);
+    
+    msg.clear();
+    if (query.queryKind != MeteomaticsPreparedQuery::MultiPointTimeSeries)
+    {
+        msg = "Query is not a prepared time series query.";
+        return false;
+    }
+    
+    std::string queryString;
+    queryString.reserve(startTime.size() + stopTime.size() + query.pathSuffix.size() + 3);
+    queryString += '/';
+    queryString += startTime;
+    queryString += "--";
+    queryString += stopTime;
+    queryString += query.pathSuffix;
+    
+    int httpReturnCode = 0;
+    MMIntern::MemoryClass mem;
+    mem.mem.swap(query.receiveBuffer);
+    
+    const bool fetched = fetchBinary(queryString, mem, httpReturnCode, msg, control);
+    bool success = false;
+    if (fetched && decodePool && mem.size() >= parallelDecodeMinBytes && query.coordinates > 1)
+    {
+        result.clear();
+        times.clear();
+        success = decodeMultiPointTimeSeries(mem, httpReturnCode, query.coordinates, result, times, msg, control);
+    }
+    else if (fetched)
+    {
+        success = readMultiPointTimeSeriesBinInPlace(mem, query.coordinates, result, times, control);
+        if (!success)
+        {
+            msg = control.expired() ? control.reason() : "Error while reading mem-object.";
+        }
+    }
+    
+    mem.mem.swap(query.receiveBuffer);
+    return success;
+}
+
+bool MeteomaticsApiClient::executeGrid(MeteomaticsPreparedQuery& query, const std::string& time, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, GridQuery);
+    
+    msg.clear();
+    if (query.queryKind != MeteomaticsPreparedQuery::Grid)
+    {
+        msg = "Query is not a prepared grid query.";
+        return false;
+    }
+    
+    std::string queryString;
+    queryString.reserve(time.size() + query.pathSuffix.size() + 1);
+    queryString += '/';
+    queryString += time;
+    queryString += query.pathSuffix;
+    
+    int httpReturnCode = 0;
+    MMIntern::MemoryClass mem;
+    mem.mem.swap(query.receiveBuffer);
+    
+    const bool success = fetchBinary(queryString, mem, httpReturnCode, msg, control) && decodeGrid(mem, httpReturnCode, gridResult, latGridPts, lonGridPts, msg, control);
+    
+    mem.mem.swap(query.receiveBuffer);
+    return success;
+}
+
 void MeteomaticsApiClient::datevec(double time,double &year,double &month,double &day,double &hour,double &minute,double &second) const
 {
     /* Cumulative days per month in both nonleap and leap years. */
@@ -933,6 +3534,51 @@ const std::array<int,6> MeteomaticsApiClient::getCurrentTime() const
     return current_time;
 }
 
+void MeteomaticsApiClient::setRateLimiter(const std::shared_ptr<MeteomaticsRateLimiter>& rateLimiter, const MeteomaticsRateLimiter::Priority priority)
+{
+    httpClient->setRateLimiter(rateLimiter, priority);
+}
+
+void MeteomaticsApiClient::setTransportArchive(const std::shared_ptr<MeteomaticsTransportArchive>& archive)
+{
+    httpClient->setTransportArchive(archive);
+}
+
+void MeteomaticsApiClient::setTracer(const std::shared_ptr<MeteomaticsTracer>& tracer)
+{
+    httpClient->setTracer(tracer);
+}
+
+std::size_t MeteomaticsApiClient::warmUp(const std::size_t numConnections) const
+{
+    return httpClient->warmUp(numConnections, dataRequestTimeout);
+}
+
+void MeteomaticsApiClient::setDecodeThreads(const std::size_t numThreads)
+{
+    delete decodePool;
+    decodePool = numThreads > 1 ? new MMIntern::ThreadPool(numThreads) : nullptr;
+}
+
+MeteomaticsMemoryStats MeteomaticsApiClient::getMemoryStats(const QueryType type) const
+{
+    return memoryStats->get(type);
+}
+
+void MeteomaticsApiClient::resetMemoryStats()
+{
+    memoryStats->reset();
+}
+
+bool MeteomaticsApiClient::memoryStatsAvailable()
+{
+#ifdef METEOMATICS_COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
 const std::array<int,6> MeteomaticsApiClient::addDayToToday(const int days) const
 {
     std::time_t ltime = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
@@ -970,6 +3616,8 @@ int MeteomaticsApiClient::getTomorrowsYear() const
 
 MeteomaticsApiClient::~MeteomaticsApiClient()
 {
+    delete memoryStats;
+    delete decodePool;
     delete httpClient;
 }
 
@@ -0,0 +1,378 @@
+//
+//  Meteomatics_Interpolation.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_Interpolation_h
+#define Meteomatics_Interpolation_h
+
+#include "Meteomatics_ApiClient.h"
+
+#include <cmath>
+#include <limits>
+
+
+//
+//  METEOMATICS GRID INTERPOLATION ENGINE
+//
+//  Holds grids obtained via MeteomaticsApiClient::getGrid and answers batches
+//  of point queries locally, without any further http request.
+//  Points which are not covered by any of the held grids are returned as NaN
+//  and flagged, such that the caller can fall back to getMultiPoints.
+//
+class MeteomaticsInterpolationEngine
+{
+public:
+    enum Method
+    {
+        Nearest,
+        Bilinear,
+        Bicubic
+    };
+
+    struct ErrorReport
+    {
+        std::size_t numCompared;
+        double maxAbsError;
+        double meanAbsError;
+        double rmsError;
+        double bias;
+    };
+
+    MeteomaticsInterpolationEngine();
+
+    //
+    // -- add a grid as returned by getGrid (gridResult [lat][lon], latGridPts, lonGridPts), returns false if inconsistent
+    //
+    bool addGrid(const Matrix& gridResult, const std::vector<double>& latGridPts, const std::vector<double>& lonGridPts, std::string& msg);
+
+    std::size_t numGrids() const;
+    void clear();
+
+    //
+    // -- interpolate all points at once; result[i] is NaN and covered[i] false if no grid contains the point
+    //
+    std::size_t interpolate(const std::vector<double>& lats, const std::vector<double>& lons, std::vector<double>& result, std::vector<bool>& covered, const Method method=Bilinear) const;
+
+    //
+    // -- compares interpolated values against reference values, e.g. a parameter column of getMultiPoints
+    //
+    static ErrorReport compare(const std::vector<double>& interpolated, const std::vector<double>& reference);
+    static ErrorReport compare(const std::vector<double>& interpolated, const Matrix& multiPointsResult, const std::size_t parameterIndex);
+
+private:
+    struct Axis
+    {
+        std::vector<double> pts;
+        double origin;
+        double step;                // signed spacing, used for the uniform fast path
+        bool uniform;
+
+        bool set(const std::vector<double>& _pts);
+        bool contains(double c) const;
+        double index(double c) const;           // fractional index in [0, n-1]
+    };
+
+    struct Grid
+    {
+        Axis lat;
+        Axis lon;
+        std::vector<double> values;             // row-major [lat][lon]
+    };
+
+    static void interpolateOnGrid(const Grid& grid, const std::size_t n, const double* fi, const double* fj, double* out, const Method method);
+    static double cubicWeight(double x, std::size_t k);
+
+    std::vector<Grid> grids;
+};
+
+MeteomaticsInterpolationEngine::MeteomaticsInterpolationEngine()
+{
+}
+
+bool MeteomaticsInterpolationEngine::Axis::set(const std::vector<double>& _pts)
+{
+    pts = _pts;
+    if (pts.size() < 2)
+    {
+        return false;
+    }
+
+    origin = pts.front();
+    step = (pts.back() - pts.front()) / static_cast<double>(pts.size()-1);
+    if (step == 0.0)
+    {
+        return false;
+    }
+
+    uniform = true;
+    const double tolerance = 1e-6 * std::fabs(step);
+    for (std::size_t i=1; i<pts.size(); i++)
+    {
+        const double d = pts[i] - pts[i-1];
+        if ((d > 0) != (step > 0))
+        {
+            return false;                       // axis must be monotonic
+        }
+        if (std::fabs(d - step) > tolerance)
+        {
+            uniform = false;
+        }
+    }
+    return true;
+}
+
+bool MeteomaticsInterpolationEngine::Axis::contains(double c) const
+{
+    const double lo = std::min(pts.front(), pts.back());
+    const double hi = std::max(pts.front(), pts.back());
+    return c >= lo && c <= hi;
+}
+
+double MeteomaticsInterpolationEngine::Axis::index(double c) const
+{
+    const double last = static_cast<double>(pts.size()-1);
+    if (uniform)
+    {
+        return std::min(std::max((c - origin) / step, 0.0), last);
+    }
+
+    // non-uniform axis: binary search for the enclosing interval
+    std::size_t lo = 0;
+    std::size_t hi = pts.size()-1;
+    const bool ascending = step > 0;
+    while (hi - lo > 1)
+    {
+        const std::size_t mid = (lo + hi) / 2;
+        if ((pts[mid] <= c) == ascending)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    const double f = (c - pts[lo]) / (pts[hi] - pts[lo]);
+    return std::min(std::max(static_cast<double>(lo) + f, 0.0), last);
+}
+
+bool MeteomaticsInterpolationEngine::addGrid(const Matrix& gridResult, const std::vector<double>& latGridPts, const std::vector<double>& lonGridPts, std::string& msg)
+{
+    msg.clear();
+    if (gridResult.size() != latGridPts.size())
+    {
+        msg = "Grid has a different number of rows than latitude points.";
+        return false;
+    }
+
+    Grid grid;
+    if (!grid.lat.set(latGridPts) || !grid.lon.set(lonGridPts))
+    {
+        msg = "Grid axes need at least two strictly monotonic coordinates.";
+        return false;
+    }
+
+    const std::size_t numLon = lonGridPts.size();
+    grid.values.reserve(latGridPts.size() * numLon);
+    for (const auto& row : gridResult)
+    {
+        if (row.size() != numLon)
+        {
+            msg = "Grid has a different number of columns than longitude points.";
+            return false;
+        }
+        grid.values.insert(grid.values.end(), row.begin(), row.end());
+    }
+
+    grids.push_back(std::move(grid));
+    return true;
+}
+
+std::size_t MeteomaticsInterpolationEngine::numGrids() const
+{
+    return grids.size();
+}
+
+void MeteomaticsInterpolationEngine::clear()
+{
+    grids.clear();
+}
+
+std::size_t MeteomaticsInterpolationEngine::interpolate(const std::vector<double>& lats, const std::vector<double>& lons, std::vector<double>& result, std::vector<bool>& covered, const Method method) const
+{
+    const std::size_t numPts = std::min(lats.size(), lons.size());
+    result.assign(numPts, std::numeric_limits<double>::quiet_NaN());
+    covered.assign(numPts, false);
+
+    std::vector<std::size_t> selection;
+    std::vector<double> fi, fj, values;
+    selection.reserve(numPts);
+
+    std::size_t numCovered = 0;
+    for (const auto& grid : grids)
+    {
+        // gather the still uncovered points inside this grid, first grid wins
+        selection.clear();
+        for (std::size_t p=0; p<numPts; p++)
+        {
+            if (!covered[p] && grid.lat.contains(lats[p]) && grid.lon.contains(lons[p]))
+            {
+                selection.push_back(p);
+            }
+        }
+        if (selection.empty())
+        {
+            continue;
+        }
+
+        const std::size_t n = selection.size();
+        fi.resize(n);
+        fj.resize(n);
+        values.resize(n);
+
+        if (grid.lat.uniform && grid.lon.uniform)
+        {
+            const double invLatStep = 1.0 / grid.lat.step;
+            const double invLonStep = 1.0 / grid.lon.step;
+            const double maxI = static_cast<double>(grid.lat.pts.size()-1);
+            const double maxJ = static_cast<double>(grid.lon.pts.size()-1);
+            for (std::size_t k=0; k<n; k++)
+            {
+                fi[k] = std::min(std::max((lats[selection[k]] - grid.lat.origin) * invLatStep, 0.0), maxI);
+                fj[k] = std::min(std::max((lons[selection[k]] - grid.lon.origin) * invLonStep, 0.0), maxJ);
+            }
+        }
+        else
+        {
+            for (std::size_t k=0; k<n; k++)
+            {
+                fi[k] = grid.lat.index(lats[selection[k]]);
+                fj[k] = grid.lon.index(lons[selection[k]]);
+            }
+        }
+
+        interpolateOnGrid(grid, n, fi.data(), fj.data(), values.data(), method);
+
+        for (std::size_t k=0; k<n; k++)
+        {
+            result[selection[k]] = values[k];
+            covered[selection[k]] = true;
+        }
+        numCovered += n;
+    }
+    return numCovered;
+}
+
+double MeteomaticsInterpolationEngine::cubicWeight(double x, std::size_t k)
+{
+    // Catmull-Rom weights for the sample points -1, 0, 1, 2 at offset x in [0,1]
+    const double x2 = x*x;
+    const double x3 = x2*x;
+    switch (k)
+    {
+        case 0: return 0.5 * (-x3 + 2.0*x2 - x);
+        case 1: return 0.5 * (3.0*x3 - 5.0*x2 + 2.0);
+        case 2: return 0.5 * (-3.0*x3 + 4.0*x2 + x);
+        default: return 0.5 * (x3 - x2);
+    }
+}
+
+void MeteomaticsInterpolationEngine::interpolateOnGrid(const Grid& grid, const std::size_t n, const double* fi, const double* fj, double* out, const Method method)
+{
+    const std::ptrdiff_t numLat = static_cast<std::ptrdiff_t>(grid.lat.pts.size());
+    const std::ptrdiff_t numLon = static_cast<std::ptrdiff_t>(grid.lon.pts.size());
+    const double* v = grid.values.data();
+
+    switch (method)
+    {
+        case Nearest:
+            for (std::size_t k=0; k<n; k++)
+            {
+                const std::ptrdiff_t i = static_cast<std::ptrdiff_t>(fi[k] + 0.5);
+                const std::ptrdiff_t j = static_cast<std::ptrdiff_t>(fj[k] + 0.5);
+                out[k] = v[i*numLon + j];
+            }
+            break;
+
+        case Bilinear:
+            for (std::size_t k=0; k<n; k++)
+            {
+                const std::ptrdiff_t i0 = std::min(static_cast<std::ptrdiff_t>(fi[k]), numLat-2);
+                const std::ptrdiff_t j0 = std::min(static_cast<std::ptrdiff_t>(fj[k]), numLon-2);
+                const double wi = fi[k] - static_cast<double>(i0);
+                const double wj = fj[k] - static_cast<double>(j0);
+                const double* r0 = v + i0*numLon + j0;
+                const double* r1 = r0 + numLon;
+                out[k] = (1.0-wi) * ((1.0-wj)*r0[0] + wj*r0[1])
+                       +      wi  * ((1.0-wj)*r1[0] + wj*r1[1]);
+            }
+            break;
+
+        case Bicubic:
+            for (std::size_t k=0; k<n; k++)
+            {
+                const std::ptrdiff_t i0 = std::min(static_cast<std::ptrdiff_t>(fi[k]), numLat-2);
+                const std::ptrdiff_t j0 = std::min(static_cast<std::ptrdiff_t>(fj[k]), numLon-2);
+                const double wi = fi[k] - static_cast<double>(i0);
+                const double wj = fj[k] - static_cast<double>(j0);
+
+                double sum = 0.0;
+                for (std::size_t a=0; a<4; a++)
+                {
+                    // clamp the 4x4 stencil at the grid border
+                    const std::ptrdiff_t i = std::min(std::max(i0 - 1 + static_cast<std::ptrdiff_t>(a), std::ptrdiff_t(0)), numLat-1);
+                    double rowSum = 0.0;
+                    for (std::size_t b=0; b<4; b++)
+                    {
+                        const std::ptrdiff_t j = std::min(std::max(j0 - 1 + static_cast<std::ptrdiff_t>(b), std::ptrdiff_t(0)), numLon-1);
+                        rowSum += cubicWeight(wj, b) * v[i*numLon + j];
+                    }
+                    sum += cubicWeight(wi, a) * rowSum;
+                }
+                out[k] = sum;
+            }
+            break;
+    }
+}
+
+MeteomaticsInterpolationEngine::ErrorReport MeteomaticsInterpolationEngine::compare(const std::vector<double>& interpolated, const std::vector<double>& reference)
+{
+    ErrorReport report = {0, 0.0, 0.0, 0.0, 0.0};
+    const std::size_t n = std::min(interpolated.size(), reference.size());
+    for (std::size_t i=0; i<n; i++)
+    {
+        if (std::isnan(interpolated[i]) || std::isnan(reference[i]))
+        {
+            continue;
+        }
+        const double d = interpolated[i] - reference[i];
+        report.maxAbsError = std::max(report.maxAbsError, std::fabs(d));
+        report.meanAbsError += std::fabs(d);
+        report.rmsError += d*d;
+        report.bias += d;
+        report.numCompared++;
+    }
+    if (report.numCompared > 0)
+    {
+        const double count = static_cast<double>(report.numCompared);
+        report.meanAbsError /= count;
+        report.rmsError = std::sqrt(report.rmsError / count);
+        report.bias /= count;
+    }
+    return report;
+}
+
+MeteomaticsInterpolationEngine::ErrorReport MeteomaticsInterpolationEngine::compare(const std::vector<double>& interpolated, const Matrix& multiPointsResult, const std::size_t parameterIndex)
+{
+    std::vector<double> reference(multiPointsResult.size(), std::numeric_limits<double>::quiet_NaN());
+    for (std::size_t i=0; i<multiPointsResult.size(); i++)
+    {
+        if (parameterIndex < multiPointsResult[i].size())
+        {
+            reference[i] = multiPointsResult[i][parameterIndex];
+        }
+    }
+    return compare(interpolated, reference);
+}
+
+
+#endif /* Meteomatics_Interpolation_h */
@@ -0,0 +1,521 @@
+//
+//  Meteomatics_MappedResult.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_MappedResult_h
+#define Meteomatics_MappedResult_h
+
+#include "Meteomatics_ApiClient.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace MMIntern {
+    struct MappedSeriesHeader;
+}
+
+
+//
+//  METEOMATICS MAPPED TIME SERIES
+//
+//  Multi point time series in a memory-mapped file, for results larger than memory. The values are
+//  stored as doubles laid out [parameter][coordinate][time], i.e. the series of one parameter at one
+//  coordinate is contiguous, behind a header describing the axes: the parameters, the coordinates and
+//  a regular time axis. The file is preallocated on create with all values NaN (missing) and filled
+//  by MeteomaticsApiClient::getMultiPointTimeSeries in any number of coordinate and time windows.
+//  Reopening maps the file without reading it. The file uses the byte order of the host.
+//
+class MeteomaticsMappedTimeSeries
+{
+public:
+    MeteomaticsMappedTimeSeries();
+    ~MeteomaticsMappedTimeSeries();
+
+    MeteomaticsMappedTimeSeries(const MeteomaticsMappedTimeSeries&) = delete;
+    MeteomaticsMappedTimeSeries& operator=(const MeteomaticsMappedTimeSeries&) = delete;
+
+    //
+    // -- creates (or overwrites) the file for the times startTime, startTime + stepSeconds, ... up to stopTime (iso strings)
+    //
+    bool create(const std::string& path, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, const std::string& startTime, const std::string& stopTime, const double stepSeconds, std::string& msg);
+    bool open(const std::string& path, std::string& msg, const bool writable=false);
+    bool flush();                               // writes modified pages back to the file
+    void close();
+
+    bool isOpen() const;
+    bool isWritable() const;
+
+    std::size_t numParameters() const;
+    std::size_t numCoordinates() const;
+    std::size_t numTimes() const;
+    const std::string& parameter(const std::size_t p) const;
+    double lat(const std::size_t c) const;
+    double lon(const std::size_t c) const;
+    double unixTime(const std::size_t t) const;
+    double stepSeconds() const;
+
+    //
+    // -- the numTimes() values of parameter p at coordinate c, NaN where not fetched yet
+    //
+    const double* values(const std::size_t p, const std::size_t c) const;
+    double* writableValues(const std::size_t p, const std::size_t c);     // nullptr if the file was opened read-only
+
+private:
+    bool map(const int fd, const std::size_t bytes, const bool writable, std::string& msg);
+    static bool fits(const uint64_t offset, const uint64_t count, const uint64_t size, const uint64_t end);
+    static bool validLayout(const MMIntern::MappedSeriesHeader& h, const uint64_t fileBytes);
+
+    MMIntern::MappedSeriesHeader* header;
+    std::size_t mappedBytes;
+    bool writable;
+    std::vector<std::string> parameters;
+    const double* lats;
+    const double* lons;
+    double* data;
+
+    static const uint32_t fileMagic = 0x53544D4D;   // "MMTS"
+    static const uint32_t fileVersion = 1;
+};
+
+
+struct MMIntern::MappedSeriesHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t numParameters;
+    uint64_t numCoordinates;
+    uint64_t numTimes;
+    double startTime;                           // unix seconds
+    double stepSeconds;
+    uint64_t parametersOffset;                  // names separated by '\n'
+    uint64_t parametersBytes;
+    uint64_t latsOffset;
+    uint64_t lonsOffset;
+    uint64_t dataOffset;                        // page aligned
+    uint64_t fileBytes;
+};
+
+
+MeteomaticsMappedTimeSeries::MeteomaticsMappedTimeSeries()
+: header(nullptr)
+, mappedBytes(0)
+, writable(false)
+, lats(nullptr)
+, lons(nullptr)
+, data(nullptr)
+{
+}
+
+MeteomaticsMappedTimeSeries::~MeteomaticsMappedTimeSeries()
+{
+    close();
+}
+
+bool MeteomaticsMappedTimeSeries::map(const int fd, const std::size_t bytes, const bool _writable, std::string& msg)
+{
+    void* mapped = mmap(nullptr, bytes, _writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        msg = std::string("mmap failed: ") + std::strerror(errno);
+        return false;
+    }
+    header = static_cast<MMIntern::MappedSeriesHeader*>(mapped);
+    mappedBytes = bytes;
+    writable = _writable;
+    return true;
+}
+
+// offset + count * size <= end, without overflowing
+bool MeteomaticsMappedTimeSeries::fits(const uint64_t offset, const uint64_t count, const uint64_t size, const uint64_t end)
+{
+    return offset <= end && (count == 0 || size <= (end - offset) / count);
+}
+
+// the sections follow each other as create lays them out: header, parameter names, lats, lons, values
+bool MeteomaticsMappedTimeSeries::validLayout(const MMIntern::MappedSeriesHeader& h, const uint64_t fileBytes)
+{
+    if (h.magic != fileMagic || h.version != fileVersion || h.fileBytes != fileBytes
+        || h.numParameters == 0 || h.numCoordinates == 0 || h.numTimes == 0
+        || h.latsOffset % sizeof(double) != 0 || h.lonsOffset % sizeof(double) != 0 || h.dataOffset % sizeof(double) != 0)
+    {
+        return false;
+    }
+    if (h.parametersOffset < sizeof(h) || !fits(h.parametersOffset, h.parametersBytes, 1, h.latsOffset)
+        || !fits(h.latsOffset, h.numCoordinates, sizeof(double), h.lonsOffset) || !fits(h.lonsOffset, h.numCoordinates, sizeof(double), h.dataOffset)
+        || h.dataOffset > fileBytes)
+    {
+        return false;
+    }
+    const uint64_t maxValues = (fileBytes - h.dataOffset) / sizeof(double);
+    return h.numParameters <= maxValues && h.numCoordinates <= maxValues / h.numParameters
+        && h.numTimes <= maxValues / (h.numParameters * h.numCoordinates);
+}
+
+bool MeteomaticsMappedTimeSeries::create(const std::string& path, const std::vector<std::string>& _parameters, const std::vector<double>& _lats, const std::vector<double>& _lons, const std::string& startTime, const std::string& stopTime, const double step, std::string& msg)
+{
+    close();
+    msg.clear();
+
+    double start = 0, stop = 0;
+    if (_parameters.empty() || _lats.empty() || _lats.size() != _lons.size())
+    {
+        msg = "parameters and coordinates must not be empty, lats and lons of the same size";
+        return false;
+    }
+    if (!MMIntern::parseIsoTime(startTime, start) || !MMIntern::parseIsoTime(stopTime, stop) || stop < start || !(step > 0))
+    {
+        msg = "invalid time axis";
+        return false;
+    }
+
+    std::string names;
+    for (const auto& p : _parameters)
+    {
+        if (p.empty() || p.find('\n') != std::string::npos)
+        {
+            msg = "invalid parameter name";
+            return false;
+        }
+        names += p + '\n';
+    }
+
+    const uint64_t numTimes = static_cast<uint64_t>(std::floor((stop - start) / step + 1e-9)) + 1;
+    const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+
+    MMIntern::MappedSeriesHeader h;
+    std::memset(&h, 0, sizeof(h));
+    h.magic = fileMagic;
+    h.version = fileVersion;
+    h.numParameters = _parameters.size();
+    h.numCoordinates = _lats.size();
+    h.numTimes = numTimes;
+    h.startTime = start;
+    h.stepSeconds = step;
+    h.parametersOffset = sizeof(h);
+    h.parametersBytes = names.size();
+    h.latsOffset = (h.parametersOffset + h.parametersBytes + 7) / 8 * 8;
+    h.lonsOffset = h.latsOffset + h.numCoordinates * sizeof(double);
+    h.dataOffset = (h.lonsOffset + h.numCoordinates * sizeof(double) + pageSize - 1) / pageSize * pageSize;
+    h.fileBytes = h.dataOffset + h.numParameters * h.numCoordinates * h.numTimes * sizeof(double);
+
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        msg = "cannot create " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    if (ftruncate(fd, static_cast<off_t>(h.fileBytes)) != 0)
+    {
+        msg = "cannot size " + path + ": " + std::strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    const bool mapped = map(fd, h.fileBytes, true, msg);
+    ::close(fd);
+    if (!mapped)
+    {
+        return false;
+    }
+
+    char* base = reinterpret_cast<char*>(header);
+    *header = h;
+    std::memcpy(base + h.parametersOffset, names.data(), names.size());
+    std::memcpy(base + h.latsOffset, _lats.data(), _lats.size() * sizeof(double));
+    std::memcpy(base + h.lonsOffset, _lons.data(), _lons.size() * sizeof(double));
+
+    double* values = reinterpret_cast<double*>(base + h.dataOffset);
+    std::fill(values, values + h.numParameters * h.numCoordinates * h.numTimes, std::numeric_limits<double>::quiet_NaN());
+
+    parameters = _parameters;
+    lats = reinterpret_cast<const double*>(base + h.latsOffset);
+    lons = reinterpret_cast<const double*>(base + h.lonsOffset);
+    data = values;
+    return true;
+}
+
+bool MeteomaticsMappedTimeSeries::open(const std::string& path, std::string& msg, const bool _writable)
+{
+    close();
+    msg.clear();
+
+    const int fd = ::open(path.c_str(), _writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+    {
+        msg = "cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(MMIntern::MappedSeriesHeader))
+    {
+        msg = path + " is not a mapped time series";
+        ::close(fd);
+        return false;
+    }
+    const bool mapped = map(fd, static_cast<std::size_t>(st.st_size), _writable, msg);
+    ::close(fd);
+    if (!mapped)
+    {
+        return false;
+    }
+
+    const MMIntern::MappedSeriesHeader& h = *header;
+    if (!validLayout(h, mappedBytes))
+    {
+        msg = path + " is not a mapped time series or is truncated";
+        close();
+        return false;
+    }
+
+    const char* base = reinterpret_cast<const char*>(header);
+    std::stringstream names(std::string(base + h.parametersOffset, h.parametersBytes));
+    std::string name;
+    while (std::getline(names, name))
+    {
+        parameters.push_back(name);
+    }
+    if (parameters.size() != h.numParameters)
+    {
+        msg = path + " has a corrupt parameter list";
+        close();
+        return false;
+    }
+    lats = reinterpret_cast<const double*>(base + h.latsOffset);
+    lons = reinterpret_cast<const double*>(base + h.lonsOffset);
+    data = reinterpret_cast<double*>(const_cast<char*>(base) + h.dataOffset);
+    return true;
+}
+
+bool MeteomaticsMappedTimeSeries::flush()
+{
+    return header != nullptr && (!writable || msync(header, mappedBytes, MS_SYNC) == 0);
+}
+
+void MeteomaticsMappedTimeSeries::close()
+{
+    if (header != nullptr)
+    {
+        munmap(header, mappedBytes);
+    }
+    header = nullptr;
+    mappedBytes = 0;
+    writable = false;
+    parameters.clear();
+    lats = lons = nullptr;
+    data = nullptr;
+}
+
+bool MeteomaticsMappedTimeSeries::isOpen() const
+{
+    return header != nullptr;
+}
+
+bool MeteomaticsMappedTimeSeries::isWritable() const
+{
+    return writable;
+}
+
+std::size_t MeteomaticsMappedTimeSeries::numParameters() const
+{
+    return header ? header->numParameters : 0;
+}
+
+std::size_t MeteomaticsMappedTimeSeries::numCoordinates() const
+{
+    return header ? header->numCoordinates : 0;
+}
+
+std::size_t MeteomaticsMappedTimeSeries::numTimes() const
+{
+    return header ? header->numTimes : 0;
+}
+
+const std::string& MeteomaticsMappedTimeSeries::parameter(const std::size_t p) const
+{
+    return parameters[p];
+}
+
+double MeteomaticsMappedTimeSeries::lat(const std::size_t c) const
+{
+    return lats[c];
+}
+
+double MeteomaticsMappedTimeSeries::lon(const std::size_t c) const
+{
+    return lons[c];
+}
+
+double MeteomaticsMappedTimeSeries::unixTime(const std::size_t t) const
+{
+    return header->startTime + t * header->stepSeconds;
+}
+
+double MeteomaticsMappedTimeSeries::stepSeconds() const
+{
+    return header ? header->stepSeconds : 0;
+}
+
+const double* MeteomaticsMappedTimeSeries::values(const std::size_t p, const std::size_t c) const
+{
+    return data + (p * header->numCoordinates + c) * header->numTimes;
+}
+
+double* MeteomaticsMappedTimeSeries::writableValues(const std::size_t p, const std::size_t c)
+{
+    return writable ? data + (p * header->numCoordinates + c) * header->numTimes : nullptr;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METEOMATICS API CLIENT: MAPPED TIME SERIES
+//
+bool MeteomaticsApiClient::readMultiPointTimeSeriesBinInto(MMIntern::MemoryClass& mem, MeteomaticsMappedTimeSeries& series, const std::size_t firstCoordinate, const std::size_t numCoordinates, const MeteomaticsRequestControl& control) const
+{
+    const std::size_t end = mem.size();
+    int32_t nCoords = 1;
+    if (numCoordinates != 1)                    // a single coordinate comes without the coordinate count
+    {
+        if (mem.getReadPos() + sizeof(nCoords) > end)
+        {
+            return false;
+        }
+        mem.read(nCoords);
+    }
+    if (nCoords < 0 || static_cast<std::size_t>(nCoords) != numCoordinates)
+    {
+        return false;
+    }
+
+    const std::size_t numParameters = series.numParameters();
+    const std::size_t numTimes = series.numTimes();
+    const double start = series.unixTime(0);
+    const double step = series.stepSeconds();
+
+    std::vector<double*> columns(numParameters);
+    for (std::size_t i=0; i<numCoordinates; i++)
+    {
+        if (control.expired())
+        {
+            return false;
+        }
+        for (std::size_t p=0; p<numParameters; p++)
+        {
+            columns[p] = series.writableValues(p, firstCoordinate + i);
+        }
+
+        int32_t nTimes;
+        if (mem.getReadPos() + sizeof(nTimes) > end)
+        {
+            return false;
+        }
+        mem.read(nTimes);
+        for (int32_t j=0; j<nTimes; j++)
+        {
+            int32_t nParameter;
+            double date;
+            if (mem.getReadPos() + sizeof(nParameter) + sizeof(date) > end)
+            {
+                return false;
+            }
+            mem.read(nParameter);
+            mem.read(date);
+            if (nParameter < 0 || static_cast<std::size_t>(nParameter) != numParameters || mem.getReadPos() + nParameter * sizeof(double) > end)
+            {
+                return false;
+            }
+
+            // matlab datenum to the index on the time axis of the file, times off the axis are skipped
+            const double index = std::floor(((date - 719529.0) * 86400.0 - start) / step + 0.5);
+            if (index < 0 || index >= static_cast<double>(numTimes))
+            {
+                mem.setReadPos(mem.getReadPos() + nParameter * sizeof(double));
+                continue;
+            }
+            const std::size_t t = static_cast<std::size_t>(index);
+            for (std::size_t p=0; p<numParameters; p++)
+            {
+                mem.read(columns[p][t]);
+            }
+        }
+    }
+    return true;
+}
+
+bool MeteomaticsApiClient::getMultiPointTimeSeries(MeteomaticsMappedTimeSeries& series, const std::size_t firstCoordinate, const std::size_t numCoordinates, const std::size_t firstTime, const std::size_t numTimes, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, MultiPointTimeSeriesQuery);
+
+    msg.clear();
+    if (!series.isOpen() || !series.isWritable())
+    {
+        msg = "mapped time series not open for writing";
+        return false;
+    }
+    if (numCoordinates == 0 || firstCoordinate + numCoordinates > series.numCoordinates() || numTimes == 0 || firstTime + numTimes > series.numTimes())
+    {
+        msg = "coordinate or time window outside of the mapped time series";
+        return false;
+    }
+
+    std::vector<std::string> parameters(series.numParameters());
+    for (std::size_t p=0; p<parameters.size(); p++)
+    {
+        parameters[p] = series.parameter(p);
+    }
+    std::vector<double> lats(numCoordinates), lons(numCoordinates);
+    for (std::size_t i=0; i<numCoordinates; i++)
+    {
+        lats[i] = series.lat(firstCoordinate + i);
+        lons[i] = series.lon(firstCoordinate + i);
+    }
+
+    const long long step = std::llround(series.stepSeconds());
+    const std::string timeStep = getTimeStepStr(0, 0, static_cast<int>(step / 86400), static_cast<int>(step % 86400 / 3600), static_cast<int>(step % 3600 / 60), static_cast<int>(step % 60));
+    const std::string startTime = convDateIso8601(series.unixTime(firstTime) / 86400.0 + 719529.0);
+    const std::string stopTime = convDateIso8601(series.unixTime(firstTime + numTimes - 1) / 86400.0 + 719529.0);
+    const std::string queryString = createMultiPointTimeSeriesQuery(startTime, stopTime, timeStep, parameters, lats, lons, optionals);
+
+    int httpReturnCode = 0;
+    MMIntern::MemoryClass mem(500);
+    if (!fetchBinary(queryString, mem, httpReturnCode, msg, control))
+    {
+        return false;
+    }
+    if (!readMultiPointTimeSeriesBinInto(mem, series, firstCoordinate, numCoordinates, control))
+    {
+        if (control.expired())
+        {
+            msg = control.reason();
+            return false;
+        }
+        std::cout << "Error while reading mem-object." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+#endif /* Meteomatics_MappedResult_h */
@@ -0,0 +1,416 @@
+//
+//  Meteomatics_ParameterSet.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_ParameterSet_h
+#define Meteomatics_ParameterSet_h
+
+#include "Meteomatics_ApiClient.h"
+
+#include <cstring>
+
+
+//
+// -- declares a parameter as a type, e.g. METEOMATICS_PARAMETER(T2m, "t_2m:C");
+//
+#define METEOMATICS_PARAMETER(Type, literal)                                            \
+    struct Type                                                                         \
+    {                                                                                   \
+        static constexpr std::size_t length() { return sizeof(literal) - 1; }           \
+        static constexpr char at(const std::size_t i) { return literal[i]; }            \
+        static const char* str() { return literal; }                                    \
+    }
+
+
+namespace MMIntern {
+    template<std::size_t... I> struct IndexSequence {};
+    template<class A, class B> struct ConcatIndices;
+    template<std::size_t N> struct MakeIndexSequence;
+    template<class... P> struct ParameterChars;
+    template<class Chars, class Indices> struct JoinedParameters;
+    template<class Wanted, class... P> struct ParameterIndex;
+    template<class... P> struct ValidParameters;
+
+    template<class P>
+    constexpr bool validParameterName(const std::size_t i=0);
+}
+
+
+//
+//  METEOMATICS PARAMETER SET INTERNALS
+//
+//  The joined parameter list as a char array built by the compiler: ParameterChars maps a position in
+//  "p0,p1,...,pn" to the character of the parameter (or the comma) there, JoinedParameters expands it
+//  over all positions into a static array.
+//
+template<std::size_t... I, std::size_t... J>
+struct MMIntern::ConcatIndices<MMIntern::IndexSequence<I...>, MMIntern::IndexSequence<J...>>
+{
+    typedef IndexSequence<I..., (sizeof...(I) + J)...> type;
+};
+
+template<std::size_t N>
+struct MMIntern::MakeIndexSequence
+{
+    typedef typename ConcatIndices<typename MakeIndexSequence<N / 2>::type, typename MakeIndexSequence<N - N / 2>::type>::type type;
+};
+
+template<>
+struct MMIntern::MakeIndexSequence<0>
+{
+    typedef IndexSequence<> type;
+};
+
+template<>
+struct MMIntern::MakeIndexSequence<1>
+{
+    typedef IndexSequence<0> type;
+};
+
+template<class P>
+struct MMIntern::ParameterChars<P>
+{
+    static constexpr std::size_t length()
+    {
+        return P::length();
+    }
+    static constexpr char at(const std::size_t i)
+    {
+        return P::at(i);
+    }
+};
+
+template<class P, class... Rest>
+struct MMIntern::ParameterChars<P, Rest...>
+{
+    static constexpr std::size_t length()
+    {
+        return P::length() + 1 + ParameterChars<Rest...>::length();
+    }
+    static constexpr char at(const std::size_t i)
+    {
+        return i < P::length() ? P::at(i) : i == P::length() ? ',' : ParameterChars<Rest...>::at(i - P::length() - 1);
+    }
+};
+
+template<class Chars, std::size_t... I>
+struct MMIntern::JoinedParameters<Chars, MMIntern::IndexSequence<I...>>
+{
+    static constexpr char value[sizeof...(I) + 1] = {Chars::at(I)..., '\0'};
+};
+
+template<class Chars, std::size_t... I>
+constexpr char MMIntern::JoinedParameters<Chars, MMIntern::IndexSequence<I...>>::value[sizeof...(I) + 1];
+
+template<class Wanted>
+struct MMIntern::ParameterIndex<Wanted>
+{
+    static constexpr std::size_t value = 0;
+    static constexpr bool found = false;
+};
+
+template<class Wanted, class... Rest>
+struct MMIntern::ParameterIndex<Wanted, Wanted, Rest...>
+{
+    static constexpr std::size_t value = 0;
+    static constexpr bool found = true;
+};
+
+template<class Wanted, class P, class... Rest>
+struct MMIntern::ParameterIndex<Wanted, P, Rest...>
+{
+    static constexpr std::size_t value = 1 + ParameterIndex<Wanted, Rest...>::value;
+    static constexpr bool found = ParameterIndex<Wanted, Rest...>::found;
+};
+
+// a name is not empty and has none of the characters separating the parts of a query
+template<class P>
+constexpr bool MMIntern::validParameterName(const std::size_t i)
+{
+    return i == P::length() ? i > 0
+         : P::at(i) != ',' && P::at(i) != '/' && P::at(i) != ' ' && P::at(i) != '?' && P::at(i) != '&' && validParameterName<P>(i + 1);
+}
+
+template<>
+struct MMIntern::ValidParameters<>
+{
+    static constexpr bool value = true;
+};
+
+template<class P, class... Rest>
+struct MMIntern::ValidParameters<P, Rest...>
+{
+    static constexpr bool value = validParameterName<P>() && ValidParameters<Rest...>::value;
+};
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METEOMATICS PARAMETER SET
+//
+//  A set of parameters fixed at compile time, e.g.
+//
+//      METEOMATICS_PARAMETER(T2m, "t_2m:C");
+//      METEOMATICS_PARAMETER(Precip1h, "precip_1h:mm");
+//      typedef MeteomaticsParameterSet<T2m, Precip1h> Weather;
+//
+//  The parameter list of the query ("t_2m:C,precip_1h:mm") is joined by the compiler, and the typed
+//  getters of MeteomaticsApiClient (getTimeSeries<Weather>(...), ...) decode each time into a Row with
+//  one column per parameter, addressed by type with the index resolved at compile time:
+//
+//      Weather::get<T2m>(row)
+//
+template<class... P>
+class MeteomaticsParameterSet
+{
+public:
+    static_assert(sizeof...(P) > 0, "a parameter set needs at least one parameter");
+    static_assert(MMIntern::ValidParameters<P...>::value, "parameter names must not be empty or contain ',', '/', ' ', '?' or '&'");
+
+    typedef std::array<double, sizeof...(P)> Row;
+
+    static constexpr std::size_t size = sizeof...(P);
+
+    //
+    // -- the joined parameter list of the query, e.g. "t_2m:C,precip_1h:mm"
+    //
+    static constexpr const char* fragment()
+    {
+        return MMIntern::JoinedParameters<MMIntern::ParameterChars<P...>, typename MMIntern::MakeIndexSequence<MMIntern::ParameterChars<P...>::length()>::type>::value;
+    }
+
+    //
+    // -- the parameters as strings, for the getters taking a std::vector<std::string>
+    //
+    static std::vector<std::string> parameters()
+    {
+        return std::vector<std::string>{P::str()...};
+    }
+
+    //
+    // -- column of a parameter in Row (a compile error if it is not part of the set)
+    //
+    template<class Parameter>
+    static constexpr std::size_t index()
+    {
+        static_assert(MMIntern::ParameterIndex<Parameter, P...>::found, "parameter is not part of the parameter set");
+        return MMIntern::ParameterIndex<Parameter, P...>::value;
+    }
+
+    template<class Parameter>
+    static double& get(Row& row)
+    {
+        return std::get<index<Parameter>()>(row);
+    }
+
+    template<class Parameter>
+    static const double& get(const Row& row)
+    {
+        return std::get<index<Parameter>()>(row);
+    }
+};
+
+template<class... P>
+constexpr std::size_t MeteomaticsParameterSet<P...>::size;
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+template<std::size_t N>
+bool MeteomaticsApiClient::readMultiPointTimeSeriesBinRows(MMIntern::MemoryClass& mem, const std::size_t numCoordinates, std::vector<std::vector<std::array<double, N>>>& results, std::vector<std::string>& times, const MeteomaticsRequestControl& control) const
+{
+    // rows of N values copied as a block, the times of further coordinates are copied from the first one
+    const std::size_t end = mem.size();
+    int32_t nCoords = 1;
+    if (numCoordinates != 1)                    // a single coordinate comes without the coordinate count
+    {
+        if (mem.getReadPos() + sizeof(nCoords) > end)
+        {
+            return false;
+        }
+        mem.read(nCoords);
+    }
+    if (nCoords < 0 || static_cast<std::size_t>(nCoords) != numCoordinates)
+    {
+        return false;
+    }
+    results.resize(numCoordinates);
+
+    std::vector<double> firstTimes;
+    for (std::size_t i=0; i<numCoordinates; i++)
+    {
+        if (control.expired())
+        {
+            return false;
+        }
+
+        int32_t nTimes;
+        if (mem.getReadPos() + sizeof(nTimes) > end)
+        {
+            return false;
+        }
+        mem.read(nTimes);
+        if (nTimes < 0)
+        {
+            return false;
+        }
+
+        std::vector<std::array<double, N>>& rows = results[i];
+        rows.resize(nTimes);
+        for (int32_t j=0; j<nTimes; j++)
+        {
+            int32_t nParameter;
+            double t;
+            if (mem.getReadPos() + sizeof(nParameter) + sizeof(t) > end)
+            {
+                return false;
+            }
+            mem.read(nParameter);
+            mem.read(t);
+            if (nParameter < 0 || static_cast<std::size_t>(nParameter) != N || mem.getReadPos() + N * sizeof(double) > end)
+            {
+                return false;
+            }
+
+            if (i == 0)
+            {
+                firstTimes.push_back(t);
+                times.push_back(convDateIso8601(t));
+            }
+            else if (j < static_cast<int32_t>(firstTimes.size()) && firstTimes[j] == t)
+            {
+                times.push_back(times[j]);
+            }
+            else
+            {
+                times.push_back(convDateIso8601(t));
+            }
+
+            std::memcpy(rows[j].data(), mem.mem.data() + mem.getReadPos(), N * sizeof(double));
+            mem.setReadPos(mem.getReadPos() + N * sizeof(double));
+        }
+    }
+    return true;
+}
+
+template<class ParameterSet>
+bool MeteomaticsApiClient::getMultiPointTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<double>& lats, const std::vector<double>& lons, std::vector<std::vector<typename ParameterSet::Row>>& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, MultiPointTimeSeriesQuery);
+    MMIntern::TraceSpan request(httpClient->getTracer(), "getMultiPointTimeSeries", "request");
+
+    result.clear();
+    times.clear();
+    msg.clear();
+
+    MMIntern::TraceSpan build(httpClient->getTracer(), "query build", "client");
+    const std::string queryString = createMultiPointTimeSeriesQuery(startTime, stopTime, timeStep, ParameterSet::fragment(), lats, lons, optionals);
+    build.end();
+
+    int httpReturnCode = 0;
+    MMIntern::MemoryClass mem(500);
+    if (!fetchBinary(queryString, mem, httpReturnCode, msg, control))
+    {
+        return false;
+    }
+
+    MMIntern::TraceSpan decode(httpClient->getTracer(), "decode", "client");
+    if (!readMultiPointTimeSeriesBinRows(mem, lats.size(), result, times, control))
+    {
+        if (control.expired())
+        {
+            msg = control.reason();
+            return false;
+        }
+        std::cout << "Error while reading mem-object." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template<class ParameterSet>
+bool MeteomaticsApiClient::getTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, double lat, double lon, std::vector<typename ParameterSet::Row>& result, std::vector<std::string>& times, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, TimeSeriesQuery);
+
+    result.clear();
+
+    std::vector<std::vector<typename ParameterSet::Row>> tmpRows;
+    if (!getMultiPointTimeSeries<ParameterSet>(startTime, stopTime, timeStep, std::vector<double>(1,lat), std::vector<double>(1,lon), tmpRows, times, msg, optionals, control))
+    {
+        return false;
+    }
+    result.swap(tmpRows[0]);
+    return true;
+}
+
+template<class ParameterSet>
+bool MeteomaticsApiClient::getPoint(const std::string& time, double lat, double lon, typename ParameterSet::Row& result, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, PointQuery);
+
+    std::vector<typename ParameterSet::Row> rows;
+    std::vector<std::string> returnTimes;
+    if (!getTimeSeries<ParameterSet>(time, time, getTimeStepStr(0, 0, 0, 0, 0, 0), lat, lon, rows, returnTimes, msg, optionals, control) || rows.empty())
+    {
+        return false;
+    }
+    result = rows[0];
+    return true;
+}
+
+template<class ParameterSet>
+bool MeteomaticsApiClient::getMultiPoints(const std::string& time, const std::vector<double>& lats, const std::vector<double>& lons, std::vector<typename ParameterSet::Row>& result, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, MultiPointsQuery);
+
+    result.clear();
+
+    std::vector<std::vector<typename ParameterSet::Row>> tmpRows;
+    std::vector<std::string> timeVec;
+    if (!getMultiPointTimeSeries<ParameterSet>(time, time, getTimeStepStr(0, 0, 0, 0, 0, 0), lats, lons, tmpRows, timeVec, msg, optionals, control))
+    {
+        return false;
+    }
+    result.resize(tmpRows.size());
+    for (std::size_t i=0; i<tmpRows.size(); i++)
+    {
+        if (tmpRows[i].empty())
+        {
+            return false;
+        }
+        result[i] = tmpRows[i][0];
+    }
+    return true;
+}
+
+
+#endif /* Meteomatics_ParameterSet_h */
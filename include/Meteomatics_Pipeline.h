@@ -0,0 +1,829 @@
+//
+//  Meteomatics_Pipeline.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_Pipeline_h
+#define Meteomatics_Pipeline_h
+
+#include "Meteomatics_Async.h"
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+
+
+struct MeteomaticsPipelineMetrics
+{
+    MeteomaticsPipelineMetrics();
+
+    std::size_t submitted;
+    std::size_t completed;                      // callbacks run, successful or not
+    std::size_t failed;
+    std::size_t transferQueueDepth;             // queries waiting for an I/O thread
+    std::size_t decodeQueueDepth;               // bodies waiting for a decode thread
+    std::size_t maxTransferQueueDepth;
+    std::size_t maxDecodeQueueDepth;
+    std::size_t resultQueueDepth;               // results of enqueued queries waiting to be popped
+    std::size_t steals;                         // decode tasks taken from another thread's queue
+    double ioUtilization;                       // share of the I/O threads' time spent in transfers
+    double decodeUtilization;                   // share of the decode threads' time spent decoding
+};
+
+// completed query as delivered by MeteomaticsPipeline::popResult
+struct MeteomaticsQueryResult
+{
+    std::size_t queryId = 0;
+    MeteomaticsApiClient::QueryType type = MeteomaticsApiClient::GridQuery;
+    bool success = false;
+    std::string msg;
+    Matrix gridResult;                          // GridQuery: [lat][lon]
+    std::vector<double> latGridPts;
+    std::vector<double> lonGridPts;
+    std::vector<Matrix> result;                 // MultiPointTimeSeriesQuery: [coordinate][time][parameter]
+    std::vector<std::string> times;
+};
+
+namespace MMIntern {
+    template<class T> class BoundedMpmcQueue;
+    class WorkStealingPool;
+}
+
+
+//
+//  METEOMATICS BOUNDED MPMC QUEUE
+//
+//  Lock-free ring for any number of producers and consumers: every cell carries a sequence
+//  number telling whether it is ready to be written or read in the current lap, producers and
+//  consumers claim positions by compare-and-swap on their own counter. Values are moved in and
+//  out, the capacity is rounded up to a power of two.
+//
+template<class T>
+class MMIntern::BoundedMpmcQueue
+{
+public:
+    explicit BoundedMpmcQueue(const std::size_t capacity);
+
+    bool tryPush(T& value);                     // moves from value on success, false if full
+    bool tryPop(T& value);                      // false if empty
+
+    std::size_t capacity() const;
+    std::size_t size() const;                   // approximate while in use
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    static const std::size_t cacheLine = 64;
+
+    std::size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    char padding0[cacheLine];
+    std::atomic<std::size_t> enqueuePos;
+    char padding1[cacheLine];
+    std::atomic<std::size_t> dequeuePos;
+    char padding2[cacheLine];
+};
+
+template<class T>
+MMIntern::BoundedMpmcQueue<T>::BoundedMpmcQueue(const std::size_t capacity)
+: enqueuePos(0)
+, dequeuePos(0)
+{
+    std::size_t n = 2;
+    while (n < capacity)
+    {
+        n *= 2;
+    }
+    mask = n - 1;
+    cells.reset(new Cell[n]);
+    for (std::size_t i=0; i<n; i++)
+    {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<class T>
+bool MMIntern::BoundedMpmcQueue<T>::tryPush(T& value)
+{
+    std::size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;)
+    {
+        cell = &cells[pos & mask];
+        const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+        if (diff == 0)
+        {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;                       // the cell still holds the value of the previous lap
+        }
+        else
+        {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->value = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template<class T>
+bool MMIntern::BoundedMpmcQueue<T>::tryPop(T& value)
+{
+    std::size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;)
+    {
+        cell = &cells[pos & mask];
+        const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+        if (diff == 0)
+        {
+            if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;                       // not written yet in this lap
+        }
+        else
+        {
+            pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+    value = std::move(cell->value);
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+}
+
+template<class T>
+std::size_t MMIntern::BoundedMpmcQueue<T>::capacity() const
+{
+    return mask + 1;
+}
+
+template<class T>
+std::size_t MMIntern::BoundedMpmcQueue<T>::size() const
+{
+    const std::size_t enqueued = enqueuePos.load(std::memory_order_relaxed);
+    const std::size_t dequeued = dequeuePos.load(std::memory_order_relaxed);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+
+//
+//  METEOMATICS WORK STEALING POOL
+//
+//  Every thread owns a task deque, it runs its own tasks newest first and steals the oldest
+//  task of another thread when its deque is empty. push() distributes tasks round robin and
+//  blocks while capacity tasks are queued or running, which throttles the producers.
+//
+class MMIntern::WorkStealingPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    WorkStealingPool(const std::size_t numThreads, const std::size_t capacity);
+    ~WorkStealingPool();                        // runs the remaining tasks
+
+    void push(const Task& task);
+
+    std::size_t size() const;
+    std::size_t depth() const;
+    std::size_t maxDepth() const;
+    std::size_t numSteals() const;
+    double busySeconds() const;
+
+private:
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void run(const std::size_t self);
+    Task take(const std::size_t self);
+
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::vector<std::thread> threads;
+    const std::size_t capacity;
+
+    mutable std::mutex mutex;
+    std::condition_variable wakeCond;
+    std::condition_variable notFullCond;
+    std::size_t queued;                         // tasks in the deques not yet claimed by a thread
+    std::size_t inFlight;                       // queued or running
+    std::size_t maxQueued;
+    bool stop;
+
+    std::atomic<std::size_t> nextQueue;
+    std::atomic<std::size_t> steals;
+    std::atomic<long long> busyNanoseconds;
+};
+
+MMIntern::WorkStealingPool::WorkStealingPool(const std::size_t numThreads, const std::size_t _capacity)
+: capacity(std::max<std::size_t>(1, _capacity))
+, queued(0)
+, inFlight(0)
+, maxQueued(0)
+, stop(false)
+, nextQueue(0)
+, steals(0)
+, busyNanoseconds(0)
+{
+    const std::size_t n = std::max<std::size_t>(1, numThreads);
+    for (std::size_t i=0; i<n; i++)
+    {
+        queues.emplace_back(new TaskQueue());
+    }
+    for (std::size_t i=0; i<n; i++)
+    {
+        threads.emplace_back(&WorkStealingPool::run, this, i);
+    }
+}
+
+MMIntern::WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wakeCond.notify_all();
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+}
+
+void MMIntern::WorkStealingPool::push(const Task& task)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFullCond.wait(lock, [this]() { return inFlight < capacity; });
+        inFlight++;
+    }
+
+    TaskQueue& queue = *queues[nextQueue++ % queues.size()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+        maxQueued = std::max(maxQueued, queued);
+    }
+    wakeCond.notify_one();
+}
+
+MMIntern::WorkStealingPool::Task MMIntern::WorkStealingPool::take(const std::size_t self)
+{
+    // a task has been claimed, so one of the deques holds one
+    for (;;)
+    {
+        {
+            TaskQueue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                Task task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return task;
+            }
+        }
+        for (std::size_t i=1; i<queues.size(); i++)
+        {
+            TaskQueue& victim = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                Task task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                steals++;
+                return task;
+            }
+        }
+        std::this_thread::yield();
+    }
+}
+
+void MMIntern::WorkStealingPool::run(const std::size_t self)
+{
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCond.wait(lock, [this]() { return stop || queued > 0; });
+            if (queued == 0)
+            {
+                return;                         // stopped and drained
+            }
+            queued--;
+        }
+
+        const Task task = take(self);
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        task();
+        busyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            inFlight--;
+        }
+        notFullCond.notify_one();
+    }
+}
+
+std::size_t MMIntern::WorkStealingPool::size() const
+{
+    return threads.size();
+}
+
+std::size_t MMIntern::WorkStealingPool::depth() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return queued;
+}
+
+std::size_t MMIntern::WorkStealingPool::maxDepth() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return maxQueued;
+}
+
+std::size_t MMIntern::WorkStealingPool::numSteals() const
+{
+    return steals;
+}
+
+double MMIntern::WorkStealingPool::busySeconds() const
+{
+    return 1e-9 * static_cast<double>(busyNanoseconds.load());
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METEOMATICS PIPELINE
+//
+//  Two stage query execution: I/O threads only transfer bodies, a work stealing pool decodes
+//  them and runs the callbacks, such that a big decode doesn't hold up the next download.
+//  Both stages are connected by bounded queues: submitting blocks while the transfer queue is
+//  full, and I/O threads block while the decode queue is full. The I/O threads share the
+//  DNS and TLS session caches and the rate limiter of the client, but each transfer runs on an
+//  easy handle of its own, which keeps its connections (libcurl can't share those across threads).
+//  Callbacks are run on decode threads; the results of enqueued queries are instead published
+//  to a lock-free queue for consumer threads.
+//
+class MeteomaticsPipeline : public MeteomaticsApiClient
+{
+public:
+    MeteomaticsPipeline(const std::string& user, const std::string& password, const int timeout_seconds, const std::size_t numIoThreads=4, const std::size_t numDecodeThreads=2, const std::size_t queueCapacity=64, const std::size_t resultQueueCapacity=1024);
+    ~MeteomaticsPipeline();                     // waits for all submitted queries, discarding results nobody popped
+
+    void getGridAsync(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, const std::function<void(MeteomaticsGridResult&)>& onDone, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    void getMultiPointTimeSeriesAsync(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, const std::function<void(MeteomaticsTimeSeriesResult&)>& onDone, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    //
+    // -- same queries, but the results are published to the result queue instead of a callback, returns the query id.
+    //    Decode threads wait while the result queue is full, so it must be drained for the pipeline to make progress.
+    //    Both sides retry the lock-free queue briefly and then sleep on a condition variable until the other side
+    //    made progress, so a consumer blocked in popResult (or a decode thread waiting for room) costs no cpu.
+    //
+    std::size_t enqueueGrid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+    std::size_t enqueueMultiPointTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    //
+    // -- takes the next completed result of an enqueued query, may be called from any number of threads.
+    //    tryPopResult returns false if none is ready, popResult waits and returns false once none is outstanding.
+    //
+    bool tryPopResult(MeteomaticsQueryResult& result);
+    bool popResult(MeteomaticsQueryResult& result);
+
+    //
+    // -- blocks until all submitted queries are done. Enqueued queries are only done once their result is published,
+    //    so with more than resultQueueCapacity of them outstanding, wait() needs a consumer draining the result queue.
+    //
+    void wait();
+
+    MeteomaticsPipelineMetrics metrics() const;
+
+private:
+    typedef std::function<bool(MMIntern::MemoryClass& mem, int http_code)> Decoder;
+
+    struct Job
+    {
+        std::string path;
+        MeteomaticsRequestControl control;
+        Decoder decode;
+        std::chrono::steady_clock::time_point submittedAt;
+    };
+
+    void submit(const std::string& path, const Decoder& decode, const MeteomaticsRequestControl& control);
+    void ioLoop();
+    void finished(const bool success);
+    void publish(MeteomaticsQueryResult& result);
+    bool takeResult(MeteomaticsQueryResult& result);
+    void resultTaken();
+
+    const std::size_t queueCapacity;
+    const std::chrono::steady_clock::time_point started;
+
+    mutable std::mutex mutex;
+    std::condition_variable jobCond;            // jobs available or stopping
+    std::condition_variable notFullCond;
+    std::condition_variable doneCond;
+    std::deque<Job> jobs;
+    std::size_t maxJobs;
+    std::size_t submitted;
+    std::size_t completed;
+    std::size_t failed;
+    bool stop;
+
+    std::atomic<long long> ioBusyNanoseconds;
+    std::atomic<std::size_t> nextQueryId;
+    std::atomic<std::size_t> outstandingResults;    // enqueued, not yet popped
+    MMIntern::BoundedMpmcQueue<MeteomaticsQueryResult> results;
+    std::mutex resultMutex;                     // only taken to sleep on or to wake the result conditions
+    std::condition_variable resultReadyCond;    // a result was published or none is outstanding anymore
+    std::condition_variable resultSpaceCond;    // a result was taken
+    std::atomic<std::size_t> waitingConsumers;
+    std::atomic<std::size_t> waitingProducers;
+    std::atomic<bool> discardResults;           // set by the destructor, nobody pops results anymore
+    std::vector<std::thread> ioThreads;
+    MMIntern::WorkStealingPool* decodePipelinePool;
+
+    static const int resultSpinAttempts = 64;  // failed attempts on the result queue before sleeping
+};
+
+MeteomaticsPipelineMetrics::MeteomaticsPipelineMetrics()
+: submitted(0)
+, completed(0)
+, failed(0)
+, transferQueueDepth(0)
+, decodeQueueDepth(0)
+, maxTransferQueueDepth(0)
+, maxDecodeQueueDepth(0)
+, resultQueueDepth(0)
+, steals(0)
+, ioUtilization(0)
+, decodeUtilization(0)
+{
+}
+
+MeteomaticsPipeline::MeteomaticsPipeline(const std::string& user, const std::string& password, const int timeout_seconds, const std::size_t numIoThreads, const std::size_t numDecodeThreads, const std::size_t _queueCapacity, const std::size_t resultQueueCapacity)
+: MeteomaticsApiClient(user, password, timeout_seconds)
+, queueCapacity(std::max<std::size_t>(1, _queueCapacity))
+, started(std::chrono::steady_clock::now())
+, maxJobs(0)
+, submitted(0)
+, completed(0)
+, failed(0)
+, stop(false)
+, ioBusyNanoseconds(0)
+, nextQueryId(0)
+, outstandingResults(0)
+, results(resultQueueCapacity)
+, waitingConsumers(0)
+, waitingProducers(0)
+, discardResults(false)
+, decodePipelinePool(new MMIntern::WorkStealingPool(numDecodeThreads, _queueCapacity))
+{
+    for (std::size_t i=0; i<std::max<std::size_t>(1, numIoThreads); i++)
+    {
+        ioThreads.emplace_back(&MeteomaticsPipeline::ioLoop, this);
+    }
+}
+
+MeteomaticsPipeline::~MeteomaticsPipeline()
+{
+    // decode threads blocked on a full result queue would never finish their query otherwise
+    {
+        std::lock_guard<std::mutex> lock(resultMutex);
+        discardResults = true;
+    }
+    resultSpaceCond.notify_all();
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    jobCond.notify_all();
+    for (auto& t : ioThreads)
+    {
+        t.join();
+    }
+    delete decodePipelinePool;
+}
+
+void MeteomaticsPipeline::submit(const std::string& path, const Decoder& decode, const MeteomaticsRequestControl& control)
+{
+    Job job;
+    job.path = path;
+    job.control = control;
+    job.decode = decode;
+    job.submittedAt = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    notFullCond.wait(lock, [this]() { return jobs.size() < queueCapacity; });
+    jobs.push_back(std::move(job));
+    maxJobs = std::max(maxJobs, jobs.size());
+    submitted++;
+    lock.unlock();
+    jobCond.notify_one();
+}
+
+void MeteomaticsPipeline::ioLoop()
+{
+    for (;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobCond.wait(lock, [this]() { return stop || !jobs.empty(); });
+            if (jobs.empty())
+            {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        notFullCond.notify_one();
+
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        MeteomaticsTracer* tracer = httpClient->getTracer();
+        if (tracer)
+        {
+            tracer->addSpan("transfer queue", "pipeline", job.submittedAt, start, job.path);
+        }
+        std::shared_ptr<MMIntern::MemoryClass> mem = std::make_shared<MMIntern::MemoryClass>(500);
+        int httpReturnCode = 0;
+        httpClient->requestBinary("api.meteomatics.com", job.path, *mem, dataRequestTimeout, httpReturnCode, job.control);
+        ioBusyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        // blocks while the decoders are behind
+        const Decoder decode = job.decode;
+        const std::chrono::steady_clock::time_point queued = std::chrono::steady_clock::now();
+        decodePipelinePool->push([this, decode, mem, httpReturnCode, tracer, queued]()
+        {
+            if (tracer)
+            {
+                tracer->addSpan("decode queue", "pipeline", queued, std::chrono::steady_clock::now());
+            }
+            finished(decode(*mem, httpReturnCode));
+        });
+    }
+}
+
+void MeteomaticsPipeline::finished(const bool success)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        completed++;
+        failed += success ? 0 : 1;
+    }
+    doneCond.notify_all();
+}
+
+void MeteomaticsPipeline::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCond.wait(lock, [this]() { return completed == submitted; });
+}
+
+void MeteomaticsPipeline::getGridAsync(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, const std::function<void(MeteomaticsGridResult&)>& onDone, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    const std::string queryString = createGridQuery(time, parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, optionals);
+
+    submit(queryString, [this, onDone, control](MMIntern::MemoryClass& mem, int httpReturnCode)
+    {
+        MeteomaticsGridResult r;
+        r.success = decodeGrid(mem, httpReturnCode, r.gridResult, r.latGridPts, r.lonGridPts, r.msg, control);
+        onDone(r);
+        return r.success;
+    }, control);
+}
+
+void MeteomaticsPipeline::getMultiPointTimeSeriesAsync(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, const std::function<void(MeteomaticsTimeSeriesResult&)>& onDone, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    const std::string queryString = createMultiPointTimeSeriesQuery(startTime, stopTime, timeStep, parameters, lats, lons, optionals);
+    const std::size_t numCoordinates = lats.size();
+
+    submit(queryString, [this, onDone, numCoordinates, control](MMIntern::MemoryClass& mem, int httpReturnCode)
+    {
+        MeteomaticsTimeSeriesResult r;
+        r.success = decodeMultiPointTimeSeries(mem, httpReturnCode, numCoordinates, r.result, r.times, r.msg, control);
+        onDone(r);
+        return r.success;
+    }, control);
+}
+
+void MeteomaticsPipeline::publish(MeteomaticsQueryResult& result)
+{
+    // full: retry briefly, then sleep until a consumer took a result or the pipeline is destroyed
+    for (int attempt=0; !results.tryPush(result); attempt++)
+    {
+        if (discardResults.load())
+        {
+            return;
+        }
+        if (attempt < resultSpinAttempts)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(resultMutex);
+        waitingProducers++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool pushed = false;
+        while (!discardResults.load() && !(pushed = results.tryPush(result)))
+        {
+            resultSpaceCond.wait(lock);
+        }
+        waitingProducers--;
+        if (!pushed)
+        {
+            return;
+        }
+        break;
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waitingConsumers.load() > 0)
+    {
+        // a sleeping consumer checks the queue under the mutex, so it can't miss this notification
+        {
+            std::lock_guard<std::mutex> lock(resultMutex);
+        }
+        resultReadyCond.notify_one();
+    }
+}
+
+bool MeteomaticsPipeline::takeResult(MeteomaticsQueryResult& result)
+{
+    if (!results.tryPop(result))
+    {
+        return false;
+    }
+    outstandingResults--;
+    return true;
+}
+
+void MeteomaticsPipeline::resultTaken()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const bool wakeProducer = waitingProducers.load() > 0;
+    const bool wakeConsumers = waitingConsumers.load() > 0 && outstandingResults.load() == 0;
+    if (!wakeProducer && !wakeConsumers)
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(resultMutex);
+    }
+    if (wakeProducer)
+    {
+        resultSpaceCond.notify_one();
+    }
+    if (wakeConsumers)
+    {
+        resultReadyCond.notify_all();           // none outstanding anymore, all waiting consumers return false
+    }
+}
+
+std::size_t MeteomaticsPipeline::enqueueGrid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    const std::string queryString = createGridQuery(time, parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, optionals);
+    const std::size_t queryId = nextQueryId++;
+    outstandingResults++;
+
+    submit(queryString, [this, queryId, control](MMIntern::MemoryClass& mem, int httpReturnCode)
+    {
+        MeteomaticsQueryResult r;
+        r.queryId = queryId;
+        r.type = GridQuery;
+        r.success = decodeGrid(mem, httpReturnCode, r.gridResult, r.latGridPts, r.lonGridPts, r.msg, control);
+        const bool success = r.success;
+        publish(r);
+        return success;
+    }, control);
+    return queryId;
+}
+
+std::size_t MeteomaticsPipeline::enqueueMultiPointTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    const std::string queryString = createMultiPointTimeSeriesQuery(startTime, stopTime, timeStep, parameters, lats, lons, optionals);
+    const std::size_t numCoordinates = lats.size();
+    const std::size_t queryId = nextQueryId++;
+    outstandingResults++;
+
+    submit(queryString, [this, queryId, numCoordinates, control](MMIntern::MemoryClass& mem, int httpReturnCode)
+    {
+        MeteomaticsQueryResult r;
+        r.queryId = queryId;
+        r.type = MultiPointTimeSeriesQuery;
+        r.success = decodeMultiPointTimeSeries(mem, httpReturnCode, numCoordinates, r.result, r.times, r.msg, control);
+        const bool success = r.success;
+        publish(r);
+        return success;
+    }, control);
+    return queryId;
+}
+
+bool MeteomaticsPipeline::tryPopResult(MeteomaticsQueryResult& result)
+{
+    if (!takeResult(result))
+    {
+        return false;
+    }
+    resultTaken();
+    return true;
+}
+
+bool MeteomaticsPipeline::popResult(MeteomaticsQueryResult& result)
+{
+    // retry briefly, then sleep until a result is published or none is outstanding anymore
+    for (int attempt=0; outstandingResults.load() > 0; attempt++)
+    {
+        if (tryPopResult(result))
+        {
+            return true;
+        }
+        if (attempt < resultSpinAttempts)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        bool taken = false;
+        {
+            std::unique_lock<std::mutex> lock(resultMutex);
+            waitingConsumers++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while (outstandingResults.load() > 0 && !(taken = takeResult(result)))
+            {
+                resultReadyCond.wait(lock);
+            }
+            waitingConsumers--;
+        }
+        if (taken)
+        {
+            resultTaken();
+        }
+        return taken;
+    }
+    return false;
+}
+
+MeteomaticsPipelineMetrics MeteomaticsPipeline::metrics() const
+{
+    MeteomaticsPipelineMetrics m;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        m.submitted = submitted;
+        m.completed = completed;
+        m.failed = failed;
+        m.transferQueueDepth = jobs.size();
+        m.maxTransferQueueDepth = maxJobs;
+    }
+    m.decodeQueueDepth = decodePipelinePool->depth();
+    m.maxDecodeQueueDepth = decodePipelinePool->maxDepth();
+    m.steals = decodePipelinePool->numSteals();
+    m.resultQueueDepth = results.size();
+
+    const double elapsed = std::max(1e-9, std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+    m.ioUtilization = 1e-9 * static_cast<double>(ioBusyNanoseconds.load()) / (elapsed * ioThreads.size());
+    m.decodeUtilization = decodePipelinePool->busySeconds() / (elapsed * decodePipelinePool->size());
+    return m;
+}
+
+
+#endif /* Meteomatics_Pipeline_h */
@@ -0,0 +1,185 @@
+//
+//  Meteomatics_PointBatcher.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_PointBatcher_h
+#define Meteomatics_PointBatcher_h
+
+#include "Meteomatics_ApiClient.h"
+
+#include <map>
+
+
+//
+//  METEOMATICS POINT BATCHER
+//
+//  Opt-in front end for getPoint: requests of concurrent callers with the same time,
+//  parameters and optionals are gathered for a short window (or until the batch is full)
+//  and sent as a single getMultiPoints request. Each caller blocks until its row arrived.
+//  The first caller of a batch waits for the window and issues the request, so no extra
+//  thread is needed.
+//
+class MeteomaticsPointBatcher
+{
+public:
+    MeteomaticsPointBatcher(const MeteomaticsApiClient& client, const int windowMilliseconds=5, const std::size_t maxBatchSize=1000);
+
+    //
+    // -- same semantics as MeteomaticsApiClient::getPoint, may be called from many threads
+    //
+    bool getPoint(const std::string& time, const std::vector<std::string>& parameters, double lat, double lon, std::vector<double>& result, std::string& msg, const std::vector<std::string>& optionals={});
+
+    std::size_t numPointRequests() const;
+    std::size_t numBatchRequests() const;
+
+private:
+    struct Batch
+    {
+        Batch();
+
+        std::vector<double> lats;
+        std::vector<double> lons;
+        Matrix result;
+        std::string msg;
+        bool full;
+        bool done;
+        bool success;
+        std::condition_variable cond;
+    };
+
+    static std::string createBatchKey(const std::string& time, const std::vector<std::string>& parameters, const std::vector<std::string>& optionals);
+
+    const MeteomaticsApiClient& client;
+    const std::chrono::milliseconds window;
+    const std::size_t maxBatchSize;
+
+    std::map<std::string, std::shared_ptr<Batch>> openBatches;
+    std::size_t pointRequests;
+    std::size_t batchRequests;
+    mutable std::mutex mutex;
+};
+
+MeteomaticsPointBatcher::Batch::Batch()
+: full(false)
+, done(false)
+, success(false)
+{
+}
+
+MeteomaticsPointBatcher::MeteomaticsPointBatcher(const MeteomaticsApiClient& _client, const int windowMilliseconds, const std::size_t _maxBatchSize)
+: client(_client)
+, window(windowMilliseconds)
+, maxBatchSize(std::max<std::size_t>(1, _maxBatchSize))
+, pointRequests(0)
+, batchRequests(0)
+{
+}
+
+std::string MeteomaticsPointBatcher::createBatchKey(const std::string& time, const std::vector<std::string>& parameters, const std::vector<std::string>& optionals)
+{
+    std::string key = time;
+    key += '/';
+    for (const auto& p : parameters)
+    {
+        key += p;
+        key += ',';
+    }
+    key += '?';
+    for (const auto& o : optionals)
+    {
+        key += o;
+        key += '&';
+    }
+    return key;
+}
+
+bool MeteomaticsPointBatcher::getPoint(const std::string& time, const std::vector<std::string>& parameters, double lat, double lon, std::vector<double>& result, std::string& msg, const std::vector<std::string>& optionals)
+{
+    result.clear();
+    msg.clear();
+
+    const std::string key = createBatchKey(time, parameters, optionals);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    pointRequests++;
+
+    std::shared_ptr<Batch> batch;
+    bool leader = false;
+    std::map<std::string, std::shared_ptr<Batch>>::iterator it = openBatches.find(key);
+    if (it == openBatches.end())
+    {
+        batch = std::make_shared<Batch>();
+        openBatches[key] = batch;
+        leader = true;
+    }
+    else
+    {
+        batch = it->second;
+    }
+
+    const std::size_t index = batch->lats.size();
+    batch->lats.push_back(lat);
+    batch->lons.push_back(lon);
+    if (batch->lats.size() >= maxBatchSize)
+    {
+        batch->full = true;             // later callers open a new batch
+        openBatches.erase(key);
+        batch->cond.notify_all();
+    }
+
+    if (leader)
+    {
+        const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + window;
+        batch->cond.wait_until(lock, deadline, [&batch]() { return batch->full; });
+
+        std::map<std::string, std::shared_ptr<Batch>>::iterator open = openBatches.find(key);
+        if (open != openBatches.end() && open->second == batch)
+        {
+            openBatches.erase(open);
+        }
+        batchRequests++;
+        lock.unlock();
+
+        // batch is closed now, its coordinates are not modified any more
+        std::string batchMsg;
+        Matrix batchResult;
+        const bool success = client.getMultiPoints(time, parameters, batch->lats, batch->lons, batchResult, batchMsg, optionals);
+
+        lock.lock();
+        batch->result.swap(batchResult);
+        batch->msg.swap(batchMsg);
+        batch->success = success && batch->result.size() == batch->lats.size();
+        batch->done = true;
+        batch->cond.notify_all();
+    }
+    else
+    {
+        batch->cond.wait(lock, [&batch]() { return batch->done; });
+    }
+
+    msg = batch->msg;
+    if (!batch->success)
+    {
+        return false;
+    }
+    result = batch->result[index];
+    return true;
+}
+
+std::size_t MeteomaticsPointBatcher::numPointRequests() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pointRequests;
+}
+
+std::size_t MeteomaticsPointBatcher::numBatchRequests() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return batchRequests;
+}
+
+
+#endif /* Meteomatics_PointBatcher_h */
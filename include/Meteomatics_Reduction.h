@@ -0,0 +1,773 @@
+//
+//  Meteomatics_Reduction.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_Reduction_h
+#define Meteomatics_Reduction_h
+
+#include "Meteomatics_ApiClient.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+
+namespace MMIntern {
+    class QuantileSketch;
+    template<class Stored> struct ReductionValue;
+}
+
+
+//
+//  METEOMATICS QUANTILE SKETCH
+//
+//  Percentiles of a stream of values in bounded memory. Values are collected exactly up to the capacity;
+//  a full level is sorted and every other value is promoted to the next level with twice the weight
+//  (alternating which half is kept), so n values take about capacity * log2(n / capacity) doubles.
+//
+class MMIntern::QuantileSketch
+{
+public:
+    QuantileSketch(const std::size_t capacity=256);
+
+    void add(const double value);
+    std::size_t count() const;
+    double quantile(const double q) const;      // q in [0,1], exact (interpolated) while nothing was compacted, NaN if empty
+
+private:
+    void compact(const std::size_t level);
+
+    std::size_t capacity;
+    std::size_t numValues;
+    bool keepOdd;
+    std::vector<std::vector<double>> levels;    // a value on level l stands for 2^l values
+};
+
+MMIntern::QuantileSketch::QuantileSketch(const std::size_t _capacity)
+: capacity(std::max<std::size_t>(_capacity, 2))
+, numValues(0)
+, keepOdd(false)
+{
+}
+
+void MMIntern::QuantileSketch::add(const double value)
+{
+    if (levels.empty())
+    {
+        levels.resize(1);
+    }
+    levels[0].push_back(value);
+    numValues++;
+    if (levels[0].size() > capacity)
+    {
+        compact(0);
+    }
+}
+
+std::size_t MMIntern::QuantileSketch::count() const
+{
+    return numValues;
+}
+
+void MMIntern::QuantileSketch::compact(const std::size_t level)
+{
+    if (levels.size() == level + 1)
+    {
+        levels.resize(level + 2);
+    }
+    std::vector<double>& buffer = levels[level];
+    std::vector<double>& next = levels[level + 1];
+    std::sort(buffer.begin(), buffer.end());
+
+    const std::size_t paired = buffer.size() & ~static_cast<std::size_t>(1);   // an odd last value stays on its level
+    for (std::size_t k=keepOdd ? 1 : 0; k<paired; k+=2)
+    {
+        next.push_back(buffer[k]);
+    }
+    keepOdd = !keepOdd;
+    buffer.erase(buffer.begin(), buffer.begin() + paired);
+
+    if (next.size() > capacity)
+    {
+        compact(level + 1);
+    }
+}
+
+double MMIntern::QuantileSketch::quantile(const double q) const
+{
+    if (numValues == 0)
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    const double clamped = std::min(1.0, std::max(0.0, q));
+
+    if (levels.size() == 1)
+    {
+        std::vector<double> sorted(levels[0]);
+        std::sort(sorted.begin(), sorted.end());
+        const double rank = clamped * (sorted.size() - 1);
+        const std::size_t lower = static_cast<std::size_t>(rank);
+        const std::size_t upper = std::min(lower + 1, sorted.size() - 1);
+        return sorted[lower] + (rank - lower) * (sorted[upper] - sorted[lower]);
+    }
+
+    std::vector<std::pair<double, double>> weighted;
+    double totalWeight = 0;
+    for (std::size_t l=0; l<levels.size(); l++)
+    {
+        const double weight = std::ldexp(1.0, static_cast<int>(l));
+        for (const double value : levels[l])
+        {
+            weighted.push_back(std::make_pair(value, weight));
+        }
+        totalWeight += weight * levels[l].size();
+    }
+    std::sort(weighted.begin(), weighted.end());
+
+    const double target = clamped * (totalWeight - 1);
+    double cumulative = 0;
+    for (const auto& entry : weighted)
+    {
+        cumulative += entry.second;
+        if (cumulative > target)
+        {
+            return entry.first;
+        }
+    }
+    return weighted.back().first;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METEOMATICS REDUCTION VALUE
+//
+//  Loads of the values as stored in a response body (unaligned, double or float as sent), one value
+//  or two widened into an SSE2 register.
+//
+template<>
+struct MMIntern::ReductionValue<double>
+{
+    static double load(const char* p)
+    {
+        double value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+#if defined(__SSE2__)
+    static __m128d load2(const char* p)
+    {
+        return _mm_loadu_pd(reinterpret_cast<const double*>(p));
+    }
+#endif
+};
+
+template<>
+struct MMIntern::ReductionValue<float>
+{
+    static double load(const char* p)
+    {
+        float value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+#if defined(__SSE2__)
+    static __m128d load2(const char* p)
+    {
+        return _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(p))));
+    }
+#endif
+};
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+//
+//  METEOMATICS REDUCTION
+//
+//  Aggregates computed while a response is decoded, instead of the result matrices. Attached to a
+//  query with the MeteomaticsApiClient getters taking a reduction, the operators are evaluated on the
+//  values as they are read from the received body (SSE2, two values per iteration), only the
+//  aggregates are kept. Missing values (NaN) are skipped and counted.
+//
+//  Time series are aggregated per coordinate, parameter and time bucket (e.g. daily min/max/mean per
+//  station), a grid into one aggregate over the whole box (e.g. the area mean).
+//
+struct MeteomaticsAggregate
+{
+    MeteomaticsAggregate();
+
+    std::size_t coordinate;                     // index of the coordinate in the query, 0 for a grid
+    std::size_t parameter;                      // index of the parameter in the query
+    double startTime;                           // unix time: start of the bucket, first time without buckets, valid time of a grid
+    std::size_t numValues;                      // values aggregated
+    std::size_t numMissing;                     // NaN values skipped
+    std::vector<double> values;                 // one per operator, in the order they were added
+};
+
+MeteomaticsAggregate::MeteomaticsAggregate()
+: coordinate(0)
+, parameter(0)
+, startTime(0)
+, numValues(0)
+, numMissing(0)
+{
+}
+
+
+class MeteomaticsReduction
+{
+public:
+    enum Operator
+    {
+        Min,
+        Max,
+        Sum,
+        Mean,
+        AreaMean,                               // grid: mean weighted by cos(lat) of the rows, time series: same as Mean
+        Count,
+        Percentile,                             // estimated with a quantile sketch, exact for up to 256 values per aggregate
+        CountAbove,                             // number of values > threshold
+        CountBelow                              // number of values < threshold
+    };
+
+    MeteomaticsReduction();
+
+    //
+    // -- appends an operator, argument is the percentile (0..100) or the threshold
+    //
+    MeteomaticsReduction& add(const Operator op, const double argument=0);
+
+    //
+    // -- aggregates time series in buckets of bucketSeconds starting offsetSeconds after 1970-01-01T00:00:00Z
+    //    (e.g. 86400 for daily), 0 aggregates the whole time range (default)
+    //
+    MeteomaticsReduction& setTimeBuckets(const double bucketSeconds, const double offsetSeconds=0);
+
+    std::size_t numOperators() const;
+
+    //
+    // -- the aggregates of the last query, by coordinate, bucket and parameter
+    //
+    const std::vector<MeteomaticsAggregate>& results() const;
+
+private:
+    friend class MeteomaticsApiClient;
+
+    void start();                               // drops the results of a previous query
+    void beginGroup(const std::size_t numLanes);
+    template<class Stored>
+    void accumulateRow(const char* values, const std::size_t n, const double weight);
+    void accumulateSeries(const char* values);
+    void finishGroup(const std::size_t coordinate, const double startTime);
+    double bucketOf(const double unixTime) const;
+
+    std::vector<Operator> operators;
+    std::vector<double> arguments;
+    std::vector<double> thresholds;             // of the CountAbove and CountBelow operators
+    std::vector<char> above;
+    bool percentiles;
+    double bucketSeconds;
+    double bucketOffset;
+
+    std::vector<MeteomaticsAggregate> aggregates;
+
+    // totals of the aggregates being accumulated, one lane per parameter of a time series (one for a grid)
+    std::size_t numLanes;
+    std::size_t numSeen;                        // values per lane so far
+    std::vector<double> laneMin;
+    std::vector<double> laneMax;
+    std::vector<double> laneSum;
+    std::vector<double> laneCount;
+    std::vector<double> laneThresholdCounts;    // [threshold][lane]
+    std::vector<MMIntern::QuantileSketch> laneSketches;
+    double weightedSum;                         // of the grid rows, for AreaMean
+    double weight;
+};
+
+
+MeteomaticsReduction::MeteomaticsReduction()
+: percentiles(false)
+, bucketSeconds(0)
+, bucketOffset(0)
+, numLanes(0)
+, numSeen(0)
+, weightedSum(0)
+, weight(0)
+{
+}
+
+MeteomaticsReduction& MeteomaticsReduction::add(const Operator op, const double argument)
+{
+    operators.push_back(op);
+    arguments.push_back(argument);
+    if (op == CountAbove || op == CountBelow)
+    {
+        thresholds.push_back(argument);
+        above.push_back(op == CountAbove);
+    }
+    percentiles = percentiles || op == Percentile;
+    return *this;
+}
+
+MeteomaticsReduction& MeteomaticsReduction::setTimeBuckets(const double _bucketSeconds, const double offsetSeconds)
+{
+    bucketSeconds = std::max(0.0, _bucketSeconds);
+    bucketOffset = offsetSeconds;
+    return *this;
+}
+
+std::size_t MeteomaticsReduction::numOperators() const
+{
+    return operators.size();
+}
+
+const std::vector<MeteomaticsAggregate>& MeteomaticsReduction::results() const
+{
+    return aggregates;
+}
+
+void MeteomaticsReduction::start()
+{
+    aggregates.clear();
+    numLanes = 0;
+}
+
+void MeteomaticsReduction::beginGroup(const std::size_t _numLanes)
+{
+    numLanes = _numLanes;
+    numSeen = 0;
+    laneMin.assign(numLanes, std::numeric_limits<double>::infinity());
+    laneMax.assign(numLanes, -std::numeric_limits<double>::infinity());
+    laneSum.assign(numLanes, 0.0);
+    laneCount.assign(numLanes, 0.0);
+    laneThresholdCounts.assign(thresholds.size() * numLanes, 0.0);
+    laneSketches.assign(percentiles ? numLanes : 0, MMIntern::QuantileSketch());
+    weightedSum = 0;
+    weight = 0;
+}
+
+template<class Stored>
+void MeteomaticsReduction::accumulateRow(const char* values, const std::size_t n, const double rowWeight)
+{
+    // values of one grid row into lane 0
+    double rowMin = laneMin[0];
+    double rowMax = laneMax[0];
+    double rowSum = 0;
+    double rowCount = 0;
+    double* counts = laneThresholdCounts.data();
+    std::size_t j = 0;
+#if defined(__SSE2__)
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d inf = _mm_set1_pd(std::numeric_limits<double>::infinity());
+    const __m128d negInf = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+    __m128d vMin = inf;
+    __m128d vMax = negInf;
+    __m128d vSum = _mm_setzero_pd();
+    __m128d vCount = _mm_setzero_pd();
+    for (; j + 2 <= n; j += 2)
+    {
+        const __m128d v = MMIntern::ReductionValue<Stored>::load2(values + j * sizeof(Stored));
+        const __m128d valid = _mm_cmpord_pd(v, v);
+        vMin = _mm_min_pd(vMin, _mm_or_pd(_mm_and_pd(valid, v), _mm_andnot_pd(valid, inf)));
+        vMax = _mm_max_pd(vMax, _mm_or_pd(_mm_and_pd(valid, v), _mm_andnot_pd(valid, negInf)));
+        vSum = _mm_add_pd(vSum, _mm_and_pd(valid, v));
+        vCount = _mm_add_pd(vCount, _mm_and_pd(valid, one));
+        for (std::size_t k=0; k<thresholds.size(); k++)
+        {
+            const __m128d threshold = _mm_set1_pd(thresholds[k]);
+            const int bits = _mm_movemask_pd(above[k] ? _mm_cmpgt_pd(v, threshold) : _mm_cmplt_pd(v, threshold));
+            counts[k] += (bits & 1) + (bits >> 1);
+        }
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, vMin);
+    rowMin = std::min(rowMin, std::min(lanes[0], lanes[1]));
+    _mm_storeu_pd(lanes, vMax);
+    rowMax = std::max(rowMax, std::max(lanes[0], lanes[1]));
+    _mm_storeu_pd(lanes, vSum);
+    rowSum = lanes[0] + lanes[1];
+    _mm_storeu_pd(lanes, vCount);
+    rowCount = lanes[0] + lanes[1];
+#endif
+    for (; j < n; j++)
+    {
+        const double v = MMIntern::ReductionValue<Stored>::load(values + j * sizeof(Stored));
+        if (std::isnan(v))
+        {
+            continue;
+        }
+        rowMin = std::min(rowMin, v);
+        rowMax = std::max(rowMax, v);
+        rowSum += v;
+        rowCount += 1;
+        for (std::size_t k=0; k<thresholds.size(); k++)
+        {
+            counts[k] += above[k] ? v > thresholds[k] : v < thresholds[k];
+        }
+    }
+    if (percentiles)
+    {
+        for (j=0; j<n; j++)
+        {
+            const double v = MMIntern::ReductionValue<Stored>::load(values + j * sizeof(Stored));
+            if (!std::isnan(v))
+            {
+                laneSketches[0].add(v);
+            }
+        }
+    }
+
+    laneMin[0] = rowMin;
+    laneMax[0] = rowMax;
+    laneSum[0] += rowSum;
+    laneCount[0] += rowCount;
+    weightedSum += rowWeight * rowSum;
+    weight += rowWeight * rowCount;
+    numSeen += n;
+}
+
+void MeteomaticsReduction::accumulateSeries(const char* values)
+{
+    // the values of all parameters at one time, lane by lane
+    std::size_t p = 0;
+#if defined(__SSE2__)
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d inf = _mm_set1_pd(std::numeric_limits<double>::infinity());
+    const __m128d negInf = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+    for (; p + 2 <= numLanes; p += 2)
+    {
+        const __m128d v = MMIntern::ReductionValue<double>::load2(values + p * sizeof(double));
+        const __m128d valid = _mm_cmpord_pd(v, v);
+        _mm_storeu_pd(&laneMin[p], _mm_min_pd(_mm_loadu_pd(&laneMin[p]), _mm_or_pd(_mm_and_pd(valid, v), _mm_andnot_pd(valid, inf))));
+        _mm_storeu_pd(&laneMax[p], _mm_max_pd(_mm_loadu_pd(&laneMax[p]), _mm_or_pd(_mm_and_pd(valid, v), _mm_andnot_pd(valid, negInf))));
+        _mm_storeu_pd(&laneSum[p], _mm_add_pd(_mm_loadu_pd(&laneSum[p]), _mm_and_pd(valid, v)));
+        _mm_storeu_pd(&laneCount[p], _mm_add_pd(_mm_loadu_pd(&laneCount[p]), _mm_and_pd(valid, one)));
+        for (std::size_t k=0; k<thresholds.size(); k++)
+        {
+            const __m128d threshold = _mm_set1_pd(thresholds[k]);
+            const __m128d hit = above[k] ? _mm_cmpgt_pd(v, threshold) : _mm_cmplt_pd(v, threshold);
+            double* counts = &laneThresholdCounts[k * numLanes + p];
+            _mm_storeu_pd(counts, _mm_add_pd(_mm_loadu_pd(counts), _mm_and_pd(hit, one)));
+        }
+    }
+#endif
+    for (; p < numLanes; p++)
+    {
+        const double v = MMIntern::ReductionValue<double>::load(values + p * sizeof(double));
+        if (std::isnan(v))
+        {
+            continue;
+        }
+        laneMin[p] = std::min(laneMin[p], v);
+        laneMax[p] = std::max(laneMax[p], v);
+        laneSum[p] += v;
+        laneCount[p] += 1;
+        for (std::size_t k=0; k<thresholds.size(); k++)
+        {
+            laneThresholdCounts[k * numLanes + p] += above[k] ? v > thresholds[k] : v < thresholds[k];
+        }
+    }
+    if (percentiles)
+    {
+        for (p=0; p<numLanes; p++)
+        {
+            const double v = MMIntern::ReductionValue<double>::load(values + p * sizeof(double));
+            if (!std::isnan(v))
+            {
+                laneSketches[p].add(v);
+            }
+        }
+    }
+    numSeen++;
+}
+
+void MeteomaticsReduction::finishGroup(const std::size_t coordinate, const double startTime)
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    for (std::size_t p=0; p<numLanes; p++)
+    {
+        MeteomaticsAggregate aggregate;
+        aggregate.coordinate = coordinate;
+        aggregate.parameter = p;
+        aggregate.startTime = startTime;
+        aggregate.numValues = static_cast<std::size_t>(laneCount[p]);
+        aggregate.numMissing = numSeen - aggregate.numValues;
+        aggregate.values.reserve(operators.size());
+
+        const bool empty = aggregate.numValues == 0;
+        std::size_t k = 0;
+        for (std::size_t i=0; i<operators.size(); i++)
+        {
+            switch (operators[i])
+            {
+                case Min:
+                    aggregate.values.push_back(empty ? nan : laneMin[p]);
+                    break;
+                case Max:
+                    aggregate.values.push_back(empty ? nan : laneMax[p]);
+                    break;
+                case Sum:
+                    aggregate.values.push_back(laneSum[p]);
+                    break;
+                case Mean:
+                    aggregate.values.push_back(empty ? nan : laneSum[p] / laneCount[p]);
+                    break;
+                case AreaMean:
+                    if (weight > 0)
+                    {
+                        aggregate.values.push_back(weightedSum / weight);
+                    }
+                    else
+                    {
+                        aggregate.values.push_back(empty ? nan : laneSum[p] / laneCount[p]);
+                    }
+                    break;
+                case Count:
+                    aggregate.values.push_back(laneCount[p]);
+                    break;
+                case Percentile:
+                    aggregate.values.push_back(laneSketches[p].quantile(arguments[i] / 100.0));
+                    break;
+                case CountAbove:
+                case CountBelow:
+                    aggregate.values.push_back(laneThresholdCounts[k * numLanes + p]);
+                    k++;
+                    break;
+            }
+        }
+        aggregates.push_back(aggregate);
+    }
+}
+
+double MeteomaticsReduction::bucketOf(const double unixTime) const
+{
+    if (bucketSeconds <= 0)
+    {
+        return 0;
+    }
+    return std::floor((unixTime - bucketOffset) / bucketSeconds) * bucketSeconds + bucketOffset;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+bool MeteomaticsApiClient::reduceGridMBG2(MMIntern::MemoryClass& mem, MeteomaticsReduction& reduction, const MeteomaticsRequestControl& control) const
+{
+    int32_t precision;
+    double forecastDateUx;
+    std::vector<double> lats, lons;
+    if (!readMBG2Header(mem, precision, forecastDateUx, lats, lons))
+    {
+        return false;
+    }
+
+    const std::size_t valueSize = precision == sizeof(float) ? sizeof(float) : sizeof(double);
+    const std::size_t rowBytes = lons.size() * valueSize;
+    if (mem.getReadPos() + lats.size() * rowBytes > mem.size())
+    {
+        return false;
+    }
+
+    constexpr double degreesToRadians = 3.14159265358979323846 / 180.0;
+    const char* values = mem.mem.data() + mem.getReadPos();
+    reduction.beginGroup(1);
+    for (std::size_t i=0; i<lats.size(); i++)
+    {
+        if ((i & 63) == 0 && control.expired())
+        {
+            return false;
+        }
+        const double rowWeight = std::cos(lats[i] * degreesToRadians);
+        if (valueSize == sizeof(float))
+        {
+            reduction.accumulateRow<float>(values + i * rowBytes, lons.size(), rowWeight);
+        }
+        else
+        {
+            reduction.accumulateRow<double>(values + i * rowBytes, lons.size(), rowWeight);
+        }
+    }
+    reduction.finishGroup(0, forecastDateUx);
+    mem.setReadPos(mem.getReadPos() + lats.size() * rowBytes);
+    return true;
+}
+
+bool MeteomaticsApiClient::reduceMultiPointTimeSeriesBin(MMIntern::MemoryClass& mem, const std::size_t numCoordinates, MeteomaticsReduction& reduction, const MeteomaticsRequestControl& control) const
+{
+    const std::size_t end = mem.size();
+    int32_t nCoords = 1;
+    if (numCoordinates != 1)                    // a single coordinate comes without the coordinate count
+    {
+        if (mem.getReadPos() + sizeof(nCoords) > end)
+        {
+            return false;
+        }
+        mem.read(nCoords);
+    }
+    if (nCoords < 0 || static_cast<std::size_t>(nCoords) != numCoordinates)
+    {
+        return false;
+    }
+
+    for (std::size_t i=0; i<numCoordinates; i++)
+    {
+        if (control.expired())
+        {
+            return false;
+        }
+
+        int32_t nTimes;
+        if (mem.getReadPos() + sizeof(nTimes) > end)
+        {
+            return false;
+        }
+        mem.read(nTimes);
+
+        bool open = false;
+        double bucket = 0;
+        double startTime = 0;
+        for (int32_t j=0; j<nTimes; j++)
+        {
+            int32_t nParameter;
+            double date;
+            if (mem.getReadPos() + sizeof(nParameter) + sizeof(date) > end)
+            {
+                return false;
+            }
+            mem.read(nParameter);
+            mem.read(date);
+            if (nParameter < 0 || (open && static_cast<std::size_t>(nParameter) != reduction.numLanes) || mem.getReadPos() + nParameter * sizeof(double) > end)
+            {
+                return false;
+            }
+
+            // matlab datenum to unix time, a new bucket closes the aggregates of the previous one
+            const double unixTime = (date - 719529.0) * 86400.0;
+            const double timeBucket = reduction.bucketOf(unixTime);
+            if (!open || timeBucket != bucket)
+            {
+                if (open)
+                {
+                    reduction.finishGroup(i, startTime);
+                }
+                reduction.beginGroup(static_cast<std::size_t>(nParameter));
+                open = true;
+                bucket = timeBucket;
+                startTime = reduction.bucketSeconds > 0 ? timeBucket : unixTime;
+            }
+            reduction.accumulateSeries(mem.mem.data() + mem.getReadPos());
+            mem.setReadPos(mem.getReadPos() + nParameter * sizeof(double));
+        }
+        if (open)
+        {
+            reduction.finishGroup(i, startTime);
+        }
+    }
+    return true;
+}
+
+bool MeteomaticsApiClient::getGrid(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, MeteomaticsReduction& reduction, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, GridQuery);
+    MMIntern::TraceSpan request(httpClient->getTracer(), "getGrid", "request");
+
+    reduction.start();
+    msg.clear();
+
+    const std::string queryString = createGridQuery(time, parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, optionals);
+
+    int httpReturnCode = 0;
+    MMIntern::MemoryClass mem(500);
+    if (!fetchBinary(queryString, mem, httpReturnCode, msg, control))
+    {
+        return false;
+    }
+
+    MMIntern::TraceSpan decode(httpClient->getTracer(), "decode", "client");
+    if (!reduceGridMBG2(mem, reduction, control))
+    {
+        if (control.expired())
+        {
+            msg = control.reason();
+            return false;
+        }
+        std::cout << "Error while reading grid and matrix MBG2 binary..." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool MeteomaticsApiClient::getMultiPointTimeSeries(const std::string& startTime, const std::string& stopTime, const std::string& timeStep, const std::vector<std::string>& parameters, const std::vector<double>& lats, const std::vector<double>& lons, MeteomaticsReduction& reduction, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control) const
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, MultiPointTimeSeriesQuery);
+    MMIntern::TraceSpan request(httpClient->getTracer(), "getMultiPointTimeSeries", "request");
+
+    reduction.start();
+    msg.clear();
+
+    const std::string queryString = createMultiPointTimeSeriesQuery(startTime, stopTime, timeStep, parameters, lats, lons, optionals);
+
+    int httpReturnCode = 0;
+    MMIntern::MemoryClass mem(500);
+    if (!fetchBinary(queryString, mem, httpReturnCode, msg, control))
+    {
+        return false;
+    }
+
+    MMIntern::TraceSpan decode(httpClient->getTracer(), "decode", "client");
+    if (!reduceMultiPointTimeSeriesBin(mem, lats.size(), reduction, control))
+    {
+        if (control.expired())
+        {
+            msg = control.reason();
+            return false;
+        }
+        std::cout << "Error while reading mem-object." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+#endif /* Meteomatics_Reduction_h */
@@ -0,0 +1,813 @@
+//
+//  Meteomatics_SharedGridCache.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_SharedGridCache_h
+#define Meteomatics_SharedGridCache_h
+
+#include "Meteomatics_ApiClient.h"
+
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace MMIntern {
+    struct SharedGridSegmentHeader;
+    struct SharedGridSlot;
+    class SharedGridSegmentLock;
+}
+
+//
+// -- zero-copy view of a cached grid in the shared segment, values are [lat][lon] row-major.
+//    The slot may be reused for another grid once the cache is full: stillValid() tells whether
+//    everything read through the view so far belongs to the grid it was obtained for.
+//
+class MeteomaticsSharedGridView
+{
+public:
+    MeteomaticsSharedGridView();
+
+    std::size_t numLat;
+    std::size_t numLon;
+    const double* latGridPts;
+    const double* lonGridPts;
+    const double* values;
+
+    double value(const std::size_t latIndex, const std::size_t lonIndex) const;
+    bool stillValid() const;
+
+private:
+    const MMIntern::SharedGridSlot* slot;
+    uint64_t sequence;
+
+    friend class MeteomaticsSharedGridCache;
+};
+
+
+//
+//  METEOMATICS SHARED GRID CACHE
+//
+//  Caches decoded grids of getGrid in a POSIX shared memory segment, such that all processes on
+//  a host using the same segment name fetch every grid only once. The segment holds a fixed number
+//  of slots of fixed capacity, every slot guarded by a sequence lock: readers never block, writers
+//  (claiming a slot, publishing a grid) are serialized by a robust process-shared mutex. A process
+//  missing a grid claims a slot for it, other processes wanting the same grid wait for it to be
+//  published. Claims of processes that died or took longer than the timeout are taken over.
+//  Grids larger than the slot capacity are fetched but not cached. The first process creates the
+//  segment, the layout of later processes is taken from the segment. Linux/POSIX only.
+//
+class MeteomaticsSharedGridCache : protected MeteomaticsApiClient
+{
+public:
+    MeteomaticsSharedGridCache(const std::string& user, const std::string& password, const int timeout_seconds, const std::string& segmentName="/meteomatics_grids", const std::size_t numSlots=32, const std::size_t maxGridBytes=4*1024*1024);
+    ~MeteomaticsSharedGridCache();
+
+    bool isOpen() const;                        // false if the segment could not be created or opened, getGrid then always fetches
+
+    // the uncached getters and the helpers of the client stay available, the client itself isn't: code holding
+    // a MeteomaticsApiClient& could not tell that it bypasses the cache
+    using MeteomaticsApiClient::getGrid;
+    using MeteomaticsApiClient::getIsoTimeStr;
+    using MeteomaticsApiClient::getTimeStepStr;
+    using MeteomaticsApiClient::getCurrentYear;
+    using MeteomaticsApiClient::getCurrentMonth;
+    using MeteomaticsApiClient::getCurrentDay;
+    using MeteomaticsApiClient::getTomorrow;
+    using MeteomaticsApiClient::getTomorrowsMonth;
+    using MeteomaticsApiClient::getTomorrowsYear;
+    using MeteomaticsApiClient::setRateLimiter;
+    using MeteomaticsApiClient::setTransportArchive;
+    using MeteomaticsApiClient::setTracer;
+    using MeteomaticsApiClient::warmUp;
+    using MeteomaticsApiClient::getMemoryStats;
+    using MeteomaticsApiClient::resetMemoryStats;
+    using MeteomaticsApiClient::memoryStatsAvailable;
+
+    //
+    // -- same semantics as MeteomaticsApiClient::getGrid, copies the grid out of the shared segment
+    //
+    bool getGridCached(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nrGridPts_Lat, const int nrGridPts_Lon, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    //
+    // -- zero-copy access, fetches the grid first if no process has it yet. Fails for grids too large for a slot.
+    //
+    bool getGridView(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nrGridPts_Lat, const int nrGridPts_Lon, MeteomaticsSharedGridView& view, std::string& msg, const std::vector<std::string>& optionals={}, const MeteomaticsRequestControl& control=MeteomaticsRequestControl());
+
+    std::size_t numHits() const;                // found in the segment
+    std::size_t numFetched() const;             // fetched by this process
+    std::size_t numWaited() const;              // published by another process while waiting for it
+
+    //
+    // -- removes the segment name, processes having it open keep using it
+    //
+    static bool remove(const std::string& segmentName="/meteomatics_grids");
+
+private:
+    enum SlotState
+    {
+        Empty = 0,
+        Fetching,
+        Ready
+    };
+
+    struct SlotInfo
+    {
+        uint32_t state;
+        int32_t fetcherPid;
+        double fetchStarted;
+        uint64_t keyHash;
+        bool keyMatches;
+        std::size_t numLat;
+        std::size_t numLon;
+    };
+
+    enum LookupResult
+    {
+        Found,
+        Claimed,                                // this process has to fetch
+        Uncacheable                             // no slot available or key too long
+    };
+
+    bool open(const std::string& segmentName, const std::size_t numSlots, const std::size_t maxGridBytes);
+
+    static uint64_t hashKey(const std::string& key);
+    static double unixNow();
+
+    MMIntern::SharedGridSlot& slotAt(const std::size_t index) const;
+    double* slotData(const std::size_t index) const;
+    bool readSlotInfo(const std::size_t index, const std::string& key, const uint64_t keyHash, SlotInfo& info) const;
+    bool copySlot(const std::size_t index, const std::string& key, const uint64_t keyHash, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts) const;
+    bool viewSlot(const std::size_t index, const std::string& key, const uint64_t keyHash, MeteomaticsSharedGridView& view) const;
+
+    // finds the slot of key, claims one if none has it, and waits while another process is fetching it
+    LookupResult lookup(const std::string& key, const uint64_t keyHash, const MeteomaticsRequestControl& control, std::size_t& index);
+    bool publish(const std::size_t index, const Matrix& gridResult, const std::vector<double>& latGridPts, const std::vector<double>& lonGridPts);
+    void release(const std::size_t index);
+
+    // slots left half written by a process that died while writing are emptied, called with the lock held
+    void repairSlots() const;
+    // waits for a slot being written, repairing it if its writer died
+    void waitForWriter(const std::size_t spins) const;
+
+    // fetches or finds the grid, index is valid when the grid has been published
+    bool acquire(const std::string& queryString, const uint64_t keyHash, const MeteomaticsRequestControl& control, std::size_t& index, bool& cached, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg);
+
+    MMIntern::SharedGridSegmentHeader* header;
+    std::size_t segmentBytes;
+
+    std::size_t hits;
+    std::size_t fetched;
+    std::size_t waited;
+
+    static const std::size_t maxKeyLength = 1024;
+    static const uint32_t segmentMagic = 0x4D4D4743;    // "MMGC"
+    static const uint32_t segmentVersion = 1;
+};
+
+
+struct MMIntern::SharedGridSegmentHeader
+{
+    std::atomic<uint32_t> magic;                // set once the creator has initialised the segment
+    uint32_t version;
+    uint64_t numSlots;
+    uint64_t slotBytes;                         // data capacity of a slot: lats, lons and values
+    uint64_t slotsOffset;
+    uint64_t dataOffset;
+    std::atomic<uint64_t> useCounter;
+    pthread_mutex_t mutex;                      // serializes writers
+};
+
+struct MMIntern::SharedGridSlot
+{
+    std::atomic<uint64_t> sequence;             // odd while being written
+    std::atomic<uint64_t> lastUse;
+    uint32_t state;
+    int32_t fetcherPid;
+    double fetchStarted;
+    uint64_t keyHash;
+    uint32_t keyLength;
+    uint32_t numLat;
+    uint32_t numLon;
+    char key[1024];
+};
+
+
+class MMIntern::SharedGridSegmentLock
+{
+public:
+    explicit SharedGridSegmentLock(SharedGridSegmentHeader* _header)
+    : header(_header)
+    , ownerDied(false)
+    {
+        if (pthread_mutex_lock(&header->mutex) == EOWNERDEAD)
+        {
+            pthread_mutex_consistent(&header->mutex);
+            ownerDied = true;
+        }
+    }
+    ~SharedGridSegmentLock()
+    {
+        pthread_mutex_unlock(&header->mutex);
+    }
+
+    // the previous owner died holding the lock, possibly in the middle of writing a slot
+    bool previousOwnerDied() const
+    {
+        return ownerDied;
+    }
+
+private:
+    SharedGridSegmentHeader* header;
+    bool ownerDied;
+};
+
+
+MeteomaticsSharedGridView::MeteomaticsSharedGridView()
+: numLat(0)
+, numLon(0)
+, latGridPts(nullptr)
+, lonGridPts(nullptr)
+, values(nullptr)
+, slot(nullptr)
+, sequence(0)
+{
+}
+
+double MeteomaticsSharedGridView::value(const std::size_t latIndex, const std::size_t lonIndex) const
+{
+    return values[latIndex * numLon + lonIndex];
+}
+
+bool MeteomaticsSharedGridView::stillValid() const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot != nullptr && slot->sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+
+MeteomaticsSharedGridCache::MeteomaticsSharedGridCache(const std::string& user, const std::string& password, const int timeout_seconds, const std::string& segmentName, const std::size_t numSlots, const std::size_t maxGridBytes)
+: MeteomaticsApiClient(user, password, timeout_seconds)
+, header(nullptr)
+, segmentBytes(0)
+, hits(0)
+, fetched(0)
+, waited(0)
+{
+    if (!open(segmentName, numSlots, maxGridBytes))
+    {
+        std::cout << "Shared grid cache " << segmentName << " not available, grids are fetched by every process." << std::endl;
+    }
+}
+
+MeteomaticsSharedGridCache::~MeteomaticsSharedGridCache()
+{
+    if (header != nullptr)
+    {
+        munmap(header, segmentBytes);
+    }
+}
+
+bool MeteomaticsSharedGridCache::open(const std::string& segmentName, const std::size_t numSlots, const std::size_t maxGridBytes)
+{
+    const std::size_t align = 64;
+    const std::size_t slotsOffset = (sizeof(MMIntern::SharedGridSegmentHeader) + align - 1) / align * align;
+    const std::size_t slotBytes = (std::max<std::size_t>(maxGridBytes, 1024) + align - 1) / align * align;
+    const std::size_t dataOffset = (slotsOffset + numSlots * sizeof(MMIntern::SharedGridSlot) + align - 1) / align * align;
+
+    bool creator = true;
+    int fd = shm_open(segmentName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST)
+    {
+        creator = false;
+        fd = shm_open(segmentName.c_str(), O_RDWR, 0600);
+    }
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    if (creator)
+    {
+        segmentBytes = dataOffset + std::max<std::size_t>(1, numSlots) * slotBytes;
+        if (ftruncate(fd, static_cast<off_t>(segmentBytes)) != 0)
+        {
+            close(fd);
+            shm_unlink(segmentName.c_str());
+            return false;
+        }
+    }
+    else
+    {
+        // the creator may still be sizing the segment
+        struct stat st;
+        for (int attempt=0; attempt<1000; attempt++)
+        {
+            if (fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(MMIntern::SharedGridSegmentHeader))
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        segmentBytes = static_cast<std::size_t>(st.st_size);
+        if (segmentBytes < sizeof(MMIntern::SharedGridSegmentHeader))
+        {
+            close(fd);
+            return false;
+        }
+    }
+
+    void* mapped = mmap(nullptr, segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return false;
+    }
+    MMIntern::SharedGridSegmentHeader* h = static_cast<MMIntern::SharedGridSegmentHeader*>(mapped);
+
+    if (creator)
+    {
+        // the new segment is zero filled: all slots Empty with an even sequence
+        h->version = segmentVersion;
+        h->numSlots = std::max<std::size_t>(1, numSlots);
+        h->slotBytes = slotBytes;
+        h->slotsOffset = slotsOffset;
+        h->dataOffset = dataOffset;
+        h->useCounter.store(0);
+
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&h->mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+
+        h->magic.store(segmentMagic, std::memory_order_release);
+    }
+    else
+    {
+        for (int attempt=0; attempt<1000 && h->magic.load(std::memory_order_acquire) != segmentMagic; attempt++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (h->magic.load(std::memory_order_acquire) != segmentMagic || h->version != segmentVersion
+            || h->dataOffset + h->numSlots * h->slotBytes > segmentBytes)
+        {
+            std::cout << "Shared grid cache " << segmentName << " has an incompatible layout." << std::endl;
+            munmap(mapped, segmentBytes);
+            return false;
+        }
+    }
+
+    header = h;
+    return true;
+}
+
+bool MeteomaticsSharedGridCache::isOpen() const
+{
+    return header != nullptr;
+}
+
+bool MeteomaticsSharedGridCache::remove(const std::string& segmentName)
+{
+    return shm_unlink(segmentName.c_str()) == 0;
+}
+
+uint64_t MeteomaticsSharedGridCache::hashKey(const std::string& key)
+{
+    uint64_t hash = 14695981039346656037ull;    // FNV-1a
+    for (const char c : key)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+double MeteomaticsSharedGridCache::unixNow()
+{
+    return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+MMIntern::SharedGridSlot& MeteomaticsSharedGridCache::slotAt(const std::size_t index) const
+{
+    char* base = reinterpret_cast<char*>(header);
+    return reinterpret_cast<MMIntern::SharedGridSlot*>(base + header->slotsOffset)[index];
+}
+
+double* MeteomaticsSharedGridCache::slotData(const std::size_t index) const
+{
+    char* base = reinterpret_cast<char*>(header);
+    return reinterpret_cast<double*>(base + header->dataOffset + index * header->slotBytes);
+}
+
+bool MeteomaticsSharedGridCache::readSlotInfo(const std::size_t index, const std::string& key, const uint64_t keyHash, SlotInfo& info) const
+{
+    const MMIntern::SharedGridSlot& slot = slotAt(index);
+    for (std::size_t spins=1;; spins++)
+    {
+        const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence & 1)
+        {
+            waitForWriter(spins);
+            continue;
+        }
+        info.state = slot.state;
+        info.fetcherPid = slot.fetcherPid;
+        info.fetchStarted = slot.fetchStarted;
+        info.keyHash = slot.keyHash;
+        info.numLat = slot.numLat;
+        info.numLon = slot.numLon;
+        info.keyMatches = info.state != Empty && slot.keyHash == keyHash && slot.keyLength == key.size() && std::memcmp(slot.key, key.data(), key.size()) == 0;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == sequence)
+        {
+            return info.keyMatches;
+        }
+    }
+}
+
+bool MeteomaticsSharedGridCache::copySlot(const std::size_t index, const std::string& key, const uint64_t keyHash, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts) const
+{
+    const MMIntern::SharedGridSlot& slot = slotAt(index);
+    const double* data = slotData(index);
+    for (std::size_t spins=1;; spins++)
+    {
+        const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence & 1)
+        {
+            waitForWriter(spins);
+            continue;
+        }
+        if (slot.state != Ready || slot.keyHash != keyHash || slot.keyLength != key.size() || std::memcmp(slot.key, key.data(), key.size()) != 0)
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == sequence)
+            {
+                return false;
+            }
+            continue;
+        }
+
+        const std::size_t numLat = slot.numLat;
+        const std::size_t numLon = slot.numLon;
+        if ((numLat + numLon + numLat * numLon) * sizeof(double) <= header->slotBytes)
+        {
+            latGridPts.assign(data, data + numLat);
+            lonGridPts.assign(data + numLat, data + numLat + numLon);
+            gridResult.resize(numLat);
+            const double* values = data + numLat + numLon;
+            for (std::size_t i=0; i<numLat; i++)
+            {
+                gridResult[i].assign(values + i * numLon, values + (i + 1) * numLon);
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == sequence)
+        {
+            return true;
+        }
+    }
+}
+
+bool MeteomaticsSharedGridCache::viewSlot(const std::size_t index, const std::string& key, const uint64_t keyHash, MeteomaticsSharedGridView& view) const
+{
+    SlotInfo info;
+    const MMIntern::SharedGridSlot& slot = slotAt(index);
+    for (;;)
+    {
+        const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (!readSlotInfo(index, key, keyHash, info) || info.state != Ready)
+        {
+            return false;
+        }
+        const double* data = slotData(index);
+        view.numLat = info.numLat;
+        view.numLon = info.numLon;
+        view.latGridPts = data;
+        view.lonGridPts = data + info.numLat;
+        view.values = data + info.numLat + info.numLon;
+        view.slot = &slot;
+        view.sequence = sequence;
+        if (view.stillValid())
+        {
+            return true;
+        }
+    }
+}
+
+MeteomaticsSharedGridCache::LookupResult MeteomaticsSharedGridCache::lookup(const std::string& key, const uint64_t keyHash, const MeteomaticsRequestControl& control, std::size_t& index)
+{
+    if (key.size() > maxKeyLength)
+    {
+        return Uncacheable;
+    }
+
+    bool waitedForOther = false;
+    for (;;)
+    {
+        // lock-free: ready or being fetched by another process
+        bool fetching = false;
+        for (std::size_t i=0; i<header->numSlots; i++)
+        {
+            SlotInfo info;
+            if (readSlotInfo(i, key, keyHash, info))
+            {
+                index = i;
+                if (info.state == Ready)
+                {
+                    slotAt(i).lastUse.store(++header->useCounter, std::memory_order_relaxed);
+                    if (waitedForOther)
+                    {
+                        waited++;
+                    }
+                    else
+                    {
+                        hits++;
+                    }
+                    return Found;
+                }
+                const bool fetcherAlive = kill(info.fetcherPid, 0) == 0 || errno != ESRCH;
+                fetching = fetcherAlive && unixNow() - info.fetchStarted < dataRequestTimeout + 10;
+                break;
+            }
+        }
+        if (fetching)
+        {
+            if (control.expired())
+            {
+                return Uncacheable;
+            }
+            waitedForOther = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
+
+        // claim a slot: the stale claim of the key, an empty slot or the least recently used grid
+        MMIntern::SharedGridSegmentLock lock(header);
+        if (lock.previousOwnerDied())
+        {
+            repairSlots();
+        }
+        std::size_t victim = header->numSlots;
+        uint64_t oldestUse = std::numeric_limits<uint64_t>::max();
+        bool raced = false;
+        for (std::size_t i=0; i<header->numSlots; i++)
+        {
+            const MMIntern::SharedGridSlot& slot = slotAt(i);
+            SlotInfo info;
+            if (readSlotInfo(i, key, keyHash, info))
+            {
+                const bool fetcherAlive = kill(info.fetcherPid, 0) == 0 || errno != ESRCH;
+                if (info.state == Ready || (fetcherAlive && unixNow() - info.fetchStarted < dataRequestTimeout + 10))
+                {
+                    raced = true;               // published or claimed meanwhile
+                    break;
+                }
+                victim = i;
+                oldestUse = 0;
+                continue;
+            }
+            if (info.state == Empty && oldestUse > 0)
+            {
+                victim = i;
+                oldestUse = 0;
+            }
+            else if (info.state == Ready && slot.lastUse.load(std::memory_order_relaxed) < oldestUse)
+            {
+                victim = i;
+                oldestUse = slot.lastUse.load(std::memory_order_relaxed);
+            }
+        }
+        if (raced)
+        {
+            continue;
+        }
+        if (victim == header->numSlots)
+        {
+            return Uncacheable;                 // all slots being fetched
+        }
+
+        MMIntern::SharedGridSlot& slot = slotAt(victim);
+        slot.sequence.fetch_add(1, std::memory_order_acq_rel);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.state = Fetching;
+        slot.fetcherPid = static_cast<int32_t>(getpid());
+        slot.fetchStarted = unixNow();
+        slot.keyHash = keyHash;
+        slot.keyLength = static_cast<uint32_t>(key.size());
+        std::memcpy(slot.key, key.data(), key.size());
+        slot.numLat = 0;
+        slot.numLon = 0;
+        slot.sequence.fetch_add(1, std::memory_order_release);
+        index = victim;
+        return Claimed;
+    }
+}
+
+bool MeteomaticsSharedGridCache::publish(const std::size_t index, const Matrix& gridResult, const std::vector<double>& latGridPts, const std::vector<double>& lonGridPts)
+{
+    const std::size_t numLat = latGridPts.size();
+    const std::size_t numLon = lonGridPts.size();
+    bool fits = gridResult.size() == numLat && (numLat + numLon + numLat * numLon) * sizeof(double) <= header->slotBytes;
+    for (std::size_t i=0; fits && i<numLat; i++)
+    {
+        fits = gridResult[i].size() == numLon;
+    }
+    if (!fits)
+    {
+        release(index);
+        return false;
+    }
+
+    MMIntern::SharedGridSegmentLock lock(header);
+    if (lock.previousOwnerDied())
+    {
+        repairSlots();
+    }
+    MMIntern::SharedGridSlot& slot = slotAt(index);
+    if (slot.state != Fetching || slot.fetcherPid != static_cast<int32_t>(getpid()))
+    {
+        return false;                           // taken over meanwhile
+    }
+
+    slot.sequence.fetch_add(1, std::memory_order_acq_rel);
+    std::atomic_thread_fence(std::memory_order_release);
+    double* data = slotData(index);
+    std::memcpy(data, latGridPts.data(), numLat * sizeof(double));
+    std::memcpy(data + numLat, lonGridPts.data(), numLon * sizeof(double));
+    for (std::size_t i=0; i<numLat; i++)
+    {
+        std::memcpy(data + numLat + numLon + i * numLon, gridResult[i].data(), numLon * sizeof(double));
+    }
+    slot.numLat = static_cast<uint32_t>(numLat);
+    slot.numLon = static_cast<uint32_t>(numLon);
+    slot.state = Ready;
+    slot.lastUse.store(++header->useCounter, std::memory_order_relaxed);
+    slot.sequence.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+void MeteomaticsSharedGridCache::release(const std::size_t index)
+{
+    MMIntern::SharedGridSegmentLock lock(header);
+    if (lock.previousOwnerDied())
+    {
+        repairSlots();
+    }
+    MMIntern::SharedGridSlot& slot = slotAt(index);
+    if (slot.state != Fetching || slot.fetcherPid != static_cast<int32_t>(getpid()))
+    {
+        return;
+    }
+    slot.sequence.fetch_add(1, std::memory_order_acq_rel);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.state = Empty;
+    slot.sequence.fetch_add(1, std::memory_order_release);
+}
+
+void MeteomaticsSharedGridCache::repairSlots() const
+{
+    for (std::size_t i=0; i<header->numSlots; i++)
+    {
+        MMIntern::SharedGridSlot& slot = slotAt(i);
+        if (slot.sequence.load(std::memory_order_relaxed) & 1)
+        {
+            slot.state = Empty;
+            slot.sequence.fetch_add(1, std::memory_order_release);
+        }
+    }
+}
+
+void MeteomaticsSharedGridCache::waitForWriter(const std::size_t spins) const
+{
+    if (spins % 100000 != 0)
+    {
+        std::this_thread::yield();
+        return;
+    }
+    // a writer holds the lock while writing, taking it either waits for the writer or finds it dead
+    MMIntern::SharedGridSegmentLock lock(header);
+    if (lock.previousOwnerDied())
+    {
+        repairSlots();
+    }
+}
+
+bool MeteomaticsSharedGridCache::acquire(const std::string& queryString, const uint64_t keyHash, const MeteomaticsRequestControl& control, std::size_t& index, bool& cached, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg)
+{
+    cached = false;
+    const LookupResult result = header != nullptr ? lookup(queryString, keyHash, control, index) : Uncacheable;
+    if (result == Found)
+    {
+        cached = true;
+        return true;
+    }
+
+    int httpReturnCode = 0;
+    MMIntern::MemoryClass mem(500);
+    const bool success = fetchBinary(queryString, mem, httpReturnCode, msg, control) && decodeGrid(mem, httpReturnCode, gridResult, latGridPts, lonGridPts, msg, control);
+    fetched++;
+
+    if (result == Claimed)
+    {
+        if (success)
+        {
+            cached = publish(index, gridResult, latGridPts, lonGridPts);
+        }
+        else
+        {
+            release(index);
+        }
+    }
+    return success;
+}
+
+bool MeteomaticsSharedGridCache::getGridCached(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, Matrix& gridResult, std::vector<double>& latGridPts, std::vector<double>& lonGridPts, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    MMIntern::AllocationScope allocationScope(memoryStats, GridQuery);
+
+    gridResult.clear();
+    latGridPts.clear();
+    lonGridPts.clear();
+    msg.clear();
+
+    const std::string queryString = createGridQuery(time, parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, optionals);
+    const uint64_t keyHash = hashKey(queryString);
+
+    for (;;)
+    {
+        std::size_t index = 0;
+        bool cached = false;
+        if (!acquire(queryString, keyHash, control, index, cached, gridResult, latGridPts, lonGridPts, msg))
+        {
+            return false;
+        }
+        if (!gridResult.empty() || !cached)
+        {
+            return true;                        // fetched by this process
+        }
+        if (copySlot(index, queryString, keyHash, gridResult, latGridPts, lonGridPts))
+        {
+            return true;
+        }
+        // evicted between finding and copying, look again
+    }
+}
+
+bool MeteomaticsSharedGridCache::getGridView(const std::string& time, const std::string& parameter, const double lat_N, const double lon_W, const double lat_S, const double lon_E, const int nGridPts_Lat, const int nGridPts_Lon, MeteomaticsSharedGridView& view, std::string& msg, const std::vector<std::string>& optionals, const MeteomaticsRequestControl& control)
+{
+    msg.clear();
+    view = MeteomaticsSharedGridView();
+
+    const std::string queryString = createGridQuery(time, parameter, lat_N, lon_W, lat_S, lon_E, nGridPts_Lat, nGridPts_Lon, optionals);
+    const uint64_t keyHash = hashKey(queryString);
+
+    for (;;)
+    {
+        std::size_t index = 0;
+        bool cached = false;
+        Matrix gridResult;
+        std::vector<double> latGridPts, lonGridPts;
+        if (!acquire(queryString, keyHash, control, index, cached, gridResult, latGridPts, lonGridPts, msg))
+        {
+            return false;
+        }
+        if (!cached)
+        {
+            msg = "grid too large for the shared grid cache or no slot available";
+            return false;
+        }
+        if (viewSlot(index, queryString, keyHash, view))
+        {
+            return true;
+        }
+    }
+}
+
+std::size_t MeteomaticsSharedGridCache::numHits() const
+{
+    return hits;
+}
+
+std::size_t MeteomaticsSharedGridCache::numFetched() const
+{
+    return fetched;
+}
+
+std::size_t MeteomaticsSharedGridCache::numWaited() const
+{
+    return waited;
+}
+
+
+#endif /* Meteomatics_SharedGridCache_h */
@@ -0,0 +1,414 @@
+//
+//  Meteomatics_TimeInterpolation.h
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+#ifndef Meteomatics_TimeInterpolation_h
+#define Meteomatics_TimeInterpolation_h
+
+#include "Meteomatics_ApiClient.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+
+//
+//  METEOMATICS TIME INTERPOLATION
+//
+//  Answers queries at arbitrary timestamps between the steps of a cached time series
+//  (as returned by getTimeSeries) or of a stack of grids (getGrid at several times).
+//  State parameters (e.g. t_2m:C) are interpolated linearly. Accumulated parameters
+//  (e.g. precip_1h:mm, whose value at t covers the period [t-1h, t]) are interpolated
+//  on their running sum, such that the result is again an accumulation over the period.
+//  Which columns are accumulated is either given explicitly by their periods, or derived
+//  from the parameter names (see accumulationPeriodSeconds).
+//
+class MeteomaticsTimeInterpolator
+{
+public:
+    MeteomaticsTimeInterpolator();
+
+    //
+    // -- cache a single point time series, result [time][parameter] as returned by getTimeSeries
+    //
+    bool setTimeSeries(const std::vector<std::string>& times, const Matrix& result, const std::vector<std::string>& parameters, std::string& msg);
+    bool setTimeSeries(const std::vector<std::string>& times, const Matrix& result, const std::vector<long>& accumulationPeriods, std::string& msg);   // [parameter] in seconds, 0 for state parameters
+
+    //
+    // -- cache a stack of grids of one parameter, grids[time] [lat][lon] as returned by getGrid
+    //
+    bool setGridStack(const std::vector<std::string>& times, const std::vector<Matrix>& grids, const std::string& parameter, std::string& msg);
+    bool setGridStack(const std::vector<std::string>& times, const std::vector<Matrix>& grids, const long accumulationPeriod, std::string& msg);
+
+    //
+    // -- interpolate for all query times at once, result [query][parameter] (series) or [query][lat*lon] (grids)
+    //
+    bool interpolate(const std::vector<std::string>& queryTimes, Matrix& result, std::string& msg) const;
+
+    //
+    // -- interpolate a single grid of the cached stack, gridResult [lat][lon]
+    //
+    bool interpolateGrid(const std::string& queryTime, Matrix& gridResult, std::string& msg) const;
+
+    //
+    // -- accumulation period in seconds parsed from the parameter name (e.g. 3600 for precip_1h:mm), 0 for state parameters.
+    //    Only names of the accumulating families (precip_, sunshine_duration_, evaporation_, fresh_snow_, snow_melt_ and the
+    //    radiation energies) count, extremes over a period such as t_max_2m_24h:C or precip_max_... are state parameters.
+    //
+    static long accumulationPeriodSeconds(const std::string& parameter);
+
+private:
+    static bool parseSteps(const std::vector<std::string>& times, std::vector<double>& newStepTimes, std::string& msg);
+    void setFrames(std::vector<double>& newStepTimes, std::vector<double>& newValues, std::vector<long>& newPeriods, std::size_t rows, std::size_t cols);
+    void buildAccumulations();
+    void locate(double t, std::size_t& k, double& w) const;
+    double cumulativeAt(std::size_t column, double t) const;
+
+    std::vector<double> stepTimes;              // unix seconds, strictly increasing
+    std::vector<double> values;                 // [step][column]
+    std::vector<double> cumulative;             // [step][column], running sums of accumulated columns
+    std::vector<long> periods;                  // [column], 0 for state parameters
+    std::size_t numColumns;
+    std::size_t gridRows;
+    std::size_t gridCols;
+    bool uniformSteps;
+};
+
+MeteomaticsTimeInterpolator::MeteomaticsTimeInterpolator()
+: numColumns(0)
+, gridRows(0)
+, gridCols(0)
+, uniformSteps(false)
+{
+}
+
+long MeteomaticsTimeInterpolator::accumulationPeriodSeconds(const std::string& parameter)
+{
+    // accumulated parameters carry their period as "<name>_<n><unit>:<unit>", e.g. precip_24h:mm or sunshine_duration_1h:min
+    static const char* const families[] = {"precip_", "sunshine_duration_", "evaporation_", "fresh_snow_", "snow_melt_", "global_rad_", "direct_rad_", "diffuse_rad_"};
+    const std::size_t colon = parameter.find(':');
+    const std::string name = parameter.substr(0, colon);
+    bool accumulating = false;
+    for (const char* family : families)
+    {
+        accumulating = accumulating || name.compare(0, std::strlen(family), family) == 0;
+    }
+    if (!accumulating || name.find("_max") != std::string::npos || name.find("_min_") != std::string::npos)
+    {
+        return 0;
+    }
+    const std::size_t underscore = name.rfind('_');
+    if (underscore == std::string::npos || underscore+1 >= name.size())
+    {
+        return 0;
+    }
+
+    const char* begin = name.c_str() + underscore + 1;
+    char* end = nullptr;
+    const long n = std::strtol(begin, &end, 10);
+    if (end == begin || n <= 0)
+    {
+        return 0;
+    }
+
+    const std::string unit(end);
+    if (unit == "min")
+        return n * 60;
+    if (unit == "h")
+        return n * 3600;
+    if (unit == "d")
+        return n * 86400;
+    return 0;
+}
+
+bool MeteomaticsTimeInterpolator::parseSteps(const std::vector<std::string>& times, std::vector<double>& newStepTimes, std::string& msg)
+{
+    if (times.size() < 2)
+    {
+        msg = "At least two time steps are needed for time interpolation.";
+        return false;
+    }
+    newStepTimes.resize(times.size());
+    for (std::size_t i=0; i<times.size(); i++)
+    {
+        if (!MMIntern::parseIsoTime(times[i], newStepTimes[i]))
+        {
+            msg = "Cannot parse time " + times[i];
+            return false;
+        }
+        if (i > 0 && newStepTimes[i] <= newStepTimes[i-1])
+        {
+            msg = "Time steps must be strictly increasing.";
+            return false;
+        }
+    }
+    return true;
+}
+
+void MeteomaticsTimeInterpolator::setFrames(std::vector<double>& newStepTimes, std::vector<double>& newValues, std::vector<long>& newPeriods, std::size_t rows, std::size_t cols)
+{
+    // only called with validated frames, a failed set keeps the previous ones
+    stepTimes.swap(newStepTimes);
+    values.swap(newValues);
+    periods.swap(newPeriods);
+    numColumns = periods.size();
+    gridRows = rows;
+    gridCols = cols;
+
+    const double step = stepTimes[1] - stepTimes[0];
+    uniformSteps = true;
+    for (std::size_t i=2; i<stepTimes.size() && uniformSteps; i++)
+    {
+        uniformSteps = (stepTimes[i] - stepTimes[i-1]) == step;
+    }
+    buildAccumulations();
+}
+
+bool MeteomaticsTimeInterpolator::setTimeSeries(const std::vector<std::string>& times, const Matrix& result, const std::vector<std::string>& parameters, std::string& msg)
+{
+    std::vector<long> accumulationPeriods(parameters.size());
+    for (std::size_t c=0; c<parameters.size(); c++)
+    {
+        accumulationPeriods[c] = accumulationPeriodSeconds(parameters[c]);
+    }
+    return setTimeSeries(times, result, accumulationPeriods, msg);
+}
+
+bool MeteomaticsTimeInterpolator::setTimeSeries(const std::vector<std::string>& times, const Matrix& result, const std::vector<long>& accumulationPeriods, std::string& msg)
+{
+    msg.clear();
+    std::vector<double> newStepTimes;
+    if (!parseSteps(times, newStepTimes, msg))
+    {
+        return false;
+    }
+    if (result.size() != times.size())
+    {
+        msg = "Time series has a different number of rows than times.";
+        return false;
+    }
+    const std::size_t columns = accumulationPeriods.size();
+    std::vector<double> newValues;
+    newValues.reserve(times.size() * columns);
+    for (const auto& row : result)
+    {
+        if (row.size() != columns)
+        {
+            msg = "Time series has a different number of columns than parameters.";
+            return false;
+        }
+        newValues.insert(newValues.end(), row.begin(), row.end());
+    }
+
+    std::vector<long> newPeriods(columns);
+    for (std::size_t c=0; c<columns; c++)
+    {
+        newPeriods[c] = std::max(0L, accumulationPeriods[c]);
+    }
+    setFrames(newStepTimes, newValues, newPeriods, 0, 0);
+    return true;
+}
+
+bool MeteomaticsTimeInterpolator::setGridStack(const std::vector<std::string>& times, const std::vector<Matrix>& grids, const std::string& parameter, std::string& msg)
+{
+    return setGridStack(times, grids, accumulationPeriodSeconds(parameter), msg);
+}
+
+bool MeteomaticsTimeInterpolator::setGridStack(const std::vector<std::string>& times, const std::vector<Matrix>& grids, const long accumulationPeriod, std::string& msg)
+{
+    msg.clear();
+    if (grids.size() != times.size() || grids.empty() || grids[0].empty() || grids[0][0].empty())
+    {
+        msg = "Grid stack needs one non-empty grid per time.";
+        return false;
+    }
+    std::vector<double> newStepTimes;
+    if (!parseSteps(times, newStepTimes, msg))
+    {
+        return false;
+    }
+    const std::size_t rows = grids[0].size();
+    const std::size_t cols = grids[0][0].size();
+    std::vector<double> newValues;
+    newValues.reserve(times.size() * rows * cols);
+    for (const auto& grid : grids)
+    {
+        if (grid.size() != rows)
+        {
+            msg = "All grids of the stack must have the same shape.";
+            return false;
+        }
+        for (const auto& row : grid)
+        {
+            if (row.size() != cols)
+            {
+                msg = "All grids of the stack must have the same shape.";
+                return false;
+            }
+            newValues.insert(newValues.end(), row.begin(), row.end());
+        }
+    }
+
+    std::vector<long> newPeriods(rows*cols, std::max(0L, accumulationPeriod));
+    setFrames(newStepTimes, newValues, newPeriods, rows, cols);
+    return true;
+}
+
+void MeteomaticsTimeInterpolator::buildAccumulations()
+{
+    // running sum C(t) of the accumulation rate, the value of step k being spread
+    // uniformly over its period: rate = v_k / period on (t_{k-1}, t_k]
+    cumulative.assign(values.size(), 0.0);
+    for (std::size_t k=1; k<stepTimes.size(); k++)
+    {
+        const double dt = stepTimes[k] - stepTimes[k-1];
+        const double* v = values.data() + k*numColumns;
+        const double* prev = cumulative.data() + (k-1)*numColumns;
+        double* cum = cumulative.data() + k*numColumns;
+        for (std::size_t c=0; c<numColumns; c++)
+        {
+            cum[c] = periods[c] > 0 ? prev[c] + v[c] * dt / static_cast<double>(periods[c]) : 0.0;
+        }
+    }
+}
+
+void MeteomaticsTimeInterpolator::locate(double t, std::size_t& k, double& w) const
+{
+    // returns the interval [k, k+1] containing t and the weight of k+1
+    const std::size_t last = stepTimes.size()-1;
+    if (uniformSteps)
+    {
+        const double f = (t - stepTimes[0]) / (stepTimes[1] - stepTimes[0]);
+        k = std::min(static_cast<std::size_t>(std::max(f, 0.0)), last-1);
+    }
+    else
+    {
+        k = static_cast<std::size_t>(std::upper_bound(stepTimes.begin(), stepTimes.end(), t) - stepTimes.begin());
+        k = std::min(k > 0 ? k-1 : 0, last-1);
+    }
+    w = (t - stepTimes[k]) / (stepTimes[k+1] - stepTimes[k]);
+}
+
+double MeteomaticsTimeInterpolator::cumulativeAt(std::size_t column, double t) const
+{
+    if (t < stepTimes[0])
+    {
+        // before the first step the rate of the first step is assumed
+        return (t - stepTimes[0]) * values[column] / static_cast<double>(periods[column]);
+    }
+    std::size_t k;
+    double w;
+    locate(t, k, w);
+    return (1.0-w) * cumulative[k*numColumns + column] + w * cumulative[(k+1)*numColumns + column];
+}
+
+bool MeteomaticsTimeInterpolator::interpolate(const std::vector<std::string>& queryTimes, Matrix& result, std::string& msg) const
+{
+    msg.clear();
+    result.clear();
+    if (stepTimes.size() < 2 || values.size() != stepTimes.size() * numColumns || periods.size() != numColumns)
+    {
+        msg = "No time series cached.";
+        return false;
+    }
+
+    std::vector<double> t(queryTimes.size());
+    for (std::size_t q=0; q<queryTimes.size(); q++)
+    {
+        if (!MMIntern::parseIsoTime(queryTimes[q], t[q]))
+        {
+            msg = "Cannot parse time " + queryTimes[q];
+            return false;
+        }
+        if (t[q] < stepTimes.front() || t[q] > stepTimes.back())
+        {
+            msg = "Time " + queryTimes[q] + " is outside of the cached time range.";
+            return false;
+        }
+    }
+
+    bool anyAccumulated = false;
+    for (const long p : periods)
+    {
+        anyAccumulated = anyAccumulated || p > 0;
+    }
+
+    result.resize(queryTimes.size(), std::vector<double>(numColumns));
+    for (std::size_t q=0; q<queryTimes.size(); q++)
+    {
+        std::size_t k;
+        double w;
+        locate(t[q], k, w);
+
+        // linear blend of two frames for all columns
+        const double* v0 = values.data() + k*numColumns;
+        const double* v1 = v0 + numColumns;
+        double* out = result[q].data();
+        const double w0 = 1.0 - w;
+        for (std::size_t c=0; c<numColumns; c++)
+        {
+            out[c] = w0*v0[c] + w*v1[c];
+        }
+
+        if (!anyAccumulated || w == 0.0 || w == 1.0)
+        {
+            continue;   // on a step the cached value is exact
+        }
+
+        const double* c0 = cumulative.data() + k*numColumns;
+        const double* c1 = c0 + numColumns;
+        long lastPeriod = 0;
+        std::size_t kp = 0;
+        double wp = 0.0;
+        for (std::size_t c=0; c<numColumns; c++)
+        {
+            if (periods[c] == 0)
+            {
+                continue;
+            }
+            const double now = w0*c0[c] + w*c1[c];
+            const double start = t[q] - static_cast<double>(periods[c]);
+            if (start < stepTimes[0])
+            {
+                out[c] = now - cumulativeAt(c, start);
+                continue;
+            }
+            if (periods[c] != lastPeriod)
+            {
+                locate(start, kp, wp);
+                lastPeriod = periods[c];
+            }
+            out[c] = now - ((1.0-wp)*cumulative[kp*numColumns + c] + wp*cumulative[(kp+1)*numColumns + c]);
+        }
+    }
+    return true;
+}
+
+bool MeteomaticsTimeInterpolator::interpolateGrid(const std::string& queryTime, Matrix& gridResult, std::string& msg) const
+{
+    gridResult.clear();
+    if (gridRows == 0)
+    {
+        msg = "No grid stack cached.";
+        return false;
+    }
+
+    Matrix flat;
+    if (!interpolate(std::vector<std::string>(1, queryTime), flat, msg))
+    {
+        return false;
+    }
+
+    gridResult.resize(gridRows);
+    for (std::size_t i=0; i<gridRows; i++)
+    {
+        gridResult[i].assign(flat[0].begin() + i*gridCols, flat[0].begin() + (i+1)*gridCols);
+    }
+    return true;
+}
+
+
+#endif /* Meteomatics_TimeInterpolation_h */
@@ -0,0 +1,218 @@
+//
+//  meteomatics_backfill.cpp
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+
+//
+// Backfill tool: fills a memory-mapped multi point time series (see Meteomatics_MappedResult.h) over a
+// long time range, window by window within rate limits. Completed windows are recorded in SERIESFILE.manifest,
+// running the same command again after an interruption resumes with the missing windows.
+//
+//   e.g. ./meteomatics_backfill USER PASSWORD t2m.mmts --parameters t_2m:C,precip_1h:mm --coordinates 47.41,9.35+46.2,7.1
+//            --start 2015-01-01T00:00:00Z --stop 2024-12-31T23:00:00Z --step 3600 --rate 5
+//
+
+#include "Meteomatics_Backfill.h"
+
+#include <iostream>
+
+
+using namespace std;
+
+
+struct Options
+{
+    string user;
+    string password;
+    string seriesFile;
+    vector<string> parameters;
+    vector<double> lats;
+    vector<double> lons;
+    string startTime;
+    string stopTime;
+    double stepSeconds;
+    vector<string> optionals;
+    size_t concurrency;
+    double requestsPerSecond;
+    double bytesPerSecond;
+    size_t maxValues;
+    size_t maxCoordinates;
+    int timeout;
+};
+
+
+static vector<string> split(const string& str, char delimiter)
+{
+    vector<string> tokens;
+    stringstream ss(str);
+    string token;
+    while (getline(ss, token, delimiter))
+    {
+        if (!token.empty())
+            tokens.push_back(token);
+    }
+    return tokens;
+}
+
+static bool parseCoordinates(const string& str, vector<double>& lats, vector<double>& lons)
+{
+    for (const auto& pair : split(str, '+'))
+    {
+        const vector<string> c = split(pair, ',');
+        if (c.size() != 2)
+            return false;
+        lats.push_back(atof(c[0].c_str()));
+        lons.push_back(atof(c[1].c_str()));
+    }
+    return !lats.empty();
+}
+
+
+static void usage()
+{
+    cout << "Usage: ./meteomatics_backfill USERNAME PASSWORD SERIESFILE [options]\n"
+            "  a new SERIESFILE needs:\n"
+            "  --parameters P,P...    parameters\n"
+            "  --coordinates LAT,LON[+LAT,LON...]\n"
+            "  --start TIME           first time (iso)\n"
+            "  --stop TIME            last time (iso)\n"
+            "  --step S               time step in seconds (default: 3600)\n"
+            "  an existing SERIESFILE is resumed, further options:\n"
+            "  --optionals O[&O...]   optional query parameters, e.g. model=mix\n"
+            "  --concurrency N        number of concurrent requests (default: 4)\n"
+            "  --rate R               max requests per second (default: unlimited)\n"
+            "  --bytes-rate B         max received bytes per second (default: unlimited)\n"
+            "  --max-values N         max values per request (default: 100000)\n"
+            "  --max-coordinates N    max coordinates per request (default: 100)\n"
+            "  --timeout S            timeout per request in seconds (default: 300)" << endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    if (argc < 4)
+        return false;
+
+    options.user = argv[1];
+    options.password = argv[2];
+    options.seriesFile = argv[3];
+    options.stepSeconds = 3600;
+    options.concurrency = 4;
+    options.requestsPerSecond = 0;
+    options.bytesPerSecond = 0;
+    options.maxValues = 100000;
+    options.maxCoordinates = 100;
+    options.timeout = 300;
+
+    for (int i=4; i<argc; i++)
+    {
+        const string arg = argv[i];
+        if (i+1 >= argc)
+            return false;
+        const string value = argv[++i];
+        if (arg == "--parameters")
+            options.parameters = split(value, ',');
+        else if (arg == "--coordinates")
+        {
+            if (!parseCoordinates(value, options.lats, options.lons))
+                return false;
+        }
+        else if (arg == "--start")
+            options.startTime = value;
+        else if (arg == "--stop")
+            options.stopTime = value;
+        else if (arg == "--step")
+            options.stepSeconds = atof(value.c_str());
+        else if (arg == "--optionals")
+            options.optionals = split(value, '&');
+        else if (arg == "--concurrency")
+            options.concurrency = max(1, atoi(value.c_str()));
+        else if (arg == "--rate")
+            options.requestsPerSecond = atof(value.c_str());
+        else if (arg == "--bytes-rate")
+            options.bytesPerSecond = atof(value.c_str());
+        else if (arg == "--max-values")
+            options.maxValues = max(1, atoi(value.c_str()));
+        else if (arg == "--max-coordinates")
+            options.maxCoordinates = max(1, atoi(value.c_str()));
+        else if (arg == "--timeout")
+            options.timeout = atoi(value.c_str());
+        else
+            return false;
+    }
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage();
+        return 1;
+    }
+
+    const string manifestPath = options.seriesFile + ".manifest";
+    string msg;
+
+    MeteomaticsMappedTimeSeries series;
+    if (ifstream(options.seriesFile.c_str()).good())
+    {
+        if (!series.open(options.seriesFile, msg, true))
+        {
+            cout << msg << endl;
+            return 1;
+        }
+        cout << "Resuming " << options.seriesFile << endl;
+    }
+    else
+    {
+        remove(manifestPath.c_str());           // a manifest without its series is stale
+        if (!series.create(options.seriesFile, options.parameters, options.lats, options.lons, options.startTime, options.stopTime, options.stepSeconds, msg))
+        {
+            cout << msg << endl;
+            usage();
+            return 1;
+        }
+    }
+    cout << series.numParameters() << " parameters, " << series.numCoordinates() << " coordinates, " << series.numTimes() << " times" << endl;
+
+    shared_ptr<MeteomaticsRateLimiter> rateLimiter;
+    if (options.requestsPerSecond > 0 || options.bytesPerSecond > 0)
+        rateLimiter = make_shared<MeteomaticsRateLimiter>(options.requestsPerSecond, options.bytesPerSecond);
+
+    MeteomaticsBackfill backfill(options.user, options.password, options.timeout, options.concurrency, rateLimiter);
+    backfill.setWindowLimits(options.maxValues, options.maxCoordinates);
+
+    chrono::steady_clock::time_point lastReport;
+    backfill.setProgressCallback([&lastReport](const MeteomaticsBackfillProgress& p)
+    {
+        const chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (now - lastReport < chrono::seconds(1) && p.windowsDone + p.windowsFailed < p.windowsTotal)
+            return;
+        lastReport = now;
+        cout << p.windowsDone << "/" << p.windowsTotal << " windows (" << p.windowsResumed << " resumed, " << p.windowsFailed << " failed), "
+             << p.windowsPerSecond << " windows/s, " << p.valuesPerSecond << " values/s, eta " << p.etaSeconds << " s" << endl;
+    });
+
+    const bool complete = backfill.run(series, manifestPath, msg, options.optionals);
+    const MeteomaticsBackfillProgress p = backfill.progress();
+
+    cout << "------------------------------------------------------\n";
+    cout << "Windows:     " << p.windowsDone << "/" << p.windowsTotal << " (" << p.windowsResumed << " resumed, " << p.windowsFailed << " failed)\n";
+    cout << "Requests:    " << p.requests << "\n";
+    cout << "Values:      " << p.values << " written to " << options.seriesFile << "\n";
+    cout << "Wall time:   " << p.elapsedSeconds << " s\n";
+    cout << "Throughput:  " << p.windowsPerSecond << " windows/s, " << p.valuesPerSecond << " values/s\n";
+    cout << "------------------------------------------------------" << endl;
+
+    if (!complete)
+    {
+        cout << msg.substr(0,500) << "\nRun again to resume." << endl;
+        return 1;
+    }
+    return 0;
+}
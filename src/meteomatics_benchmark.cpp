@@ -0,0 +1,888 @@
+//
+//  meteomatics_benchmark.cpp
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+
+//
+// Offline benchmarks of the client internals on synthetic responses (no network access needed).
+//
+// Usage: ./meteomatics_benchmark [NUM_COORDINATES NUM_TIMES NUM_PARAMETERS]
+//        ./meteomatics_benchmark --replay ARCHIVE [REPEATS]    decodes recorded responses (see meteomatics_bulk --record)
+//        ./meteomatics_benchmark --check                        only the offline checks and result comparisons, exits with 1 if one fails
+//
+
+#define METEOMATICS_COUNT_ALLOCATIONS
+#include "Meteomatics_CachingClient.h"
+#include "Meteomatics_GridPyramid.h"
+#include "Meteomatics_GridStore.h"
+#include "Meteomatics_MappedResult.h"
+#include "Meteomatics_ParameterSet.h"
+#include "Meteomatics_Pipeline.h"
+#include "Meteomatics_PointBatcher.h"
+#include "Meteomatics_Reduction.h"
+#include "Meteomatics_TimeInterpolation.h"
+
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+
+using namespace std;
+
+
+// exposes the protected decoders of the client
+class BenchmarkClient : public MeteomaticsApiClient
+{
+public:
+    BenchmarkClient() : MeteomaticsApiClient("", "", 1) {}
+    
+    using MeteomaticsApiClient::readMultiPointTimeSeriesBin;
+    using MeteomaticsApiClient::readMultiPointTimeSeriesBinParallel;
+    using MeteomaticsApiClient::readMultiPointTimeSeriesCsv;
+    using MeteomaticsApiClient::readMultiPointTimeSeriesBinRows;
+    using MeteomaticsApiClient::createMultiPointTimeSeriesQuery;
+    using MeteomaticsApiClient::reduceMultiPointTimeSeriesBin;
+    using MeteomaticsApiClient::convDateIso8601;
+    using MeteomaticsApiClient::getTimeStepStr;
+    
+    // requests and decodes a recorded query, grids are recognized by their resolution, all others are multi point time series
+    bool replayQuery(const string& path, size_t& numBytes, size_t& numValues) const
+    {
+        const size_t formatStart = path.rfind('/');
+        const size_t coordinatesStart = (formatStart == string::npos || formatStart == 0) ? string::npos : path.rfind('/', formatStart - 1);
+        const string coordinates = coordinatesStart == string::npos ? string() : path.substr(coordinatesStart + 1, formatStart - coordinatesStart - 1);
+        
+        string msg;
+        int httpReturnCode = 0;
+        MMIntern::MemoryClass mem(500);
+        httpClient->requestBinary(httpClient->getServer(), path, mem, dataRequestTimeout, httpReturnCode);
+        numBytes = mem.size();
+        numValues = 0;
+        
+        if (coordinates.find(':') != string::npos)
+        {
+            Matrix grid;
+            vector<double> lats, lons;
+            if (!decodeGrid(mem, httpReturnCode, grid, lats, lons, msg))
+                return false;
+            numValues = grid.size() * (grid.empty() ? 0 : grid[0].size());
+            return true;
+        }
+        
+        vector<Matrix> result;
+        vector<string> times;
+        if (!decodeMultiPointTimeSeries(mem, httpReturnCode, count(coordinates.begin(), coordinates.end(), '+') + 1, result, times, msg))
+            return false;
+        for (const auto& m : result)
+            numValues += m.size() * (m.empty() ? 0 : m[0].size());
+        return true;
+    }
+    
+    // getMultiPointTimeSeries with the transfer replaced by delivering body in chunks, as libcurl does
+    bool receiveMultiPointTimeSeries(const MMIntern::MemoryClass& body, const size_t numCoordinates) const
+    {
+        MMIntern::AllocationScope allocationScope(memoryStats, MultiPointTimeSeriesQuery);
+        
+        vector<Matrix> result;
+        vector<string> times;
+        string msg;
+        
+        MMIntern::AllocationScope::enterPhase(MMIntern::AllocationScope::Receive);
+        MMIntern::MemoryClass mem(500);
+        const size_t chunkSize = CURL_MAX_WRITE_SIZE;
+        for (size_t pos=0; pos<body.size(); pos+=chunkSize)
+        {
+            const char* chunk = body.mem.data() + pos;
+            MMIntern::HttpClient::writeMemoryCallback(const_cast<char*>(chunk), 1, min(chunkSize, body.size() - pos), &mem);
+        }
+        
+        MMIntern::AllocationScope::enterPhase(MMIntern::AllocationScope::Decode);
+        return decodeMultiPointTimeSeries(mem, 200, numCoordinates, result, times, msg);
+    }
+};
+
+
+// exposes the query of the caching client, to record responses for it
+class RevalidationClient : public MeteomaticsCachingClient
+{
+public:
+    RevalidationClient() : MeteomaticsCachingClient("", "", 1) {}
+    
+    using MeteomaticsApiClient::createGridQuery;
+};
+
+
+static void createMultiPointTimeSeriesBody(MMIntern::MemoryClass& mem, int32_t numCoords, int32_t numTimes, int32_t numParams)
+{
+    mem.write(numCoords);
+    for (int32_t i=0; i<numCoords; i++)
+    {
+        mem.write(numTimes);
+        for (int32_t j=0; j<numTimes; j++)
+        {
+            mem.write(numParams);
+            mem.write(737000.0 + j / 24.0);                     // matlab datenum, hourly steps
+            for (int32_t k=0; k<numParams; k++)
+            {
+                mem.write(0.001 * i + 0.1 * j + k);
+            }
+        }
+    }
+}
+
+// the same data as csv (as the API formats it) and as bin, the bin values being parsed from the csv text
+static void createMultiPointTimeSeriesBodies(const BenchmarkClient& client, string& csv, MMIntern::MemoryClass& mem, int32_t numCoords, int32_t numTimes, int32_t numParams)
+{
+    vector<string> times(numTimes);
+    for (int32_t j=0; j<numTimes; j++)
+    {
+        times[j] = client.convDateIso8601(737000.0 + j / 24.0);
+    }
+    
+    csv = "lat;lon;validdate";
+    for (int32_t k=0; k<numParams; k++)
+    {
+        csv += ";p" + to_string(k) + ":x";
+    }
+    csv += '\n';
+    
+    mem.write(numCoords);
+    char buffer[64];
+    for (int32_t i=0; i<numCoords; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "%.4f;%.4f;", 45.0 + 0.001 * i, 7.0 + 0.002 * i);
+        const string coordinate(buffer);
+        
+        mem.write(numTimes);
+        for (int32_t j=0; j<numTimes; j++)
+        {
+            csv += coordinate;
+            csv += times[j];
+            mem.write(numParams);
+            mem.write(737000.0 + j / 24.0);
+            for (int32_t k=0; k<numParams; k++)
+            {
+                snprintf(buffer, sizeof(buffer), ";%.1f", 0.1 * ((i * 7 + j * 3 + k * 11) % 2000) - 50.0);
+                csv += buffer;
+                mem.write(strtod(buffer + 1, nullptr));
+            }
+            csv += '\n';
+        }
+    }
+}
+
+static bool identical(const vector<Matrix>& a, const vector<Matrix>& b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i=0; i<a.size(); i++)
+    {
+        if (a[i].size() != b[i].size())
+            return false;
+        for (size_t j=0; j<a[i].size(); j++)
+        {
+            if (a[i][j].size() != b[i][j].size() || memcmp(a[i][j].data(), b[i][j].data(), a[i][j].size()*sizeof(double)) != 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+template<class F>
+static double secondsOf(F f)
+{
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+
+static bool benchmarkParallelDecode(int32_t numCoords, int32_t numTimes, int32_t numParams)
+{
+    BenchmarkClient client;
+    MMIntern::MemoryClass mem;
+    createMultiPointTimeSeriesBody(mem, numCoords, numTimes, numParams);
+    
+    cout << "Multi point time series decode: " << numCoords << " coordinates x " << numTimes << " times x " << numParams
+         << " parameters (" << mem.size() / (1024.0*1024.0) << " MB)" << endl;
+    
+    vector<Matrix> reference;
+    vector<string> referenceTimes;
+    mem.resetReadPos();
+    const double sequential = secondsOf([&]() { client.readMultiPointTimeSeriesBin(mem, reference, referenceTimes); });
+    cout << "  sequential:  " << sequential << " s" << endl;
+    
+    bool allSame = true;
+    const size_t maxThreads = max(2u, thread::hardware_concurrency());
+    for (size_t numThreads=2; numThreads<=maxThreads; numThreads*=2)
+    {
+        MMIntern::ThreadPool pool(numThreads);
+        vector<Matrix> results;
+        vector<string> times;
+        mem.resetReadPos();
+        const double parallel = secondsOf([&]() { client.readMultiPointTimeSeriesBinParallel(mem, results, times, pool); });
+        
+        const bool same = identical(reference, results) && referenceTimes == times;
+        cout << "  " << numThreads << " threads:  " << parallel << " s, speedup " << sequential / parallel
+             << (same ? ", bit-identical" : ", RESULTS DIFFER") << endl;
+        allSame = allSame && same;
+    }
+    cout << endl;
+    return allSame;
+}
+
+
+// daily min/max/mean per coordinate and parameter: from the decoded matrices vs. while decoding
+static bool benchmarkReduction(int32_t numCoords, int32_t numTimes, int32_t numParams)
+{
+    BenchmarkClient client;
+    MMIntern::MemoryClass mem;
+    createMultiPointTimeSeriesBody(mem, numCoords, numTimes, numParams);
+    
+    cout << "Daily min/max/mean of the multi point time series" << endl;
+    vector<double> reference;
+    const double decoded = secondsOf([&]()
+    {
+        vector<Matrix> results;
+        vector<string> times;
+        mem.resetReadPos();
+        client.readMultiPointTimeSeriesBin(mem, results, times);
+        for (const auto& series : results)
+        {
+            for (size_t start=0; start<series.size(); start+=24)
+            {
+                const size_t end = min(start + 24, series.size());
+                for (int32_t k=0; k<numParams; k++)
+                {
+                    double minimum = series[start][k], maximum = series[start][k], sum = 0;
+                    for (size_t t=start; t<end; t++)
+                    {
+                        minimum = min(minimum, series[t][k]);
+                        maximum = max(maximum, series[t][k]);
+                        sum += series[t][k];
+                    }
+                    reference.push_back(minimum);
+                    reference.push_back(maximum);
+                    reference.push_back(sum / (end - start));
+                }
+            }
+        }
+    });
+    
+    MeteomaticsReduction reduction;
+    reduction.add(MeteomaticsReduction::Min).add(MeteomaticsReduction::Max).add(MeteomaticsReduction::Mean).setTimeBuckets(86400);
+    const double streamed = secondsOf([&]()
+    {
+        mem.resetReadPos();
+        client.reduceMultiPointTimeSeriesBin(mem, numCoords, reduction);
+    });
+    
+    double maxDifference = 0;
+    size_t numAggregates = 0;
+    for (const auto& aggregate : reduction.results())
+    {
+        for (size_t i=0; i<aggregate.values.size() && numAggregates < reference.size(); i++, numAggregates++)
+            maxDifference = max(maxDifference, fabs(aggregate.values[i] - reference[numAggregates]));
+    }
+    const bool same = numAggregates == reference.size() && maxDifference < 1e-9;
+    cout << "  decode, then aggregate:  " << decoded << " s" << endl;
+    cout << "  aggregate while decoding: " << streamed << " s, speedup " << decoded / streamed << ", " << reduction.results().size() << " aggregates"
+         << (same ? "" : ", RESULTS DIFFER") << endl;
+    cout << endl;
+    return same;
+}
+
+
+METEOMATICS_PARAMETER(T2m, "t_2m:C");
+METEOMATICS_PARAMETER(Precip1h, "precip_1h:mm");
+METEOMATICS_PARAMETER(WindSpeed10m, "wind_speed_10m:ms");
+typedef MeteomaticsParameterSet<T2m, Precip1h, WindSpeed10m> BenchmarkParameters;
+
+// query building and decoding for parameters given at runtime vs. as a compile time parameter set
+static bool benchmarkParameterSet(int32_t numCoords, int32_t numTimes)
+{
+    BenchmarkClient client;
+    const vector<string> parameters = BenchmarkParameters::parameters();
+    const vector<double> lats(10, 47.4), lons(10, 9.3);
+    const vector<string> noOptionals;
+    const string start = "2024-01-01T00:00:00Z", stop = "2024-01-02T00:00:00Z", step = "T1H";
+    const int numQueries = 1000000;
+    
+    size_t length = 0;
+    const double runtimeQueries = secondsOf([&]()
+    {
+        for (int i=0; i<numQueries; i++)
+            length += client.createMultiPointTimeSeriesQuery(start, stop, step, parameters, lats, lons, noOptionals).size();
+    });
+    const double typedQueries = secondsOf([&]()
+    {
+        for (int i=0; i<numQueries; i++)
+            length += client.createMultiPointTimeSeriesQuery(start, stop, step, BenchmarkParameters::fragment(), lats, lons, noOptionals).size();
+    });
+    
+    MMIntern::MemoryClass mem;
+    createMultiPointTimeSeriesBody(mem, numCoords, numTimes, BenchmarkParameters::size);
+    vector<Matrix> matrices;
+    vector<string> times;
+    mem.resetReadPos();
+    const double runtimeDecode = secondsOf([&]() { client.readMultiPointTimeSeriesBin(mem, matrices, times); });
+    
+    vector<vector<BenchmarkParameters::Row>> rows;
+    times.clear();
+    mem.resetReadPos();
+    const double typedDecode = secondsOf([&]() { client.readMultiPointTimeSeriesBinRows(mem, numCoords, rows, times); });
+    
+    bool same = rows.size() == matrices.size();
+    for (size_t i=0; same && i<rows.size(); i++)
+        for (size_t t=0; same && t<rows[i].size(); t++)
+            same = BenchmarkParameters::get<WindSpeed10m>(rows[i][t]) == matrices[i][t][2];
+    
+    cout << "Parameter set: " << BenchmarkParameters::fragment() << " (" << length / (2 * numQueries) << " byte queries)" << endl;
+    cout << "  query build, runtime parameters: " << runtimeQueries / numQueries * 1e9 << " ns, parameter set: " << typedQueries / numQueries * 1e9 << " ns" << endl;
+    cout << "  decode into matrices: " << runtimeDecode << " s, into rows: " << typedDecode << " s, speedup " << runtimeDecode / typedDecode
+         << (same ? "" : ", RESULTS DIFFER") << endl;
+    cout << endl;
+    return same;
+}
+
+
+static bool benchmarkCsv(int32_t numCoords, int32_t numTimes, int32_t numParams)
+{
+    BenchmarkClient client;
+    string csv;
+    MMIntern::MemoryClass mem;
+    createMultiPointTimeSeriesBodies(client, csv, mem, numCoords, numTimes, numParams);
+    
+    cout << "Multi point time series csv vs. bin: " << numCoords << " coordinates x " << numTimes << " times x " << numParams << " parameters" << endl;
+    
+    vector<Matrix> binResults;
+    vector<string> binTimes;
+    mem.resetReadPos();
+    const double bin = secondsOf([&]() { client.readMultiPointTimeSeriesBin(mem, binResults, binTimes); });
+    
+    vector<Matrix> csvResults;
+    vector<string> csvTimes;
+    bool success = false;
+    const double csvSeconds = secondsOf([&]() { success = client.readMultiPointTimeSeriesCsv(csv, numCoords, csvResults, csvTimes); });
+    
+    const double numValues = static_cast<double>(numCoords) * numTimes * numParams;
+    const bool same = success && identical(binResults, csvResults) && binTimes == csvTimes;
+    cout << "  bin: " << mem.size() / (1024.0*1024.0) << " MB in " << bin << " s, " << numValues / bin / 1e6 << " M values/s" << endl;
+    cout << "  csv: " << csv.size() / (1024.0*1024.0) << " MB in " << csvSeconds << " s, " << numValues / csvSeconds / 1e6 << " M values/s, "
+         << csv.size() / csvSeconds / (1024.0*1024.0) << " MB/s" << (same ? ", identical to bin" : ", RESULTS DIFFER") << endl;
+    cout << endl;
+    return same;
+}
+
+static void benchmarkMemory(int32_t numTimes, int32_t numParams)
+{
+    BenchmarkClient client;
+    
+    cout << "Multi point time series memory: " << numTimes << " times x " << numParams << " parameters per coordinate" << endl;
+    cout << "  coordinates    receive: allocs       bytes        peak    decoded: allocs       bytes        peak   bytes/value" << endl;
+    for (int32_t numCoords=10; numCoords<=10000; numCoords*=10)
+    {
+        MMIntern::MemoryClass body;
+        createMultiPointTimeSeriesBody(body, numCoords, numTimes, numParams);
+        
+        client.resetMemoryStats();
+        client.receiveMultiPointTimeSeries(body, numCoords);
+        const MeteomaticsMemoryStats stats = client.getMemoryStats(MeteomaticsApiClient::MultiPointTimeSeriesQuery);
+        
+        const double numValues = static_cast<double>(numCoords) * numTimes * numParams;
+        cout << "  " << setw(11) << numCoords
+             << setw(17) << stats.receiveBuffer.allocations << setw(12) << stats.receiveBuffer.bytesAllocated << setw(12) << stats.receiveBuffer.peakLiveBytes
+             << setw(17) << stats.decodedResult.allocations << setw(12) << stats.decodedResult.bytesAllocated << setw(12) << stats.decodedResult.peakLiveBytes
+             << setw(14) << (stats.receiveBuffer.peakLiveBytes + stats.decodedResult.peakLiveBytes) / numValues << endl;
+    }
+    cout << endl;
+}
+
+
+// the mutex protected deque the lock-free queue replaces, with the same interface
+class LockedResultQueue
+{
+public:
+    bool tryPush(MeteomaticsQueryResult& value)
+    {
+        lock_guard<mutex> lock(m);
+        if (q.size() >= 1024)
+            return false;
+        q.push_back(std::move(value));
+        return true;
+    }
+    bool tryPop(MeteomaticsQueryResult& value)
+    {
+        lock_guard<mutex> lock(m);
+        if (q.empty())
+            return false;
+        value = std::move(q.front());
+        q.pop_front();
+        return true;
+    }
+private:
+    mutex m;
+    deque<MeteomaticsQueryResult> q;
+};
+
+// producers publish numMessages small results (as many decode threads finishing tiny queries), consumers drain them
+template<class Queue>
+static double deliverResults(Queue& queue, size_t numProducers, size_t numConsumers, size_t numMessages, bool& complete)
+{
+    atomic<size_t> consumed(0);
+    atomic<size_t> idSum(0);
+    vector<thread> threads;
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t p=0; p<numProducers; p++)
+    {
+        threads.emplace_back([&, p]()
+        {
+            for (size_t i=p; i<numMessages; i+=numProducers)
+            {
+                MeteomaticsQueryResult r;
+                r.queryId = i;
+                r.success = true;
+                while (!queue.tryPush(r))
+                    this_thread::yield();
+            }
+        });
+    }
+    for (size_t c=0; c<numConsumers; c++)
+    {
+        threads.emplace_back([&]()
+        {
+            MeteomaticsQueryResult r;
+            size_t sum = 0;
+            while (consumed.load() < numMessages)
+            {
+                if (queue.tryPop(r))
+                {
+                    sum += r.queryId;
+                    consumed++;
+                }
+                else
+                    this_thread::yield();
+            }
+            idSum += sum;
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    complete = idSum.load() == numMessages * (numMessages - 1) / 2;
+    return seconds;
+}
+
+static void benchmarkResultQueue(size_t numMessages)
+{
+    cout << "Result delivery: " << numMessages << " results" << endl;
+    cout << "  producers x consumers    lock-free M/s      mutex M/s" << endl;
+    const size_t n = max(2u, thread::hardware_concurrency());
+    const size_t configurations[][2] = {{1, 1}, {n, 1}, {n, n}, {2*n, 2*n}};
+    for (const auto& configuration : configurations)
+    {
+        bool lockFreeComplete = false, lockedComplete = false;
+        MMIntern::BoundedMpmcQueue<MeteomaticsQueryResult> lockFree(1024);
+        const double lockFreeSeconds = deliverResults(lockFree, configuration[0], configuration[1], numMessages, lockFreeComplete);
+        LockedResultQueue locked;
+        const double lockedSeconds = deliverResults(locked, configuration[0], configuration[1], numMessages, lockedComplete);
+        
+        cout << "  " << setw(9) << configuration[0] << " x " << setw(9) << configuration[1]
+             << setw(17) << numMessages / lockFreeSeconds / 1e6 << setw(15) << numMessages / lockedSeconds / 1e6
+             << (lockFreeComplete && lockedComplete ? "" : "  RESULTS LOST") << endl;
+    }
+    cout << endl;
+}
+
+
+static void benchmarkGridStore(size_t numLat, size_t numLon)
+{
+    // smooth field with some noise and a few missing values, like a temperature grid
+    Matrix grid(numLat, vector<double>(numLon));
+    vector<double> lats(numLat), lons(numLon);
+    for (size_t i=0; i<numLat; i++)
+    {
+        lats[i] = 90.0 - 180.0 * i / max<size_t>(1, numLat - 1);
+        for (size_t j=0; j<numLon; j++)
+        {
+            lons[j] = -180.0 + 360.0 * j / numLon;
+            grid[i][j] = 30.0 * cos(lats[i] * M_PI / 180.0) - 10.0 + 5.0 * sin(lons[j] * M_PI / 45.0) + 0.01 * ((i * 31 + j * 17) % 100);
+        }
+    }
+    grid[numLat / 2][numLon / 3] = numeric_limits<double>::quiet_NaN();
+    
+    cout << "Grid store: " << numLat << " x " << numLon << " grid (" << numLat * numLon * sizeof(double) / (1024.0*1024.0) << " MB as doubles)" << endl;
+    const MeteomaticsGridStore::Codec codecs[] = {MeteomaticsGridStore::Quantized, MeteomaticsGridStore::Half};
+    const char* names[] = {"quantized (0.01)", "fp16"};
+    for (int c=0; c<2; c++)
+    {
+        MeteomaticsGridStore store(codecs[c], 0.01);
+        string msg;
+        const double putSeconds = secondsOf([&]() { store.put("t_2m", grid, lats, lons, msg); });
+        
+        Matrix decoded;
+        vector<double> decodedLats, decodedLons;
+        for (int rep=0; rep<10; rep++)
+            store.getGrid("t_2m", decoded, decodedLats, decodedLons);
+        
+        double maxError = 0;
+        bool nanKept = true;
+        for (size_t i=0; i<numLat; i++)
+            for (size_t j=0; j<numLon; j++)
+            {
+                if (std::isnan(grid[i][j]))
+                    nanKept = nanKept && std::isnan(decoded[i][j]);
+                else
+                    maxError = max(maxError, fabs(decoded[i][j] - grid[i][j]));
+            }
+        
+        Matrix region;
+        const double regionSeconds = secondsOf([&]() { store.getRegion("t_2m", numLat / 4, numLat / 4 + 50, numLon / 4, numLon / 4 + 50, region); });
+        
+        const MeteomaticsGridStoreStats stats = store.stats();
+        cout << "  " << setw(16) << names[c] << ": ratio " << stats.compressionRatio << ", max error " << maxError << (nanKept ? "" : ", NAN LOST")
+             << ", compress " << putSeconds << " s, decompress " << stats.decodeThroughput / 1e6 << " M values/s, 50x50 region " << regionSeconds * 1e6 << " us" << endl;
+    }
+    cout << endl;
+}
+
+
+static void benchmarkGridPyramid(size_t numLat, size_t numLon)
+{
+    Matrix grid(numLat, vector<double>(numLon));
+    vector<double> lats(numLat), lons(numLon);
+    for (size_t i=0; i<numLat; i++)
+    {
+        lats[i] = 90.0 - 180.0 * i / max<size_t>(1, numLat - 1);
+        for (size_t j=0; j<numLon; j++)
+        {
+            lons[j] = -180.0 + 360.0 * j / numLon;
+            grid[i][j] = 30.0 * cos(lats[i] * M_PI / 180.0) - 10.0 + 5.0 * sin(lons[j] * M_PI / 45.0);
+        }
+    }
+    
+    cout << "Grid pyramid: " << numLat << " x " << numLon << " grid" << endl;
+    const MeteomaticsGridPyramid::Method methods[] = {MeteomaticsGridPyramid::Mean, MeteomaticsGridPyramid::Max, MeteomaticsGridPyramid::Nearest};
+    const char* names[] = {"mean", "max", "nearest"};
+    const size_t maxThreads = max(2u, thread::hardware_concurrency());
+    for (int m=0; m<3; m++)
+    {
+        for (size_t numThreads=1; numThreads<=maxThreads; numThreads*=2)
+        {
+            MeteomaticsGridPyramid pyramid(methods[m], numThreads);
+            string msg;
+            const int repeats = 10;
+            const double seconds = secondsOf([&]() { for (int rep=0; rep<repeats; rep++) pyramid.build(grid, lats, lons, msg); }) / repeats;
+            
+            Matrix region;
+            vector<double> regionLats, regionLons;
+            size_t level = 0;
+            const double regionSeconds = secondsOf([&]() { pyramid.getGrid(60, -10, 40, 20, 20, 30, region, regionLats, regionLons, level); });
+            
+            cout << "  " << setw(7) << names[m] << ", " << numThreads << " threads: " << pyramid.numLevels() << " levels in " << seconds * 1e3 << " ms, "
+                 << numLat * numLon / seconds / 1e6 << " M input values/s, 20x30 region from level " << level << " in " << regionSeconds * 1e6 << " us" << endl;
+        }
+    }
+    cout << endl;
+}
+
+
+// client overhead and decoding of real responses, served from memory
+static void benchmarkReplay(const string& path, int repeats)
+{
+    auto archive = make_shared<MeteomaticsTransportArchive>();
+    string msg;
+    if (!archive->replay(path, msg))
+    {
+        cout << msg << endl;
+        return;
+    }
+    BenchmarkClient client;
+    client.setTransportArchive(archive);
+    
+    const vector<string> queries = archive->queries();
+    cout << "Replay of " << queries.size() << " recorded queries from " << path << ", " << repeats << " repeats" << endl;
+    size_t totalBytes = 0, totalValues = 0, failed = 0;
+    const double seconds = secondsOf([&]()
+    {
+        for (int r=0; r<repeats; r++)
+        {
+            for (const auto& query : queries)
+            {
+                size_t numBytes = 0, numValues = 0;
+                if (!client.replayQuery(query, numBytes, numValues))
+                    failed++;
+                totalBytes += numBytes;
+                totalValues += numValues;
+            }
+        }
+    });
+    cout << "  " << totalBytes / (1024.0*1024.0) << " MB, " << totalValues << " values in " << seconds << " s: "
+         << queries.size() * repeats / seconds << " queries/s, " << totalBytes / seconds / (1024.0*1024.0) << " MB/s, "
+         << totalValues / seconds / 1e6 << " M values/s" << (failed > 0 ? ", " + to_string(failed) + " failed" : string()) << endl;
+    cout << endl;
+}
+
+
+// the caching client revalidates with the ETag of the first response (200) and keeps its grid on the second one (304),
+// which the archive only serves to a conditional request
+static bool checkRevalidation()
+{
+    const string path = "meteomatics_revalidation_check.archive";
+    RevalidationClient client;
+    const string query = client.createGridQuery("2020-01-01T00:00:00Z", "t_2m:C", 50, 5, 45, 10, 3, 4, {});
+    
+    vector<double> lats = {50, 47.5, 45}, lons = {5, 6.5, 8, 10};
+    MMIntern::MemoryClass body;
+    for (const char c : string("MBG_"))
+        body.write(c);
+    body.write(int32_t(2));
+    body.write(int32_t(sizeof(double)));
+    body.write(int32_t(1));
+    body.write(int32_t(0));
+    body.write(int32_t(1));
+    body.write(1577836800.0);
+    body.write(int32_t(lats.size()));
+    for (const double lat : lats)
+        body.write(lat);
+    body.write(int32_t(lons.size()));
+    for (const double lon : lons)
+        body.write(lon);
+    for (size_t i=0; i<lats.size()*lons.size(); i++)
+        body.write(-5.0 + 0.25*i);
+    
+    string msg;
+    auto archive = make_shared<MeteomaticsTransportArchive>();
+    if (!archive->record(path, msg, false))
+    {
+        cout << "Revalidation check FAILED: " << msg << endl;
+        return false;
+    }
+    archive->add(query, 200, "ETag: \"run-2020010100\"\n", body.mem.data(), body.size());
+    archive->add(query, 304, "ETag: \"run-2020010100\"\n", nullptr, 0);
+    archive->close();
+    const bool replaying = archive->replay(path, msg);
+    remove(path.c_str());
+    if (!replaying)
+    {
+        cout << "Revalidation check FAILED: " << msg << endl;
+        return false;
+    }
+    client.setTransportArchive(archive);
+    
+    Matrix first, second;
+    vector<double> firstLats, firstLons, secondLats, secondLons;
+    const bool received = client.getGridCached("2020-01-01T00:00:00Z", "t_2m:C", 50, 5, 45, 10, 3, 4, first, firstLats, firstLons, msg)
+                       && client.getGridCached("2020-01-01T00:00:00Z", "t_2m:C", 50, 5, 45, 10, 3, 4, second, secondLats, secondLons, msg);
+    const vector<string> firstHeaders = archive->requestHeaders(query, 0);
+    const vector<string> secondHeaders = archive->requestHeaders(query, 1);
+    const string condition = "If-None-Match: \"run-2020010100\"";
+    const bool conditional = find(firstHeaders.begin(), firstHeaders.end(), condition) == firstHeaders.end()
+                          && find(secondHeaders.begin(), secondHeaders.end(), condition) != secondHeaders.end();
+    const bool ok = received && conditional && client.numDownloads() == 1 && client.numNotModified() == 1 && archive->numReplayed() == 2
+                 && first.size() == lats.size() && identical(vector<Matrix>{first}, vector<Matrix>{second}) && firstLats == secondLats && firstLons == secondLons;
+    cout << "Revalidation check " << (ok ? "passed" : "FAILED") << ": " << client.numDownloads() << " download, "
+         << client.numNotModified() << " not modified, " << (conditional ? "revalidated with " + condition : string("no conditional request"))
+         << (msg.empty() ? string() : ", " + msg) << endl;
+    cout << endl;
+    return ok;
+}
+
+
+// the point batcher splits 10 concurrent getPoint calls into batches of 4, 4 (both full) and 2 (sent after the window),
+// every caller must receive the same row as a single unbatched getMultiPoints call returns for its coordinate
+static bool checkPointBatcher()
+{
+    const string path = "meteomatics_point_batcher_check.archive";
+    const string time = "2020-01-01T00:00:00Z";
+    const vector<string> parameters = {"t_2m:C", "precip_1h:mm"};
+    const size_t numPoints = 10, batchSize = 4;
+    vector<double> lats, lons;
+    for (size_t i=0; i<numPoints; i++)
+    {
+        lats.push_back(45 + 0.5*i);
+        lons.push_back(5 + 0.25*i);
+    }
+    
+    // the values only depend on the coordinate, not on its position in the request
+    BenchmarkClient client;
+    string msg;
+    auto archive = make_shared<MeteomaticsTransportArchive>();
+    if (!archive->record(path, msg, false))
+    {
+        cout << "Point batcher check FAILED: " << msg << endl;
+        return false;
+    }
+    auto addResponse = [&](size_t begin, size_t end)
+    {
+        const vector<double> batchLats(lats.begin() + begin, lats.begin() + end), batchLons(lons.begin() + begin, lons.begin() + end);
+        MMIntern::MemoryClass body;
+        body.write(int32_t(batchLats.size()));
+        for (size_t i=0; i<batchLats.size(); i++)
+        {
+            body.write(int32_t(1));
+            body.write(int32_t(parameters.size()));
+            body.write(737791.0);                               // matlab datenum of time
+            for (size_t k=0; k<parameters.size(); k++)
+                body.write(batchLats[i] + 0.01*batchLons[i] + k);
+        }
+        const string query = client.createMultiPointTimeSeriesQuery(time, time, client.getTimeStepStr(0, 0, 0, 0, 0, 0), parameters, batchLats, batchLons, {});
+        archive->add(query, 200, "", body.mem.data(), body.size());
+    };
+    addResponse(0, numPoints);
+    for (size_t first=0; first<numPoints; first+=batchSize)
+        addResponse(first, min(numPoints, first + batchSize));
+    archive->close();
+    const bool replaying = archive->replay(path, msg);
+    remove(path.c_str());
+    if (!replaying)
+    {
+        cout << "Point batcher check FAILED: " << msg << endl;
+        return false;
+    }
+    client.setTransportArchive(archive);
+    
+    Matrix unbatched;
+    const bool received = client.getMultiPoints(time, parameters, lats, lons, unbatched, msg);
+    
+    // the callers join one after the other, so the batches and with them the recorded queries are known
+    MeteomaticsPointBatcher batcher(client, 500, batchSize);
+    Matrix batched(numPoints);
+    vector<char> success(numPoints, 0);
+    vector<string> messages(numPoints);
+    vector<thread> callers;
+    for (size_t i=0; i<numPoints; i++)
+    {
+        callers.emplace_back([&, i]() { success[i] = batcher.getPoint(time, parameters, lats[i], lons[i], batched[i], messages[i]); });
+        while (batcher.numPointRequests() <= i)
+            this_thread::yield();
+    }
+    for (auto& caller : callers)
+        caller.join();
+    
+    const bool ok = received && count(success.begin(), success.end(), 1) == int(numPoints) && batched == unbatched
+                 && batcher.numBatchRequests() == 3 && archive->numMissing() == 0 && archive->numReplayed() == 4;
+    cout << "Point batcher check " << (ok ? "passed" : "FAILED") << ": " << batcher.numPointRequests() << " points in "
+         << batcher.numBatchRequests() << " batches, " << (batched == unbatched ? "identical to" : "different from") << " one unbatched request"
+         << (msg.empty() ? string() : ", " + msg) << endl;
+    cout << endl;
+    return ok;
+}
+
+
+// a read-only mapping hands out no writable values, and a file whose header does not match its size is not mapped,
+// also if the sizes only fit because their product overflows
+static bool checkMappedTimeSeries()
+{
+    const string path = "meteomatics_mapped_check.mmts";
+    string msg;
+    MeteomaticsMappedTimeSeries series;
+    const bool created = series.create(path, {"t_2m:C"}, {47.0}, {8.0}, "2020-01-01T00:00:00Z", "2020-02-11T14:00:00Z", 3600, msg);
+    series.close();
+    ifstream in(path, ios::binary);
+    const string file((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    in.close();
+    
+    const bool readOnly = created && series.open(path, msg) && series.values(0, 0) != nullptr && std::isnan(series.values(0, 0)[0])
+                       && series.writableValues(0, 0) == nullptr;
+    const uint64_t numTimes = series.numTimes();
+    series.close();
+    
+    auto setField = [](string& bytes, size_t offset, uint64_t value) { memcpy(&bytes[offset], &value, sizeof(value)); };
+    auto rejected = [&](const string& bytes)
+    {
+        ofstream(path, ios::binary | ios::trunc).write(bytes.data(), bytes.size());
+        string openMsg;
+        return !series.open(path, openMsg);
+    };
+    string overflow = file, overlap = file;
+    setField(overflow, offsetof(MMIntern::MappedSeriesHeader, numTimes), (uint64_t(1) << 61) + 1);
+    setField(overlap, offsetof(MMIntern::MappedSeriesHeader, numCoordinates), numTimes);        // the same number of values,
+    setField(overlap, offsetof(MMIntern::MappedSeriesHeader, numTimes), 1);                     // but lats and lons run into them
+    const bool corruptRejected = rejected(file.substr(0, file.size() - sizeof(double))) && rejected(overflow) && rejected(overlap);
+    remove(path.c_str());
+    
+    const bool ok = readOnly && corruptRejected;
+    cout << "Mapped time series check " << (ok ? "passed" : "FAILED") << ": read-only mapping "
+         << (readOnly ? "without" : "with") << " writable values, corrupt headers " << (corruptRejected ? "rejected" : "accepted")
+         << (msg.empty() ? string() : ", " + msg) << endl;
+    cout << endl;
+    return ok;
+}
+
+
+// a failed set must neither leave partly filled frames behind nor discard the previous ones
+static bool checkTimeInterpolation()
+{
+    const vector<string> times = {"2020-01-01T00:00:00Z", "2020-01-01T01:00:00Z"};
+    const vector<string> queryTimes = {"2020-01-01T00:30:00Z"};
+    const Matrix ragged = {{1.0}, {2.0, 3.0}};
+    string msg;
+    Matrix result;
+    
+    MeteomaticsTimeInterpolator fresh;
+    const bool freshRejected = !fresh.setTimeSeries(times, ragged, vector<long>(1, 0), msg) && !fresh.interpolate(queryTimes, result, msg);
+    
+    MeteomaticsTimeInterpolator kept;
+    const bool keptValid = kept.setTimeSeries(times, {{1.0}, {3.0}}, vector<long>(1, 0), msg)
+                        && !kept.setTimeSeries(times, ragged, vector<long>(1, 0), msg)
+                        && !kept.setGridStack(times, {{{1.0, 2.0}}, {{3.0}}}, 0, msg)
+                        && kept.interpolate(queryTimes, result, msg) && result.size() == 1 && result[0].size() == 1 && result[0][0] == 2.0;
+    
+    const bool ok = freshRejected && keptValid;
+    cout << "Time interpolation check " << (ok ? "passed" : "FAILED") << ": ragged input "
+         << (freshRejected ? "rejected" : "accepted") << ", previous frames " << (keptValid ? "kept" : "lost") << endl;
+    cout << endl;
+    return ok;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc >= 3 && string(argv[1]) == "--replay")
+    {
+        benchmarkReplay(argv[2], argc >= 4 ? max(1, atoi(argv[3])) : 10);
+        return 0;
+    }
+    
+    bool checked = checkRevalidation();
+    checked = checkTimeInterpolation() && checked;
+    checked = checkPointBatcher() && checked;
+    checked = checkMappedTimeSeries() && checked;
+    if (argc == 2 && string(argv[1]) == "--check")
+    {
+        // the benchmarks comparing results, on small inputs
+        checked = benchmarkParallelDecode(500, 48, 3) && checked;
+        checked = benchmarkReduction(500, 48, 3) && checked;
+        checked = benchmarkParameterSet(500, 48) && checked;
+        checked = benchmarkCsv(500, 48, 3) && checked;
+        return checked ? 0 : 1;
+    }
+    
+    int32_t numCoords = 20000;
+    int32_t numTimes = 100;
+    int32_t numParams = 3;
+    if (argc == 4)
+    {
+        numCoords = atoi(argv[1]);
+        numTimes = atoi(argv[2]);
+        numParams = atoi(argv[3]);
+    }
+    
+    checked = benchmarkParallelDecode(numCoords, numTimes, numParams) && checked;
+    checked = benchmarkReduction(numCoords, numTimes, numParams) && checked;
+    checked = benchmarkParameterSet(numCoords, numTimes) && checked;
+    checked = benchmarkCsv(numCoords, numTimes, numParams) && checked;
+    benchmarkMemory(numTimes, numParams);
+    benchmarkResultQueue(1000000);
+    benchmarkGridStore(721, 1440);
+    benchmarkGridPyramid(721, 1440);
+    
+    return checked ? 0 : 1;
+}
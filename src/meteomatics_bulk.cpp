@@ -0,0 +1,447 @@
+//
+//  meteomatics_bulk.cpp
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+
+//
+// Bulk fetch tool: runs the jobs of a job file through a MeteomaticsPipeline within rate limits
+// and streams the results to a CSV or binary file as they complete.
+//
+// Job file, one job per line ('#' starts a comment), optionals joined by '&':
+//
+//   timeseries START STOP STEP PARAMETERS LAT,LON[+LAT,LON...] [OPTIONALS]
+//   points     TIME PARAMETERS LAT,LON[+LAT,LON...] [OPTIONALS]
+//   grid       TIME PARAMETER LAT_N,LON_W,LAT_S,LON_E NLATxNLON [OPTIONALS]
+//
+//   e.g. timeseries 2024-01-01T00:00:00Z 2024-01-02T00:00:00Z PT1H t_2m:C,precip_1h:mm 47.41,9.35+46.2,7.1 model=mix
+//
+// CSV output: one line per value  "job;lat;lon;validdate;parameter;value"
+// Binary output: one 40 byte record per value  int32 job, int32 parameter index, double lat, lon, unix time, value
+//
+// --record ARCHIVE keeps the raw responses, --replay ARCHIVE runs the jobs from them without network
+// (see MeteomaticsTransportArchive), e.g. to profile decoding with real responses on an offline machine.
+// --trace FILE writes a timeline of all requests for chrome://tracing or ui.perfetto.dev.
+//
+
+#include "Meteomatics_Pipeline.h"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+
+using namespace std;
+
+
+struct Job
+{
+    size_t id;
+    string kind;
+    string startTime;
+    string stopTime;
+    string timeStep;
+    vector<string> parameters;
+    vector<double> lats;
+    vector<double> lons;
+    int nLat;
+    int nLon;
+    vector<string> optionals;
+};
+
+struct Options
+{
+    string user;
+    string password;
+    string jobFile;
+    string output;
+    bool binary;
+    size_t concurrency;
+    double requestsPerSecond;
+    double bytesPerSecond;
+    int timeout;
+    string recordArchive;
+    string replayArchive;
+    string traceFile;
+};
+
+
+static vector<string> split(const string& str, char delimiter)
+{
+    vector<string> tokens;
+    stringstream ss(str);
+    string token;
+    while (getline(ss, token, delimiter))
+    {
+        if (!token.empty())
+            tokens.push_back(token);
+    }
+    return tokens;
+}
+
+static bool parseCoordinates(const string& str, vector<double>& lats, vector<double>& lons)
+{
+    for (const auto& pair : split(str, '+'))
+    {
+        const vector<string> c = split(pair, ',');
+        if (c.size() != 2)
+            return false;
+        lats.push_back(atof(c[0].c_str()));
+        lons.push_back(atof(c[1].c_str()));
+    }
+    return !lats.empty();
+}
+
+static bool parseJob(const string& line, size_t id, Job& job, string& msg)
+{
+    stringstream ss(line);
+    vector<string> f;
+    string token;
+    while (ss >> token)
+        f.push_back(token);
+
+    job = Job();
+    job.id = id;
+    job.kind = f[0];
+    job.nLat = job.nLon = 0;
+
+    size_t numFields = 0;
+    if (job.kind == "timeseries" && f.size() >= 6)
+    {
+        job.startTime = f[1];
+        job.stopTime = f[2];
+        job.timeStep = (f[3].size() > 1 && f[3][0] == 'P') ? f[3].substr(1) : f[3];
+        job.parameters = split(f[4], ',');
+        if (!parseCoordinates(f[5], job.lats, job.lons))
+        {
+            msg = "invalid coordinates";
+            return false;
+        }
+        numFields = 6;
+    }
+    else if (job.kind == "points" && f.size() >= 4)
+    {
+        job.startTime = job.stopTime = f[1];
+        job.parameters = split(f[2], ',');
+        if (!parseCoordinates(f[3], job.lats, job.lons))
+        {
+            msg = "invalid coordinates";
+            return false;
+        }
+        numFields = 4;
+    }
+    else if (job.kind == "grid" && f.size() >= 5)
+    {
+        job.startTime = job.stopTime = f[1];
+        job.parameters = vector<string>(1, f[2]);
+        const vector<string> box = split(f[3], ',');
+        const vector<string> size = split(f[4], 'x');
+        if (box.size() != 4 || size.size() != 2)
+        {
+            msg = "invalid grid box or size";
+            return false;
+        }
+        job.lats = {atof(box[0].c_str()), atof(box[2].c_str())};
+        job.lons = {atof(box[1].c_str()), atof(box[3].c_str())};
+        job.nLat = atoi(size[0].c_str());
+        job.nLon = atoi(size[1].c_str());
+        numFields = 5;
+    }
+    else
+    {
+        msg = "unknown job kind or missing fields";
+        return false;
+    }
+
+    if (f.size() > numFields)
+        job.optionals = split(f[numFields], '&');
+    return true;
+}
+
+static bool readJobFile(const string& path, vector<Job>& jobs)
+{
+    ifstream in(path.c_str());
+    if (!in)
+    {
+        cout << "Cannot open job file " << path << endl;
+        return false;
+    }
+
+    string line;
+    size_t lineNumber = 0;
+    while (getline(in, line))
+    {
+        lineNumber++;
+        const size_t comment = line.find('#');
+        if (comment != string::npos)
+            line.erase(comment);
+        if (line.find_first_not_of(" \t\r") == string::npos)
+            continue;
+
+        Job job;
+        string msg;
+        if (!parseJob(line, jobs.size(), job, msg))
+        {
+            cout << path << ":" << lineNumber << ": " << msg << endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+
+//
+// Writes results as they complete, one job at a time
+//
+class ResultWriter
+{
+public:
+    ResultWriter(const string& path, bool _binary)
+    : binary(_binary)
+    , out(path.c_str(), binary ? ios::binary : ios::out)
+    , numValues(0)
+    {
+        if (out && !binary)
+            out << "job;lat;lon;validdate;parameter;value\n";
+    }
+
+    bool good() const { return out.good(); }
+    size_t values() const { return numValues; }
+
+    void write(const Job& job, size_t param, double lat, double lon, const string& validdate, double value)
+    {
+        if (binary)
+        {
+            const int32_t jobId = static_cast<int32_t>(job.id);
+            const int32_t paramId = static_cast<int32_t>(param);
+            double unixTime = 0;
+            MMIntern::parseIsoTime(validdate, unixTime);
+            out.write(reinterpret_cast<const char*>(&jobId), sizeof(jobId));
+            out.write(reinterpret_cast<const char*>(&paramId), sizeof(paramId));
+            out.write(reinterpret_cast<const char*>(&lat), sizeof(lat));
+            out.write(reinterpret_cast<const char*>(&lon), sizeof(lon));
+            out.write(reinterpret_cast<const char*>(&unixTime), sizeof(unixTime));
+            out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+        else
+        {
+            out << job.id << ';' << lat << ';' << lon << ';' << validdate << ';' << job.parameters[param] << ';' << value << '\n';
+        }
+        numValues++;
+    }
+
+    mutex lock;
+
+private:
+    const bool binary;
+    ofstream out;
+    size_t numValues;
+};
+
+
+// submits a job to the pipeline, its results are written from the decode thread as soon as it is decoded
+static void submitJob(MeteomaticsPipeline& pipeline, const Job& job, ResultWriter& writer, const function<void(bool, const string&)>& done)
+{
+    if (job.kind == "grid")
+    {
+        pipeline.getGridAsync(job.startTime, job.parameters[0], job.lats[0], job.lons[0], job.lats[1], job.lons[1], job.nLat, job.nLon,
+            [&job, &writer, done](MeteomaticsGridResult& r)
+            {
+                if (r.success)
+                {
+                    lock_guard<mutex> lock(writer.lock);
+                    for (size_t i=0; i<r.gridResult.size() && i<r.latGridPts.size(); i++)
+                        for (size_t j=0; j<r.gridResult[i].size() && j<r.lonGridPts.size(); j++)
+                            writer.write(job, 0, r.latGridPts[i], r.lonGridPts[j], job.startTime, r.gridResult[i][j]);
+                }
+                done(r.success, r.msg);
+            }, job.optionals);
+        return;
+    }
+
+    // points are a time series with a single time step
+    const string timeStep = job.kind == "points" ? "T1H" : job.timeStep;
+    pipeline.getMultiPointTimeSeriesAsync(job.startTime, job.stopTime, timeStep, job.parameters, job.lats, job.lons,
+        [&job, &writer, done](MeteomaticsTimeSeriesResult& r)
+        {
+            if (r.success)
+            {
+                lock_guard<mutex> lock(writer.lock);
+                for (size_t c=0; c<r.result.size() && c<job.lats.size(); c++)
+                {
+                    const size_t numTimes = r.result[c].size();
+                    const size_t timeOffset = r.times.size() == r.result.size() * numTimes ? c * numTimes : 0;
+                    for (size_t t=0; t<numTimes; t++)
+                    {
+                        const string& validdate = timeOffset + t < r.times.size() ? r.times[timeOffset + t] : job.startTime;
+                        for (size_t p=0; p<r.result[c][t].size() && p<job.parameters.size(); p++)
+                            writer.write(job, p, job.lats[c], job.lons[c], validdate, r.result[c][t][p]);
+                    }
+                }
+            }
+            done(r.success, r.msg);
+        }, job.optionals);
+}
+
+
+static void usage()
+{
+    cout << "Usage: ./meteomatics_bulk USERNAME PASSWORD JOBFILE [options]\n"
+            "  --output FILE          result file (default: results.csv)\n"
+            "  --binary               write binary records instead of CSV\n"
+            "  --concurrency N        number of concurrent transfers (default: 4)\n"
+            "  --rate R               max requests per second (default: unlimited)\n"
+            "  --bytes-rate B         max received bytes per second (default: unlimited)\n"
+            "  --timeout S            timeout per request in seconds (default: 300)\n"
+            "  --record ARCHIVE       append the raw responses to ARCHIVE\n"
+            "  --replay ARCHIVE       serve the responses from ARCHIVE, no network\n"
+            "  --trace FILE           write a trace-event timeline of the requests to FILE" << endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    if (argc < 4)
+        return false;
+
+    options.user = argv[1];
+    options.password = argv[2];
+    options.jobFile = argv[3];
+    options.output = "results.csv";
+    options.binary = false;
+    options.concurrency = 4;
+    options.requestsPerSecond = 0;
+    options.bytesPerSecond = 0;
+    options.timeout = 300;
+
+    for (int i=4; i<argc; i++)
+    {
+        const string arg = argv[i];
+        const bool hasValue = i+1 < argc;
+        if (arg == "--binary")
+            options.binary = true;
+        else if (arg == "--output" && hasValue)
+            options.output = argv[++i];
+        else if (arg == "--concurrency" && hasValue)
+            options.concurrency = max(1, atoi(argv[++i]));
+        else if (arg == "--rate" && hasValue)
+            options.requestsPerSecond = atof(argv[++i]);
+        else if (arg == "--bytes-rate" && hasValue)
+            options.bytesPerSecond = atof(argv[++i]);
+        else if (arg == "--timeout" && hasValue)
+            options.timeout = atoi(argv[++i]);
+        else if (arg == "--record" && hasValue)
+            options.recordArchive = argv[++i];
+        else if (arg == "--replay" && hasValue)
+            options.replayArchive = argv[++i];
+        else if (arg == "--trace" && hasValue)
+            options.traceFile = argv[++i];
+        else
+            return false;
+    }
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage();
+        return 1;
+    }
+
+    vector<Job> jobs;
+    if (!readJobFile(options.jobFile, jobs))
+        return 1;
+
+    ResultWriter writer(options.output, options.binary);
+    if (!writer.good())
+    {
+        cout << "Cannot open output file " << options.output << endl;
+        return 1;
+    }
+
+    shared_ptr<MeteomaticsRateLimiter> rateLimiter;
+    if (options.requestsPerSecond > 0 || options.bytesPerSecond > 0)
+        rateLimiter = make_shared<MeteomaticsRateLimiter>(options.requestsPerSecond, options.bytesPerSecond);
+
+    shared_ptr<MeteomaticsTransportArchive> archive;
+    if (!options.recordArchive.empty() || !options.replayArchive.empty())
+    {
+        string msg;
+        archive = make_shared<MeteomaticsTransportArchive>();
+        if (!(options.replayArchive.empty() ? archive->record(options.recordArchive, msg) : archive->replay(options.replayArchive, msg)))
+        {
+            cout << msg << endl;
+            return 1;
+        }
+    }
+
+    atomic<size_t> numFailed(0);
+    vector<double> latencies(jobs.size(), 0.0);
+
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    // the I/O threads only transfer, decoding and writing happens on the decode threads
+    const size_t numDecodeThreads = max<size_t>(1, min<size_t>(options.concurrency, thread::hardware_concurrency()));
+    MeteomaticsPipeline pipeline(options.user, options.password, options.timeout, options.concurrency, numDecodeThreads, 2 * options.concurrency);
+    if (rateLimiter)
+        pipeline.setRateLimiter(rateLimiter, MeteomaticsRateLimiter::Backfill);
+    if (archive)
+        pipeline.setTransportArchive(archive);
+    shared_ptr<MeteomaticsTracer> tracer;
+    if (!options.traceFile.empty())
+    {
+        tracer = make_shared<MeteomaticsTracer>();
+        pipeline.setTracer(tracer);
+    }
+
+    for (size_t j=0; j<jobs.size(); j++)
+    {
+        const chrono::steady_clock::time_point jobStart = chrono::steady_clock::now();
+        submitJob(pipeline, jobs[j], writer, [&, j, jobStart](bool success, const string& msg)
+        {
+            if (!success)
+            {
+                numFailed++;
+                lock_guard<mutex> lock(writer.lock);
+                cout << "Job " << j << " failed: " << msg.substr(0,500) << endl;
+            }
+            latencies[j] = chrono::duration<double>(chrono::steady_clock::now() - jobStart).count();
+        });
+    }
+    pipeline.wait();
+
+    const double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    const MeteomaticsPipelineMetrics metrics = pipeline.metrics();
+
+    vector<double> sorted(latencies);
+    sort(sorted.begin(), sorted.end());
+    const auto percentile = [&sorted](double p) { return sorted.empty() ? 0.0 : sorted[min(sorted.size()-1, static_cast<size_t>(p * sorted.size()))]; };
+
+    cout << "------------------------------------------------------\n";
+    cout << "Jobs:        " << jobs.size() << " (" << numFailed << " failed)\n";
+    cout << "Values:      " << writer.values() << " written to " << options.output << "\n";
+    cout << "Wall time:   " << elapsed << " s\n";
+    cout << "Throughput:  " << jobs.size() / max(elapsed, 1e-9) << " jobs/s, " << writer.values() / max(elapsed, 1e-9) << " values/s\n";
+    cout << "Latency:     p50 " << percentile(0.5) << " s, p95 " << percentile(0.95) << " s, max " << percentile(1.0) << " s\n";
+    cout << "Queues:      transfer max " << metrics.maxTransferQueueDepth << ", decode max " << metrics.maxDecodeQueueDepth << ", " << metrics.steals << " steals\n";
+    cout << "Utilization: I/O threads " << 100.0 * metrics.ioUtilization << " %, decode threads " << 100.0 * metrics.decodeUtilization << " %\n";
+    if (archive && archive->isReplaying())
+        cout << "Archive:     " << archive->numReplayed() << " responses replayed, " << archive->numMissing() << " missing\n";
+    else if (archive)
+        cout << "Archive:     " << archive->numRecords() << " responses recorded to " << options.recordArchive << "\n";
+    string msg;
+    if (tracer && tracer->write(options.traceFile, msg))
+        cout << "Trace:       " << tracer->numEvents() << " spans written to " << options.traceFile << "\n";
+    else if (tracer)
+        cout << "Trace:       " << msg << "\n";
+    cout << "------------------------------------------------------" << endl;
+
+    return numFailed > 0 ? 2 : 0;
+}
@@ -0,0 +1,66 @@
+//
+//  meteomatics_coroutine_main.cpp
+//  MeteomaticsApi
+//
+//  Copyright © 2018 Meteomatics. All rights reserved.
+//
+
+
+//
+// Example for the C++20 coroutine interface (cmake -DMETEOMATICS_COROUTINES=ON):
+//   a single thread drives several concurrent queries by polling the client.
+//
+
+#include "Meteomatics_Async.h"
+
+#include <iostream>
+
+
+// the coroutines take their arguments by value: they outlive the temporaries they are called with
+MeteomaticsTask queryGrid(MeteomaticsAsyncClient& api_client, std::string time, std::string parameter)
+{
+    MeteomaticsGridResult grid = co_await api_client.grid(time, parameter, 50, -15, 20, 10, 50, 100);
+    if (grid.success)
+        std::cout << parameter << ": got " << grid.gridResult.size() << " x " << grid.gridResult[0].size() << " grid points" << std::endl;
+    else
+        std::cout << parameter << ": error msg = " << grid.msg.substr(0,500) << "[...]" << std::endl;
+}
+
+MeteomaticsTask queryTimeSeries(MeteomaticsAsyncClient& api_client, std::string startTime, std::string endTime, std::vector<std::string> parameters)
+{
+    const std::string timeStep = api_client.getTimeStepStr(0, 0, 0, 1, 0, 0);
+    MeteomaticsTimeSeriesResult series = co_await api_client.timeSeries(startTime, endTime, timeStep, parameters, 47.41, 9.35);
+    if (series.success)
+        std::cout << "time series: got " << series.times.size() << " time steps" << std::endl;
+    else
+        std::cout << "time series: error msg = " << series.msg.substr(0,500) << "[...]" << std::endl;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        std::cout << "Usage: ./meteomatics_coroutines USERNAME PASSWORD" << std::endl;
+        return 0;
+    }
+    
+    const int timeout=300;
+    MeteomaticsAsyncClient api_client(argv[1], argv[2], timeout);
+    
+    const int year = api_client.getCurrentYear();
+    const int month = api_client.getCurrentMonth();
+    const int day = api_client.getCurrentDay();
+    const std::string startTime = api_client.getIsoTimeStr(year, month, day, 0, 0, 0);
+    const std::string endTime = api_client.getIsoTimeStr(api_client.getTomorrowsYear(), api_client.getTomorrowsMonth(), api_client.getTomorrow(), 0, 0, 0);
+    
+    std::vector<MeteomaticsTask> tasks;
+    tasks.push_back(queryGrid(api_client, startTime, "t_2m:C"));
+    tasks.push_back(queryGrid(api_client, startTime, "msl_pressure:hPa"));
+    tasks.push_back(queryTimeSeries(api_client, startTime, endTime, {"t_2m:C", "precip_1h:mm"}));
+    
+    // all queries are in flight now, this thread drives them until every coroutine finished
+    api_client.run();
+    
+    return 0;
+}
@@ -12,6 +12,13 @@
 //
 
 #include "Meteomatics_ApiClient.h"
+#include "Meteomatics_CachingClient.h"
+#include "Meteomatics_GridPyramid.h"
+#include "Meteomatics_Interpolation.h"
+#include "Meteomatics_MappedResult.h"
+#include "Meteomatics_ParameterSet.h"
+#include "Meteomatics_Reduction.h"
+#include "Meteomatics_SharedGridCache.h"
 
 #include <iostream>
 
@@ -19,6 +26,12 @@
 using namespace std;
 
 
+// a parameter set fixed at compile time, for the typed getters
+METEOMATICS_PARAMETER(T2m, "t_2m:C");
+METEOMATICS_PARAMETER(Precip1h, "precip_1h:mm");
+typedef MeteomaticsParameterSet<T2m, Precip1h> Weather;
+
+
 int main(int argc, char* argv[])
 {
     bool success = false;
@@ -40,6 +53,9 @@ int main(int argc, char* argv[])
     const int timeout=300;
     MeteomaticsApiClient api_client(user, password, timeout);
     
+    // Optional: resolve the server and open connections ahead of the first query
+    api_client.warmUp(2);
+    
     
     // Parameters
     //
@@ -171,8 +187,21 @@ int main(int argc, char* argv[])
     }
     else
         std::cout << "Error msg = " << msg.substr(0,500) << "[...]" << std::endl << std::endl;
-    
-    
+
+    FloatMatrix floatGridResult;                            // same grid in single precision, half the memory
+
+    success = api_client.getGrid(singleTime, parameters[0], lat_N, lon_W, lat_S, lon_E, nLatPts, nLonPts, floatGridResult, latGridPts, lonGridPts, msg);
+
+    if (success)
+    {
+        std::cout << "Float Grid Result (1 entry shown): " << std::endl;
+        std::cout << "(" << latGridPts[0] << "," << lonGridPts[0] << ")  " << floatGridResult[0][0] << std::endl << std::endl;
+        success = false;
+    }
+    else
+        std::cout << "Error msg = " << msg.substr(0,500) << "[...]" << std::endl << std::endl;
+
+
     //
     // MultiTimePoints (multiple coordinates, multiple time, one or more parameters)
     //
@@ -231,5 +260,134 @@ int main(int argc, char* argv[])
     else
         std::cout << "Error msg = " << msg.substr(0,500) << "[...]" << std::endl << std::endl;
 
+
+    //
+    // Out-of-core Multi Point Time Series (written into a memory-mapped file, one window of coordinates per request)
+    //
+    MeteomaticsMappedTimeSeries mappedSeries;
+    if (mappedSeries.create("meteomatics_series.mmts", parameters, lats, lons, startTime, endTime, 3600, msg))
+    {
+        success = true;
+        for (std::size_t first=0; first<lats.size() && success; first+=2)         // e.g. two coordinates per request
+        {
+            success = api_client.getMultiPointTimeSeries(mappedSeries, first, std::min<std::size_t>(2, lats.size() - first), 0, mappedSeries.numTimes(), msg);
+        }
+        if (success && mappedSeries.flush() && mappedSeries.open("meteomatics_series.mmts", msg))      // reopening maps, nothing is read
+        {
+            std::cout << "Mapped series " << mappedSeries.parameter(0) << " at (" << mappedSeries.lat(0) << "," << mappedSeries.lon(0) << "): "
+                      << mappedSeries.values(0, 0)[0] << " ... " << mappedSeries.values(0, 0)[mappedSeries.numTimes() - 1] << std::endl << std::endl;
+        }
+        else
+            std::cout << "Error msg = " << msg.substr(0,500) << "[...]" << std::endl << std::endl;
+        success = false;
+    }
+    else
+        std::cout << "Error msg = " << msg.substr(0,500) << "[...]" << std::endl << std::endl;
+
+
+    //
+    // Typed Time Series (parameter list joined at compile time, each time decoded into a Weather::Row)
+    //
+    std::vector<Weather::Row> weatherRows;
+    if (api_client.getTimeSeries<Weather>(startTime, endTime, timeStep, lat_N, lon_E, weatherRows, returnTimes, msg) && !weatherRows.empty())
+    {
+        std::cout << "Typed Time Series (" << Weather::fragment() << "): " << returnTimes[0] << " "
+                  << Weather::get<T2m>(weatherRows[0]) << " " << Weather::get<Precip1h>(weatherRows[0]) << std::endl << std::endl;
+    }
+    else
+        std::cout << "Error msg = " << msg.substr(0,500) << "[...]" << std::endl << std::endl;
+
+
+    //
+    // Aggregates (computed while decoding, the individual values are never stored)
+    //
+    MeteomaticsReduction dailyStats;
+    dailyStats.add(MeteomaticsReduction::Min).add(MeteomaticsReduction::Max).add(MeteomaticsReduction::Mean).setTimeBuckets(86400);
+    if (api_client.getMultiPointTimeSeries(startTime, endTime, timeStep, parameters, lats, lons, dailyStats, msg) && !dailyStats.results().empty())
+    {
+        const MeteomaticsAggregate& first = dailyStats.results()[0];
+        std::cout << "Daily " << parameters[first.parameter] << " at (" << lats[first.coordinate] << "," << lons[first.coordinate] << "): min "
+                  << first.values[0] << ", max " << first.values[1] << ", mean " << first.values[2] << " of " << first.numValues << " values, "
+                  << dailyStats.results().size() << " aggregates" << std::endl;
+    }
+    else
+        std::cout << "Error msg = " << msg.substr(0,500) << "[...]" << std::endl << std::endl;
+
+    MeteomaticsReduction areaStats;
+    areaStats.add(MeteomaticsReduction::AreaMean).add(MeteomaticsReduction::Percentile, 95);
+    if (api_client.getGrid(singleTime, parameters[0], lat_N, lon_W, lat_S, lon_E, nLatPts, nLonPts, areaStats, msg))
+    {
+        std::cout << "Grid " << parameters[0] << ": area mean " << areaStats.results()[0].values[0] << ", 95th percentile " << areaStats.results()[0].values[1] << std::endl << std::endl;
+    }
+    else
+        std::cout << "Error msg = " << msg.substr(0,500) << "[...]" << std::endl << std::endl;
+
+
+    //
+    // Local Interpolation (points served from the grid queried above, no further request)
+    //
+    MeteomaticsInterpolationEngine interpolationEngine;
+    Matrix referenceResult;
+    if (!gridResult.empty() && interpolationEngine.addGrid(gridResult, latGridPts, lonGridPts, msg)
+        && api_client.getMultiPoints(singleTime, std::vector<std::string>(1, parameters[0]), lats, lons, referenceResult, msg))
+    {
+        std::vector<double> interpolated;
+        std::vector<bool> covered;
+        interpolationEngine.interpolate(lats, lons, interpolated, covered, MeteomaticsInterpolationEngine::Bilinear);
+        
+        const MeteomaticsInterpolationEngine::ErrorReport report = MeteomaticsInterpolationEngine::compare(interpolated, referenceResult, 0);
+        std::cout << "Local Interpolation Error vs. Multi Points (" << parameters[0] << "): " << std::endl;
+        std::cout << "max abs = " << report.maxAbsError << ", rms = " << report.rmsError << ", bias = " << report.bias << std::endl;
+    }
+    else
+        std::cout << "Error msg = " << msg.substr(0,500) << "[...]" << std::endl << std::endl;
+
+
+    //
+    // Zoom levels (coarser grids derived locally from the finest one, no further request)
+    //
+    MeteomaticsGridPyramid pyramid(MeteomaticsGridPyramid::Mean);
+    if (!gridResult.empty() && pyramid.build(gridResult, latGridPts, lonGridPts, msg))
+    {
+        Matrix region;
+        std::vector<double> regionLats, regionLons;
+        size_t level = 0;
+        pyramid.getGrid(lat_N, lon_W, lat_S, lon_E, nLatPts / 4, nLonPts / 4, region, regionLats, regionLons, level);
+        std::cout << "Grid Pyramid: " << pyramid.numLevels() << " levels, " << nLatPts / 4 << " x " << nLonPts / 4 << " requested, served "
+                  << region.size() << " x " << (region.empty() ? 0 : region[0].size()) << " from level " << level << std::endl << std::endl;
+    }
+    else
+        std::cout << "Error msg = " << msg.substr(0,500) << "[...]" << std::endl << std::endl;
+
+
+    //
+    // Re-polling a grid (unchanged grids are revalidated, not downloaded again)
+    //
+    MeteomaticsCachingClient caching_client(user, password, timeout);
+    caching_client.setModelRunSchedule(1, 0.5);             // e.g. hourly runs, available after 30 minutes
+    for (int poll=0; poll<3; poll++)
+    {
+        if (!caching_client.getGridCached(singleTime, parameters[0], lat_N, lon_W, lat_S, lon_E, nLatPts, nLonPts, gridResult, latGridPts, lonGridPts, msg))
+            std::cout << "Error msg = " << msg.substr(0,500) << "[...]" << std::endl << std::endl;
+    }
+    std::cout << "Grid polled 3 times: " << caching_client.numDownloads() << " downloads, " << caching_client.numNotModified() << " not modified, "
+              << caching_client.numSkipped() << " skipped, " << caching_client.bytesReceived() << " bytes" << std::endl;
+
+
+    //
+    // Sharing grids between processes (every process on the host using the segment reads the same copy)
+    //
+    MeteomaticsSharedGridCache shared_cache(user, password, timeout);
+    MeteomaticsSharedGridView view;
+    if (shared_cache.getGridView(singleTime, parameters[0], lat_N, lon_W, lat_S, lon_E, nLatPts, nLonPts, view, msg) && view.numLat > 0 && view.numLon > 0)
+    {
+        const double value = view.value(0, 0);
+        if (view.stillValid())
+            std::cout << "Shared grid (" << view.latGridPts[0] << "," << view.lonGridPts[0] << ")  " << value << ", "
+                      << shared_cache.numHits() << " hits, " << shared_cache.numFetched() << " fetched" << std::endl;
+    }
+    else
+        std::cout << "Error msg = " << msg.substr(0,500) << "[...]" << std::endl << std::endl;
+
     return 0;
 }